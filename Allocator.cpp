@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "Allocator.h"
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+Allocator &Allocator::get() {
+  static Allocator allocator;
+  return allocator;
+}
+
+void *Allocator::allocate(size_t size, size_t alignment) {
+  if (alignment < this->alignment) {
+    alignment = this->alignment;
+  }
+  if (alignment < sizeof(void *)) {
+    alignment = sizeof(void *);
+  }
+  // Some implementations require the size to be a multiple of the alignment.
+  size = (size + alignment - 1) / alignment * alignment;
+  if (size == 0) {
+    size = alignment;
+  }
+
+  bool large = size >= HugePageSize;
+#ifdef __linux__
+  if (large && hugePages == HugePagesExplicit) {
+    size_t mapped = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+    void *ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ptr != MAP_FAILED) {
+      mappings[ptr] = mapped;
+      return ptr;
+    }
+    // No huge pages reserved, fall back to normal pages.
+    fallbacks++;
+  }
+  if (large && hugePages == HugePagesTransparent) {
+    // madvise() needs the memory to start and end at a huge page boundary.
+    alignment = HugePageSize;
+    size = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+  }
+#endif
+
+  void *ptr;
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    std::cerr << "Could not allocate aligned memory!" << std::endl;
+    std::exit(1);
+  }
+
+#ifdef __linux__
+  if (large && hugePages == HugePagesTransparent) {
+    // Failing is not fatal, the memory is just backed by normal pages.
+    madvise(ptr, size, MADV_HUGEPAGE);
+  }
+#endif
+
+  return ptr;
+}
+
+void Allocator::deallocate(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+#ifdef __linux__
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = mappings.find(ptr);
+    if (it != mappings.end()) {
+      munmap(ptr, it->second);
+      mappings.erase(it);
+      return;
+    }
+  }
+#endif
+
+  std::free(ptr);
+}
+
+DTLBMissCounter::~DTLBMissCounter() {
+#ifdef __linux__
+  for (auto &thread : fds) {
+    close(thread.second);
+  }
+#endif
+}
+
+void DTLBMissCounter::openThreads() {
+#ifdef __linux__
+  DIR *tasks = opendir("/proc/self/task");
+  if (tasks == NULL) {
+    return;
+  }
+
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  struct dirent *entry;
+  while ((entry = readdir(tasks)) != NULL) {
+    char *end;
+    int tid = std::strtol(entry->d_name, &end, 10);
+    if (*end != 0 || tid <= 0 || fds.count(tid) != 0) {
+      continue;
+    }
+
+    // The counter of an exited thread keeps its final value.
+    int fd = syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+    if (fd != -1) {
+      fds[tid] = fd;
+    }
+  }
+  closedir(tasks);
+#endif
+}
+
+bool DTLBMissCounter::open() {
+  openThreads();
+  return isOpen();
+}
+
+long long DTLBMissCounter::read() {
+#ifdef __linux__
+  if (!isOpen()) {
+    return -1;
+  }
+  openThreads();
+
+  long long sum = 0;
+  for (auto &thread : fds) {
+    long long value;
+    if (::read(thread.second, &value, sizeof(value)) != sizeof(value)) {
+      return -1;
+    }
+    sum += value;
+  }
+  return sum;
+#else
+  return -1;
+#endif
+}
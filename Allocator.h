@@ -0,0 +1,120 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+
+/// Allocator for all large arrays on the host, with configurable alignment
+/// and huge pages.
+class Allocator {
+public:
+  /// Pages to back large allocations with.
+  enum HugePages {
+    /// Let the system decide.
+    HugePagesNone,
+    /// Advise the kernel to use transparent huge pages.
+    HugePagesTransparent,
+    /// Map explicit huge pages, falling back if none are available.
+    HugePagesExplicit,
+  };
+
+  /// Default alignment, the size of a cache line.
+  static const size_t DefaultAlignment = 64;
+  /// Size of a huge page.
+  static const size_t HugePageSize = 2 * 1024 * 1024;
+
+private:
+  size_t alignment = DefaultAlignment;
+  HugePages hugePages = HugePagesNone;
+
+  /// Sizes of the mappings with explicit huge pages.
+  std::map<void *, size_t> mappings;
+  /// Number of allocations that could not get explicit huge pages.
+  int fallbacks = 0;
+  std::mutex mutex;
+
+  Allocator() = default;
+
+public:
+  /// @return the allocator for this process.
+  static Allocator &get();
+
+  /// @return the alignment of all allocations.
+  size_t getAlignment() const { return alignment; }
+  /// Set the \a alignment of all allocations, must be a power of two.
+  void setAlignment(size_t alignment) { this->alignment = alignment; }
+  /// @return the kind of huge pages to use.
+  HugePages getHugePages() const { return hugePages; }
+  /// Set the kind of \a hugePages to use.
+  void setHugePages(HugePages hugePages) { this->hugePages = hugePages; }
+  /// @return the number of allocations that did not get explicit huge pages.
+  int getFallbacks() const { return fallbacks; }
+
+  /// @return memory for \a size bytes, aligned to at least \a alignment.
+  void *allocate(size_t size, size_t alignment = 0);
+  /// Free memory returned by allocate().
+  void deallocate(void *ptr);
+
+  /// @return memory for \a count elements of type \a T.
+  template <class T> T *allocate(size_t count, size_t alignment = 0) {
+    return static_cast<T *>(allocate(sizeof(T) * count, alignment));
+  }
+};
+
+/// Deleter for std::unique_ptr of memory from the Allocator.
+struct AllocatorDeleter {
+  void operator()(void *ptr) const { Allocator::get().deallocate(ptr); }
+};
+/// Array of \a T allocated by the Allocator.
+template <class T> using AllocatedArray = std::unique_ptr<T[], AllocatorDeleter>;
+
+/// @return an array of \a count elements of type \a T from the Allocator.
+template <class T> AllocatedArray<T> allocateArray(size_t count) {
+  return AllocatedArray<T>(Allocator::get().allocate<T>(count));
+}
+
+/// Counter for the dTLB misses of all threads of this process. Counts of
+/// inherited counters only reach the parent when a thread exits, so there is
+/// one counter per thread instead. Threads started later (for example by
+/// OpenMP) are only counted from the next call to read() on.
+class DTLBMissCounter {
+  /// Counters by thread id.
+  std::map<int, int> fds;
+
+  /// Open counters for the threads without one.
+  void openThreads();
+
+public:
+  ~DTLBMissCounter();
+
+  /// Open the counters.
+  /// @return \a true if the counter is supported.
+  bool open();
+  /// @return \a true if the counter is open.
+  bool isOpen() const { return !fds.empty(); }
+  /// @return the current value of the counter summed over all threads, -1 if
+  /// not open.
+  long long read();
+};
+
+#endif
@@ -24,9 +24,14 @@
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <type_traits>
+
+#include <unistd.h>
 
 #include "CG.h"
 #include "Matrix.h"
+#include "Server.h"
+#include "VectorIO.h"
 #include "WorkDistribution.h"
 
 const char *CG_MAX_ITER = "CG_MAX_ITER";
@@ -45,9 +50,91 @@ const char *CG_PRECONDITIONER_JACOBI = "jacobi";
 const char *CG_WORK_DISTRIBUTION = "CG_WORK_DISTRIBUTION";
 const char *CG_WORK_DISTRIBUTION_BY_ROW = "row";
 const char *CG_WORK_DISTRIBUTION_BY_NZ = "nz";
+const char *CG_WORK_DISTRIBUTION_CALIBRATED = "calibrated";
 
 const char *CG_OVERLAPPED_GATHER = "CG_OVERLAPPED_GATHER";
 
+const char *CG_REBALANCE = "CG_REBALANCE";
+const char *CG_REBALANCE_THRESHOLD = "CG_REBALANCE_THRESHOLD";
+
+const char *CG_ALIGNMENT = "CG_ALIGNMENT";
+const char *CG_HUGE_PAGES = "CG_HUGE_PAGES";
+const char *CG_HUGE_PAGES_NONE = "none";
+const char *CG_HUGE_PAGES_TRANSPARENT = "transparent";
+const char *CG_HUGE_PAGES_EXPLICIT = "explicit";
+
+const char *CG_FUSED_SOLVE = "CG_FUSED_SOLVE";
+const char *CG_SPECIALIZED_SOLVE = "CG_SPECIALIZED_SOLVE";
+const char *CG_RESIDUAL_CHECK_INTERVAL = "CG_RESIDUAL_CHECK_INTERVAL";
+
+const char *CG_RHS = "CG_RHS";
+const char *CG_SOLUTION_FILE = "CG_SOLUTION_FILE";
+
+const char *CG_PRECISION = "CG_PRECISION";
+const char *CG_PRECISION_FLOAT = "float";
+const char *CG_PRECISION_DOUBLE = "double";
+const char *CG_PRECISION_LONG_DOUBLE = "long_double";
+
+/// @return the name of the precision that floatType has in this executable.
+static const char *getPrecisionName() {
+  if (std::is_same<floatType, float>::value) {
+    return CG_PRECISION_FLOAT;
+  } else if (std::is_same<floatType, long double>::value) {
+    return CG_PRECISION_LONG_DOUBLE;
+  }
+  return CG_PRECISION_DOUBLE;
+}
+
+/// @return the suffix of the executable built for \a precision.
+static std::string getPrecisionSuffix(const std::string &precision) {
+  if (precision == CG_PRECISION_DOUBLE) {
+    return "";
+  }
+  return "_" + precision;
+}
+
+/// Execute the binary built for the precision requested in CG_PRECISION if it
+/// differs from this one. Returns only if no other precision is requested.
+static void execPrecision(char *argv[]) {
+  const char *env = std::getenv(CG_PRECISION);
+  if (env == NULL || *env == 0) {
+    return;
+  }
+
+  std::string lower(env);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if (lower != CG_PRECISION_FLOAT && lower != CG_PRECISION_DOUBLE &&
+      lower != CG_PRECISION_LONG_DOUBLE) {
+    std::cerr << "Invalid value for " << CG_PRECISION << "! ("
+              << CG_PRECISION_FLOAT << ", " << CG_PRECISION_DOUBLE << ", or "
+              << CG_PRECISION_LONG_DOUBLE << ")" << std::endl;
+    std::exit(1);
+  }
+  if (lower == getPrecisionName()) {
+    return;
+  }
+
+  // The executables only differ in their suffix, for example cg_omp_float.
+  std::string path = argv[0];
+  std::string suffix = getPrecisionSuffix(getPrecisionName());
+  if (!suffix.empty() && path.size() > suffix.size() &&
+      path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0) {
+    path.erase(path.size() - suffix.size());
+  }
+  path += getPrecisionSuffix(lower);
+
+  execvp(path.c_str(), argv);
+  std::cerr << "No support for precision " << lower << "!" << std::endl;
+  std::exit(1);
+}
+
+void CG::invalidEnvironment() {
+  if (throwInvalidEnvironment) {
+    throw InvalidEnvironment();
+  }
+  std::exit(1);
+}
+
 void CG::parseEnvironment() {
   const char *env;
   char *endptr;
@@ -60,7 +147,7 @@ void CG::parseEnvironment() {
       this->maxIterations = maxIterations;
     } else {
       std::cerr << "Invalid value for " << CG_MAX_ITER << "!" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
   }
 
@@ -72,7 +159,7 @@ void CG::parseEnvironment() {
       this->tolerance = tolerance;
     } else {
       std::cerr << "Invalid value for " << CG_TOLERANCE << "!" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
   }
 
@@ -85,7 +172,7 @@ void CG::parseEnvironment() {
     } else {
       std::cerr << "Invalid value for " << CG_CHECK_TOLERANCE << "!"
                 << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
   }
 
@@ -104,12 +191,12 @@ void CG::parseEnvironment() {
       std::cerr << "Invalid value for " << CG_MATRIX_FORMAT << "! ("
                 << CG_MATRIX_FORMAT_COO << ", " << CG_MATRIX_FORMAT_CRS
                 << ", or " << CG_MATRIX_FORMAT_ELL << ")" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
 
     if (!supportsMatrixFormat(matrixFormat)) {
       std::cerr << "No support for this matrix format!" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
   }
 
@@ -126,13 +213,13 @@ void CG::parseEnvironment() {
       std::cerr << "Invalid value for " << CG_PRECONDITIONER << "! ("
                 << CG_PRECONDITIONER_NONE << ", or " << CG_PRECONDITIONER_JACOBI
                 << ")" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
 
     if (preconditioner != PreconditionerNone &&
         !supportsPreconditioner(preconditioner)) {
       std::cerr << "No support for this preconditioner!" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
     }
   }
 
@@ -145,11 +232,20 @@ void CG::parseEnvironment() {
       workDistributionCalc = WorkDistributionByRow;
     } else if (lower == CG_WORK_DISTRIBUTION_BY_NZ) {
       workDistributionCalc = WorkDistributionByNz;
+    } else if (lower == CG_WORK_DISTRIBUTION_CALIBRATED) {
+      workDistributionCalc = WorkDistributionCalibrated;
     } else {
       std::cerr << "Invalid value for " << CG_WORK_DISTRIBUTION << "! ("
-                << CG_WORK_DISTRIBUTION_BY_ROW << ", or "
-                << CG_WORK_DISTRIBUTION_BY_NZ << ")" << std::endl;
-      std::exit(1);
+                << CG_WORK_DISTRIBUTION_BY_ROW << ", "
+                << CG_WORK_DISTRIBUTION_BY_NZ << ", or "
+                << CG_WORK_DISTRIBUTION_CALIBRATED << ")" << std::endl;
+      invalidEnvironment();
+    }
+    if (workDistributionCalc == WorkDistributionCalibrated &&
+        !supportsCalibration()) {
+      std::cerr << "No support for calibrated work distribution!"
+                << std::endl;
+      invalidEnvironment();
     }
   }
 
@@ -159,8 +255,119 @@ void CG::parseEnvironment() {
     if (overlappedGather &&
         (getNumberOfChunks() == -1 || !supportsOverlappedGather())) {
       std::cerr << "No support for overlapped gather!" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_REBALANCE);
+  if (env != NULL && *env != 0) {
+    errno = 0;
+    int rebalanceIterations = strtol(env, &endptr, 0);
+    if (errno == 0 && *endptr == 0 && rebalanceIterations >= 0) {
+      this->rebalanceIterations = rebalanceIterations;
+    } else {
+      std::cerr << "Invalid value for " << CG_REBALANCE << "!" << std::endl;
+      invalidEnvironment();
+    }
+    if (rebalanceIterations > 0 &&
+        (getNumberOfChunks() == -1 || !supportsRebalance())) {
+      std::cerr << "No support for rebalancing!" << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_REBALANCE_THRESHOLD);
+  if (env != NULL && *env != 0) {
+    errno = 0;
+    double rebalanceThreshold = strtod(env, &endptr);
+    if (errno == 0 && *endptr == 0 && rebalanceThreshold >= 0) {
+      this->rebalanceThreshold = rebalanceThreshold;
+    } else {
+      std::cerr << "Invalid value for " << CG_REBALANCE_THRESHOLD << "!"
+                << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  Allocator &allocator = Allocator::get();
+  env = std::getenv(CG_ALIGNMENT);
+  if (env != NULL && *env != 0) {
+    errno = 0;
+    long alignment = strtol(env, &endptr, 0);
+    // The alignment must be a power of two.
+    if (errno == 0 && *endptr == 0 && alignment > 0 &&
+        (alignment & (alignment - 1)) == 0) {
+      allocator.setAlignment(alignment);
+    } else {
+      std::cerr << "Invalid value for " << CG_ALIGNMENT << "!" << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_HUGE_PAGES);
+  if (env != NULL && *env != 0) {
+    std::string lower(env);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower == CG_HUGE_PAGES_NONE) {
+      allocator.setHugePages(Allocator::HugePagesNone);
+    } else if (lower == CG_HUGE_PAGES_TRANSPARENT) {
+      allocator.setHugePages(Allocator::HugePagesTransparent);
+    } else if (lower == CG_HUGE_PAGES_EXPLICIT) {
+      allocator.setHugePages(Allocator::HugePagesExplicit);
+    } else {
+      std::cerr << "Invalid value for " << CG_HUGE_PAGES << "! ("
+                << CG_HUGE_PAGES_NONE << ", " << CG_HUGE_PAGES_TRANSPARENT
+                << ", or " << CG_HUGE_PAGES_EXPLICIT << ")" << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  // Open the counters early, threads started later are added by each read.
+  dTLBMissCounter.open();
+
+  env = std::getenv(CG_FUSED_SOLVE);
+  if (env != NULL && *env != 0) {
+    fusedSolve = (std::string(env) != "0");
+    if (fusedSolve && !supportsFusedSolve()) {
+      std::cerr << "No support for fused solve!" << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_SPECIALIZED_SOLVE);
+  if (env != NULL && *env != 0) {
+    specializedSolve = (std::string(env) != "0");
+    if (specializedSolve && !supportsSpecializedSolve()) {
+      std::cerr << "No support for specialized solve!" << std::endl;
+      invalidEnvironment();
     }
+  } else if (specializedSolve && !supportsSpecializedSolve()) {
+    // Enabled by default, but not for this matrix format.
+    specializedSolve = false;
+  }
+
+  env = std::getenv(CG_RESIDUAL_CHECK_INTERVAL);
+  if (env != NULL && *env != 0) {
+    errno = 0;
+    int residualCheckInterval = strtol(env, &endptr, 0);
+    if (errno == 0 && *endptr == 0 && residualCheckInterval > 0) {
+      this->residualCheckInterval = residualCheckInterval;
+    } else {
+      std::cerr << "Invalid value for " << CG_RESIDUAL_CHECK_INTERVAL << "!"
+                << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_RHS);
+  if (env != NULL && *env != 0) {
+    rhsFile = env;
+  }
+
+  env = std::getenv(CG_SOLUTION_FILE);
+  if (env != NULL && *env != 0) {
+    solutionFile = env;
   }
 }
 
@@ -180,10 +387,22 @@ void CG::allocatePartitionedMatrixELL() {
   partitionedMatrixELL.reset(new PartitionedMatrixELL);
 }
 void CG::allocateJacobi() { jacobi.reset(new Jacobi); }
-void CG::allocateK() { k = new floatType[N]; }
-void CG::deallocateK() { delete[] k; }
-void CG::allocateX() { x = new floatType[N]; }
-void CG::deallocateX() { delete[] x; }
+void CG::allocateK() { k = Allocator::get().allocate<floatType>(N); }
+void CG::deallocateK() { Allocator::get().deallocate(k); }
+void CG::allocateX() { x = Allocator::get().allocate<floatType>(N); }
+void CG::deallocateX() { Allocator::get().deallocate(x); }
+
+void CG::initK() {
+  std::memset(k, 0, sizeof(floatType) * N);
+  for (int i = 0; i < nz; i++) {
+    k[matrixCOO->I[i]] += matrixCOO->V[i];
+  }
+}
+void CG::initX() { std::memset(x, 0, sizeof(floatType) * N); }
+floatType *CG::allocateVector() {
+  return Allocator::get().allocate<floatType>(N);
+}
+void CG::deallocateVector(floatType *v) { Allocator::get().deallocate(v); }
 
 // -----------------------------------------------------------------------------
 
@@ -194,9 +413,13 @@ void CG::init(const char *matrixFile) {
   // Copy over size of read matrix.
   N = matrixCOO->N;
   nz = matrixCOO->nz;
+  if (refreshable) {
+    structureHash = matrixCOO->getStructureHash();
+  }
 
   // We count everything from now on as converting!
   auto startConverting = now();
+  long long startDTLBMisses = dTLBMissCounter.read();
 
   // Does this implementation need a work distribution?
   int numberOfChunks = getNumberOfChunks();
@@ -210,11 +433,19 @@ void CG::init(const char *matrixFile) {
       workDistribution.reset(
           WorkDistribution::calculateByNz(*matrixCOO, numberOfChunks));
       break;
+    case WorkDistributionCalibrated: {
+      std::unique_ptr<WorkDistribution::Cost[]> costs(
+          new WorkDistribution::Cost[numberOfChunks]);
+      calibrate(costs.get());
+      workDistribution.reset(WorkDistribution::calculateByCost(
+          *matrixCOO, numberOfChunks, costs.get()));
+      break;
+    }
     }
   }
 
   // Eventually transform the matrix into requested format.
-  switch (matrixFormat) {
+  switch (getHostMatrixFormat()) {
   case MatrixFormatCOO:
     // Nothing to be done.
     assert(numberOfChunks == -1);
@@ -223,34 +454,32 @@ void CG::init(const char *matrixFile) {
     if (numberOfChunks == -1) {
       std::cout << "Converting matrix to CRS format..." << std::endl;
       allocateMatrixCRS();
+      matrixCRS->recordValueMap = refreshable;
       matrixCRS->convert(*matrixCOO);
     } else if (!overlappedGather) {
       std::cout << "Converting and splitting matrix in CRS format..."
                 << std::endl;
-      allocateSplitMatrixCRS();
-      splitMatrixCRS->convert(*matrixCOO, *workDistribution);
+      splitMatrix();
     } else {
       std::cout << "Converting and partitioning matrix in CRS format..."
                 << std::endl;
-      allocatePartitionedMatrixCRS();
-      partitionedMatrixCRS->convert(*matrixCOO, *workDistribution);
+      splitMatrix();
     }
     break;
   case MatrixFormatELL:
     if (numberOfChunks == -1) {
       std::cout << "Converting matrix to ELL format..." << std::endl;
       allocateMatrixELL();
+      matrixELL->recordValueMap = refreshable;
       matrixELL->convert(*matrixCOO);
     } else if (!overlappedGather) {
       std::cout << "Converting and splitting matrix in ELL format..."
                 << std::endl;
-      allocateSplitMatrixELL();
-      splitMatrixELL->convert(*matrixCOO, *workDistribution);
+      splitMatrix();
     } else {
       std::cout << "Converting and partitioning matrix in ELL format..."
                 << std::endl;
-      allocatePartitionedMatrixELL();
-      partitionedMatrixELL->convert(*matrixCOO, *workDistribution);
+      splitMatrix();
     }
     break;
   }
@@ -267,25 +496,99 @@ void CG::init(const char *matrixFile) {
   }
 
   timing.converting = now() - startConverting;
+  timing.convertingDTLBMisses = dTLBMissesSince(startDTLBMisses);
   timing.io = now() - startIO;
 
   allocateK();
-  // Init k so that the solution is (1, ..., 1)^T
-  std::memset(k, 0, sizeof(floatType) * N);
-  for (int i = 0; i < nz; i++) {
-    k[matrixCOO->I[i]] += matrixCOO->V[i];
+  if (!rhsFile.empty()) {
+    std::cout << "Reading right-hand side from " << rhsFile << "..."
+              << std::endl;
+    auto startRHS = now();
+    if (!readVector(rhsFile.c_str(), N, k)) {
+      std::exit(1);
+    }
+    timing.io += now() - startRHS;
+  } else {
+    initK();
   }
 
   allocateX();
-  // Start with (0, ..., 0)^T
-  std::memset(x, 0, sizeof(floatType) * N);
+  initX();
 
-  if (matrixFormat != MatrixFormatCOO) {
+  vectors.init([this] { return allocateVector(); },
+               [this](floatType *v) { deallocateVector(v); });
+  vectors.adopt(VectorK, k);
+  vectors.adopt(VectorX, x);
+
+  if (matrixFormat != MatrixFormatCOO && rebalanceIterations == 0) {
     // Release matrixCOO which is not needed anymore.
     matrixCOO.reset();
   }
 }
 
+void CG::splitMatrix() {
+  switch (getHostMatrixFormat()) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      allocateSplitMatrixCRS();
+      splitMatrixCRS->recordValueMap = refreshable;
+      splitMatrixCRS->convert(*matrixCOO, *workDistribution);
+    } else {
+      allocatePartitionedMatrixCRS();
+      partitionedMatrixCRS->recordValueMap = refreshable;
+      partitionedMatrixCRS->convert(*matrixCOO, *workDistribution);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      allocateSplitMatrixELL();
+      splitMatrixELL->recordValueMap = refreshable;
+      splitMatrixELL->convert(*matrixCOO, *workDistribution);
+    } else {
+      allocatePartitionedMatrixELL();
+      partitionedMatrixELL->recordValueMap = refreshable;
+      partitionedMatrixELL->convert(*matrixCOO, *workDistribution);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+}
+
+void CG::rebalance() {
+  time_point start = now();
+  int numberOfChunks = workDistribution->numberOfChunks;
+  std::unique_ptr<double[]> times(new double[numberOfChunks]);
+  getChunkTimes(times.get());
+
+  double maxTime = 0, totalTime = 0;
+  for (int c = 0; c < numberOfChunks; c++) {
+    maxTime = std::max(maxTime, times[c]);
+    totalTime += times[c];
+  }
+  imbalance = 0;
+  if (totalTime > 0) {
+    imbalance = maxTime / (totalTime / numberOfChunks) - 1;
+  }
+  // Hysteresis: Moving rows costs more than small differences.
+  if (imbalance <= rebalanceThreshold) {
+    timing.rebalance += now() - start;
+    return;
+  }
+
+  std::unique_ptr<WorkDistribution> old = std::move(workDistribution);
+  workDistribution.reset(
+      WorkDistribution::calculateByThroughput(*matrixCOO, *old, times.get()));
+  movedRows = workDistribution->countMovedRows(*old);
+  if (movedRows == 0) {
+    workDistribution = std::move(old);
+  } else {
+    splitMatrix();
+    migrateChunks(*old);
+  }
+  timing.rebalance += now() - start;
+}
+
 // #define DEBUG_SOLVE
 /// Based on "Methods of Conjugate Gradients for Solving Linear Systems"
 /// (http://nvlpubs.nist.gov/nistpubs/jres/049/jresv49n6p409_A1b.pdf)
@@ -296,6 +599,10 @@ void CG::init(const char *matrixFile) {
 void CG::solve() {
   std::cout << "Solving..." << std::endl;
   time_point start = now();
+  long long startDTLBMisses = dTLBMissCounter.read();
+  imbalance = -1;
+  movedRows = 0;
+  timing.rebalance = Timing::duration(0);
 
   floatType rho, rho_old;
   floatType r2, nrm2_0;
@@ -332,7 +639,24 @@ void CG::solve() {
   std::cout << "rho = " << rho << std::endl;
 #endif
 
+  if (fusedSolve) {
+    solveFused(rho, nrm2_0);
+    timing.solve = now() - start;
+    timing.solveDTLBMisses = dTLBMissesSince(startDTLBMisses);
+    return;
+  }
+  if (specializedSolve) {
+    solveSpecialized(rho, nrm2_0);
+    timing.solve = now() - start;
+    timing.solveDTLBMisses = dTLBMissesSince(startDTLBMisses);
+    return;
+  }
+
   for (iteration = 0; iteration < maxIterations; iteration++) {
+    if (rebalanceIterations > 0 && iteration == rebalanceIterations) {
+      rebalance();
+    }
+
     // q(i) = A * p(i) (for (3:1b) and (3:1d))
     matvec(VectorP, VectorQ);
 
@@ -394,32 +718,177 @@ void CG::solve() {
   }
 
   timing.solve = now() - start;
+  timing.solveDTLBMisses = dTLBMissesSince(startDTLBMisses);
+}
+
+/// Same algorithm as in solve(), but the scalars alpha, beta and rho never
+/// leave the device. The host only reads |r|^2 every #residualCheckInterval
+/// iterations to check for convergence, so it may do some more iterations
+/// than strictly necessary.
+void CG::solveFused(floatType rho, floatType nrm2_0) {
+  fusedInitKernel(rho);
+
+  for (iteration = 0; iteration < maxIterations; iteration++) {
+    if (rebalanceIterations > 0 && iteration == rebalanceIterations) {
+      rebalance();
+    }
+
+    // q(i) = A * p(i) (for (3:1b) and (3:1d))
+    matvec(VectorP, VectorQ);
+
+    // a(i) = rho(i) / <p(i), q(i)> (3:1b)
+    fusedAlpha(VectorP, VectorQ);
+
+    // x(i + 1) = x(i) + a * p(i) (3:1c)
+    // r(i + 1) = r(i) - a * q(i) (3:1d)
+    // z(i + 1) = B * r(i + 1)
+    // b(i) = rho(i + 1) / rho(i) (3:1e)
+    fusedUpdate();
+
+    if ((iteration + 1) % residualCheckInterval == 0 ||
+        (iteration + 1) == maxIterations) {
+      floatType r2 = fusedResidual();
+#ifdef DEBUG_SOLVE
+      std::cout << "r2 = " << r2 << std::endl;
+#endif
+
+      // Check convergence with relative residual.
+      residual = std::sqrt(r2) / nrm2_0;
+      if (residual <= tolerance) {
+        // We have (at least partly) done this iteration...
+        iteration++;
+        break;
+      }
+    }
+
+    if (preconditioner == PreconditionerNone) {
+      // p(i + 1) = r(i + 1) + b(i) * p(i) (3:1f)
+      fusedXpay(VectorR, VectorP);
+    } else {
+      // p(i + 1) = z(i + 1) + b(i) * p(i)
+      fusedXpay(VectorZ, VectorP);
+    }
+  }
 }
 
 bool CG::check() {
   std::cout << "Checking solution..." << std::endl;
   time_point start = now();
 
-  int errors = 0;
-  for (int i = 0; i < N; i++) {
-    // All elements of x should be 1, see initialization of k.
-    if (std::abs(x[i] - 1.0) > checkTolerance) {
-      errors++;
-    }
-  }
+  // q = k - A * x with the kernels of the implementation. q is not needed
+  // anymore after solving.
+  matvecKernel(VectorX, VectorQ);
+  xpayKernel(VectorK, -1.0, VectorQ);
+  floatType nrm2_r = std::sqrt(vectorDotKernel(VectorQ, VectorQ));
+  floatType nrm2_k = std::sqrt(vectorDotKernel(VectorK, VectorK));
+  trueResidual = (nrm2_k > 0 ? nrm2_r / nrm2_k : nrm2_r);
 
   timing.check = now() - start;
 
-  if (errors == 0) {
+  bool correct = trueResidual <= checkTolerance;
+  if (correct) {
     std::cout << "Solution is correct!" << std::endl;
   } else {
-    std::cout << errors << " elements are incorrect!" << std::endl;
+    std::cout << "True residual is larger than " << checkTolerance << "!"
+              << std::endl;
+  }
+
+  return correct;
+}
+
+void CG::writeSolution() {
+  if (solutionFile.empty()) {
+    return;
   }
 
-  return (errors == 0);
+  std::cout << "Writing solution to " << solutionFile << "..." << std::endl;
+  auto start = now();
+  writeVector(solutionFile.c_str(), N, x);
+  timing.io += now() - start;
 }
 
 const int maxLabelWidth = 25;
+Matrix *CG::getHostMatrix() {
+  if (matrixCRS) {
+    return matrixCRS.get();
+  } else if (matrixELL) {
+    return matrixELL.get();
+  } else if (splitMatrixCRS) {
+    return splitMatrixCRS.get();
+  } else if (splitMatrixELL) {
+    return splitMatrixELL.get();
+  } else if (partitionedMatrixCRS) {
+    return partitionedMatrixCRS.get();
+  } else if (partitionedMatrixELL) {
+    return partitionedMatrixELL.get();
+  }
+  return matrixCOO.get();
+}
+
+bool CG::refresh(const char *matrixFile) {
+  assert(refreshable);
+
+  std::cout << "Refreshing values from " << matrixFile << "..." << std::endl;
+  auto startIO = now();
+  std::unique_ptr<MatrixCOO> coo(new MatrixCOO(matrixFile));
+  // The value maps are only valid for the same entries in the same order.
+  if (coo->N != N || coo->nz != nz ||
+      coo->getStructureHash() != structureHash) {
+    std::cout << "Matrix has a different structure!" << std::endl;
+    return false;
+  }
+
+  auto startConverting = now();
+  timing.io = startConverting - startIO;
+  if (matrixFormat != MatrixFormatCOO) {
+    refreshValues(coo->V.get());
+  }
+  // The preconditioner and CG::initK() need the matrix in coordinate format.
+  matrixCOO = std::move(coo);
+
+  if (jacobi) {
+    jacobi->refresh(*matrixCOO);
+  }
+  // The values on the devices are outdated.
+  refreshResidentMatrix();
+  if (rhsFile.empty()) {
+    // The right-hand side depends on the values.
+    initK();
+    defaultK.reset();
+    customRHS = false;
+  }
+
+  timing.converting = now() - startConverting;
+
+  if (matrixFormat != MatrixFormatCOO && rebalanceIterations == 0) {
+    matrixCOO.reset();
+  }
+  return true;
+}
+
+void CG::reset(const floatType *rhs) {
+  if (rhs != NULL) {
+    if (!defaultK) {
+      defaultK = allocateArray<floatType>(N);
+      std::memcpy(defaultK.get(), k, sizeof(floatType) * N);
+    }
+    std::memcpy(k, rhs, sizeof(floatType) * N);
+    customRHS = true;
+  } else if (customRHS) {
+    std::memcpy(k, defaultK.get(), sizeof(floatType) * N);
+    customRHS = false;
+  }
+  initX();
+
+  // Keep the times for reading and converting the matrix, which is not
+  // repeated.
+  Timing solveTiming;
+  solveTiming.io = timing.io;
+  solveTiming.converting = timing.converting;
+  solveTiming.convertingDTLBMisses = timing.convertingDTLBMisses;
+  timing = solveTiming;
+}
+
 void CG::printPadded(const char *label, const std::string &value) {
   std::cout << std::left << std::setw(maxLabelWidth) << label;
   std::cout << value << std::endl;
@@ -437,6 +906,10 @@ void CG::printSummary() {
   std::ostringstream oss;
   oss << std::scientific << residual;
   printPadded("Residual:", oss.str());
+  oss.str("");
+  oss << trueResidual;
+  printPadded("True residual:", oss.str());
+  printPadded("Precision:", getPrecisionName());
   printPadded("# rows / # nonzeros:",
               std::to_string(N) + " / " + std::to_string(nz));
 
@@ -466,6 +939,28 @@ void CG::printSummary() {
   }
   assert(preconditionerName.length() > 0);
   printPadded("Preconditioner:", preconditionerName);
+
+  const Allocator &allocator = Allocator::get();
+  printPadded("Alignment:", std::to_string(allocator.getAlignment()));
+  std::string hugePagesName;
+  switch (allocator.getHugePages()) {
+  case Allocator::HugePagesNone:
+    hugePagesName = "none";
+    break;
+  case Allocator::HugePagesTransparent:
+    hugePagesName = "transparent";
+    break;
+  case Allocator::HugePagesExplicit:
+    hugePagesName = "explicit";
+    break;
+  }
+  assert(hugePagesName.length() > 0);
+  printPadded("Huge pages:", hugePagesName);
+  if (allocator.getFallbacks() > 0) {
+    printPadded("Huge page fallbacks:",
+                std::to_string(allocator.getFallbacks()));
+  }
+
   if (workDistribution.get() != nullptr) {
     std::string workDistributionName;
     switch (workDistributionCalc) {
@@ -475,6 +970,9 @@ void CG::printSummary() {
     case WorkDistributionByNz:
       workDistributionName = "by nonzeros";
       break;
+    case WorkDistributionCalibrated:
+      workDistributionName = "by calibrated cost";
+      break;
     }
     assert(workDistributionName.length() > 0);
     printPadded("Work distribution:", workDistributionName);
@@ -484,6 +982,18 @@ void CG::printSummary() {
     if (overlappedGather) {
       std::cout << "Overlapped gather with computation!" << std::endl;
     }
+    if (imbalance >= 0) {
+      printPadded("Measured imbalance:", std::to_string(imbalance));
+      printPadded("Rebalanced rows:", std::to_string(movedRows));
+    }
+  }
+  if (fusedSolve) {
+    std::cout << "Fused kernels with scalars on the device!" << std::endl;
+    printPadded("Residual check interval:",
+                std::to_string(residualCheckInterval));
+  } else if (specializedSolve) {
+    std::cout << "Solve loop specialized for format and preconditioner!"
+              << std::endl;
   }
 
   std::cout << std::endl;
@@ -514,6 +1024,13 @@ void CG::printSummary() {
 
   printPadded("Total time (excl. IO):", std::to_string(total));
 
+  if (timing.solveDTLBMisses != -1) {
+    std::cout << std::endl;
+    printPadded("Converting dTLB misses:",
+                std::to_string(timing.convertingDTLBMisses));
+    printPadded("Solve dTLB misses:", std::to_string(timing.solveDTLBMisses));
+  }
+
   std::cout << std::endl;
   double matvecTime = timing.matvec.count();
   printPadded("MatVec time:", std::to_string(matvecTime));
@@ -529,10 +1046,20 @@ void CG::printSummary() {
     printPadded("Preconditioner time:",
                 std::to_string(timing.preconditioner.count()));
   }
+  if (fusedSolve) {
+    printPadded("Fused update time:",
+                std::to_string(timing.fusedUpdate.count()));
+    printPadded("Residual check time:",
+                std::to_string(timing.fusedResidual.count()));
+  }
+  if (imbalance >= 0) {
+    printPadded("Rebalance time:", std::to_string(timing.rebalance.count()));
+  }
 }
 
 void CG::cleanup() {
   // Uses virtual methods and therefore cannot be done in destructor.
+  vectors.clear();
   deallocateK();
   deallocateX();
 
@@ -549,10 +1076,20 @@ void CG::cleanup() {
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  bool serverMode = argc == 3 && std::strcmp(argv[1], "--server") == 0;
+  if (argc != 2 && !serverMode) {
     std::cerr << "Usage: " << argv[0] << " <matrix.mtx>" << std::endl;
+    std::cerr << "       " << argv[0] << " --server <socket>" << std::endl;
     std::exit(1);
   }
+  execPrecision(argv);
+
+  if (serverMode) {
+    Server server(argv[2]);
+    server.parseEnvironment();
+    server.run();
+    return EXIT_SUCCESS;
+  }
 
 #ifdef __PGI
   // The PGI compiler doesn't like freeing this object together with pinned
@@ -568,10 +1105,11 @@ int main(int argc, char *argv[]) {
     cg->transferTo();
   }
   cg->solve();
+  cg->check();
   if (cg->needsTransfer()) {
     cg->transferFrom();
   }
-  cg->check();
+  cg->writeSolution();
 
   cg->printSummary();
   cg->cleanup();
@@ -22,9 +22,13 @@
 #include <cassert>
 #include <chrono>
 #include <memory>
+#include <string>
+#include <type_traits>
 
+#include "Allocator.h"
 #include "Matrix.h"
 #include "Preconditioner.h"
+#include "VectorPool.h"
 #include "WorkDistribution.h"
 #include "def.h"
 
@@ -34,8 +38,9 @@
 /// stored either COO, CRS or ELLPACK format.
 class CG {
 public:
-  /// Different vectors used to solve the equation system.
-  enum Vector {
+  /// Different vectors used to solve the equation system. Further vectors
+  /// can be requested with #requestVector().
+  enum Vector : int {
     /// LHS of the equation system.
     VectorK,
     /// Computed solution of the equation system.
@@ -76,15 +81,27 @@ public:
     WorkDistributionByRow,
     /// @see WorkDistribution.calculateByNz()
     WorkDistributionByNz,
+    /// @see WorkDistribution.calculateByCost() with the costs from calibrate()
+    WorkDistributionCalibrated,
   };
 
+  /// Thrown by parseEnvironment() for an invalid environment variable after
+  /// the error has been written to std::cerr, see throwOnInvalidEnvironment().
+  struct InvalidEnvironment {};
+
 private:
+  template <class Derived> friend class CGSpecialized;
+
   int iteration;
   int maxIterations = 1000;
 
   floatType residual;
-  floatType tolerance = 1e-9;
-  floatType checkTolerance = 1e-5;
+  /// Relative residual |k - A * x| / |k| computed by check().
+  floatType trueResidual = -1;
+  // Single precision cannot resolve the tolerances used for the others.
+  floatType tolerance = std::is_same<floatType, float>::value ? 1e-6 : 1e-9;
+  floatType checkTolerance =
+      std::is_same<floatType, float>::value ? 1e-3 : 1e-5;
 
   /// Struct holding timing information for IO, converting, the total solve time
   /// and for each kernel.
@@ -104,8 +121,23 @@ private:
     duration xpay{0};
     duration vectorDot{0};
     duration preconditioner{0};
+
+    duration fusedUpdate{0};
+    duration fusedResidual{0};
+
+    duration rebalance{0};
+
+    /// dTLB misses while converting and solving, -1 if not counted.
+    long long convertingDTLBMisses = -1;
+    long long solveDTLBMisses = -1;
   };
   Timing timing;
+  /// Counter for the dTLB misses of the process.
+  DTLBMissCounter dTLBMissCounter;
+  /// @return the dTLB misses since \a start, -1 if not counted.
+  long long dTLBMissesSince(long long start) {
+    return start == -1 ? -1 : dTLBMissCounter.read() - start;
+  }
 
   using time_point = Timing::clock::time_point;
   time_point now() const { return Timing::clock::now(); }
@@ -142,6 +174,40 @@ private:
     timing.preconditioner += now() - start;
   }
 
+  void fusedAlpha(Vector p, Vector q) {
+    time_point start = now();
+    fusedAlphaKernel(p, q);
+    timing.vectorDot += now() - start;
+  }
+
+  void fusedUpdate() {
+    time_point start = now();
+    fusedUpdateKernel();
+    timing.fusedUpdate += now() - start;
+  }
+
+  void fusedXpay(Vector x, Vector y) {
+    time_point start = now();
+    fusedXpayKernel(x, y);
+    timing.xpay += now() - start;
+  }
+
+  floatType fusedResidual() {
+    time_point start = now();
+    floatType r2 = fusedResidualKernel();
+    timing.fusedResidual += now() - start;
+
+    return r2;
+  }
+
+  /// Iterate with the fused kernels, starting from \a rho and the initial norm
+  /// of the residual \a nrm2_0.
+  void solveFused(floatType rho, floatType nrm2_0);
+
+  /// Distribute the rows according to the measured time of each chunk if the
+  /// imbalance is larger than #rebalanceThreshold.
+  void rebalance();
+
 protected:
   /// Dimension of the matrix.
   int N;
@@ -155,6 +221,25 @@ protected:
   /// Whether to overlap the gather with some computation of matvec().
   bool overlappedGather = false;
 
+  /// Number of iterations to measure before rebalancing #workDistribution, 0
+  /// if disabled.
+  int rebalanceIterations = 0;
+  /// Relative imbalance of the measured times up to which the chunks stay.
+  double rebalanceThreshold = 0.1;
+  /// Imbalance measured by the last call to rebalance(), -1 if not measured.
+  double imbalance = -1;
+  /// Number of rows moved to another chunk by the last call to rebalance().
+  int movedRows = 0;
+
+  /// Whether to iterate with the fused kernels that keep all scalars on the
+  /// device.
+  bool fusedSolve = false;
+  /// Number of iterations between reading the residual with fused kernels.
+  int residualCheckInterval = 1;
+  /// Whether to iterate with the loop instantiated for #matrixFormat and
+  /// #preconditioner.
+  bool specializedSolve = false;
+
   /// Format to store the matrix.
   MatrixFormat matrixFormat;
   /// Matrix in cooridinate format.
@@ -183,6 +268,49 @@ protected:
   floatType *k = nullptr;
   /// #VectorX
   floatType *x = nullptr;
+  /// Copy of #k for the solution (1, ..., 1)^T, saved by the first call to
+  /// reset() with a custom right-hand side.
+  AllocatedArray<floatType> defaultK;
+  /// Whether #k was set by reset() instead of CG::init().
+  bool customRHS = false;
+  /// File to read #k from, see readVector().
+  std::string rhsFile;
+  /// File to write #x to after solving, see writeVector().
+  std::string solutionFile;
+
+  /// Whether the conversion records the value maps needed by refresh().
+  bool refreshable = false;
+  /// Hash of the structure of the matrix for refresh(), see
+  /// MatrixCOO#getStructureHash().
+  uint64_t structureHash = 0;
+  /// Whether implementations for devices keep the matrix and the
+  /// preconditioner in device memory after transferFrom().
+  bool residentMatrix = false;
+  /// Free the matrix and the preconditioner kept in device memory, so that
+  /// the next transferTo() transfers them again.
+  virtual void freeResidentMatrix() {}
+  /// Update the matrix and the preconditioner kept in device memory after
+  /// refresh() changed their values on the host. The default frees them.
+  virtual void refreshResidentMatrix() { freeResidentMatrix(); }
+  /// Whether invalidEnvironment() throws instead of exiting.
+  bool throwInvalidEnvironment = false;
+  /// Exit after an invalid environment variable has been reported, or throw
+  /// InvalidEnvironment if requested by throwOnInvalidEnvironment().
+  [[noreturn]] void invalidEnvironment();
+
+  /// @return the converted matrix on the host.
+  Matrix *getHostMatrix();
+
+  /// Pool of all vectors on the host, #k and #x are adopted by CG::init().
+  VectorPool<floatType *> vectors{"k", "x", "p", "q", "r", "z"};
+  /// @return the storage of vector \a v on the host.
+  floatType *getVector(Vector v) { return vectors.get(v); }
+  /// @return the handle for a new work vector named \a name.
+  Vector requestVector(const std::string &name) {
+    return static_cast<Vector>(vectors.request(name));
+  }
+  /// Release the storage of vector \a v so that other vectors can reuse it.
+  void releaseVector(Vector v) { vectors.release(v); }
 
   /// Construct a new object with a \a defaultMatrixFormat to store tha matrix
   /// and a \a defaultPreconditioner to use.
@@ -205,6 +333,17 @@ protected:
   /// @return \a true if this implementation supports overlapping the gather
   /// with some computation of matvec().
   virtual bool supportsOverlappedGather() { return false; }
+  /// @return \a true if this implementation supports the fused kernels.
+  virtual bool supportsFusedSolve() { return false; }
+  /// @return \a true if this implementation supports the specialized loop.
+  virtual bool supportsSpecializedSolve() { return false; }
+  /// @return \a true if this implementation can rebalance its chunks.
+  virtual bool supportsRebalance() { return false; }
+  /// @return \a true if this implementation can calibrate its chunks.
+  virtual bool supportsCalibration() { return false; }
+  /// @return the format to convert the matrix to on the host. This may differ
+  /// from #matrixFormat if the implementation converts the matrix itself.
+  virtual MatrixFormat getHostMatrixFormat() { return matrixFormat; }
 
   /// Allocate MatrixCRS.
   virtual void allocateMatrixCRS();
@@ -230,6 +369,21 @@ protected:
   virtual void allocateX();
   /// Deallocate #x.
   virtual void deallocateX();
+  /// Initialize #k so that the solution is (1, ..., 1)^T. Not called if the
+  /// right-hand side is read from #rhsFile.
+  virtual void initK();
+  /// Initialize #x to (0, ..., 0)^T.
+  virtual void initX();
+  /// @return storage for a work vector in #vectors.
+  virtual floatType *allocateVector();
+  /// Deallocate work vector \a v in #vectors.
+  virtual void deallocateVector(floatType *v);
+
+  /// Scatter \a values in the order of the MatrixCOO into the converted
+  /// matrix on the host.
+  virtual void refreshValues(const floatType *values) {
+    getHostMatrix()->refreshValues(values);
+  }
 
   /// Do transfer data before calling #solve().
   virtual void doTransferTo() {}
@@ -252,10 +406,62 @@ protected:
     assert(0 && "Preconditioner not implemented!");
   }
 
+  /// Measure the \a costs of each chunk for #matrixCOO.
+  virtual void calibrate(WorkDistribution::Cost *costs) {
+    assert(0 && "Calibration not implemented!");
+  }
+  /// Store the time of matvec() for each chunk since the last call to
+  /// doTransferTo() in \a times.
+  virtual void getChunkTimes(double *times) {
+    assert(0 && "Rebalancing not implemented!");
+  }
+  /// Convert the matrix for the chunks of #workDistribution.
+  virtual void splitMatrix();
+  /// Move the rows from the chunks in \a old to the ones in #workDistribution.
+  /// The matrix on the host has already been split for the new chunks.
+  virtual void migrateChunks(const WorkDistribution &old) {
+    assert(0 && "Rebalancing not implemented!");
+  }
+
+  /// Iterate with the loop instantiated for #matrixFormat and #preconditioner,
+  /// starting from \a rho and the initial norm of the residual \a nrm2_0.
+  virtual void solveSpecialized(floatType rho, floatType nrm2_0) {
+    assert(0 && "Specialized solve not implemented!");
+  }
+
+  /// Store \a rho for the fused kernels.
+  virtual void fusedInitKernel(floatType rho) {
+    assert(0 && "Fused kernels not implemented!");
+  }
+  /// alpha = rho / <\a _p, \a _q>
+  virtual void fusedAlphaKernel(Vector _p, Vector _q) {
+    assert(0 && "Fused kernels not implemented!");
+  }
+  /// #VectorX += alpha * #VectorP, #VectorR -= alpha * #VectorQ and
+  /// #VectorZ = B * #VectorR if there is a preconditioner. Afterwards compute
+  /// |r|^2, the new rho and beta = rho(new) / rho(old).
+  virtual void fusedUpdateKernel() {
+    assert(0 && "Fused kernels not implemented!");
+  }
+  /// \a _y = \a _x + beta * \a _y
+  virtual void fusedXpayKernel(Vector _x, Vector _y) {
+    assert(0 && "Fused kernels not implemented!");
+  }
+  /// @return |r|^2 as computed by the last call to fusedUpdateKernel().
+  virtual floatType fusedResidualKernel() {
+    assert(0 && "Fused kernels not implemented!");
+    return 0;
+  }
+
+public:
+  virtual ~CG() = default;
+
   /// Print \a label (padded to a constant number of characters) and \a value.
   static void printPadded(const char *label, const std::string &value);
 
-public:
+  /// @return the dimension of the matrix.
+  int getNumberOfRows() const { return N; }
+
   /// Parse and validate environment variables.
   virtual void parseEnvironment();
   /// Init data by reading matrix from \a matrixFile.
@@ -283,9 +489,32 @@ public:
   /// Print summary after system has been solved.
   virtual void printSummary();
 
-  /// Check the computed solution.
+  /// Check the computed solution with the true residual, computed by the
+  /// kernels of the implementation. Must be called before transferFrom().
   bool check();
 
+  /// Write the solution to #solutionFile if requested.
+  virtual void writeSolution();
+
+  /// Record the value maps during init() so that the matrix can be refreshed.
+  void enableRefresh() { refreshable = true; }
+  /// Keep the matrix and the preconditioner in device memory between solves.
+  /// They are only transferred again after refresh().
+  void enableResidentMatrix() { residentMatrix = true; }
+  /// Throw InvalidEnvironment from parseEnvironment() instead of exiting so
+  /// that a server survives invalid options of a request.
+  void throwOnInvalidEnvironment() { throwInvalidEnvironment = true; }
+  /// Replace the values of the matrix with the ones in \a matrixFile, which
+  /// must have the same structure and order of entries. Only the values are
+  /// scattered into the converted matrix and the preconditioner is updated.
+  /// The data is transferred by the next call to transferTo().
+  /// @return \a false if the structure of the matrix does not match.
+  bool refresh(const char *matrixFile);
+
+  /// Prepare to solve again with the right-hand side \a rhs, or the one for
+  /// the solution (1, ..., 1)^T if \a rhs is NULL. The matrix is kept.
+  void reset(const floatType *rhs);
+
   /// Cleanup allocated memory.
   virtual void cleanup();
 
@@ -0,0 +1,224 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef CG_SPECIALIZED_H
+#define CG_SPECIALIZED_H
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+#include "CG.h"
+
+/// Base class for implementations with kernels known at compile time. The
+/// iterations of CG::solve() are instantiated for each combination of matrix
+/// format and preconditioner. This way no kernel call goes through a virtual
+/// method or switches on the format, and the compiler can inline the kernels.
+///
+/// \a Derived has to provide the following kernels on plain pointers:
+/// matvecKernelCRS(), matvecKernelELL(), matvecKernelELLFixed<Width>(),
+/// axpyKernel(), xpayKernel(), vectorDotKernel() and
+/// applyPreconditionerKernelJacobi().
+template <class Derived> class CGSpecialized : public CG {
+  Derived &derived() { return static_cast<Derived &>(*this); }
+
+  /// Run \a kernel and add its time to \a time.
+  template <class Kernel> void timed(Timing::duration &time, Kernel kernel) {
+    time_point start = now();
+    kernel();
+    time += now() - start;
+  }
+
+  template <MatrixFormat Format> void matvecSpecialized(floatType *x,
+                                                        floatType *y) {
+    if (Format == MatrixFormatCRS) {
+      derived().matvecKernelCRS(x, y);
+    } else {
+      matvecELL(x, y);
+    }
+  }
+
+  template <Preconditioner Precond>
+  void applyPreconditionerSpecialized(floatType *x, floatType *y) {
+    if (Precond == PreconditionerJacobi) {
+      derived().applyPreconditionerKernelJacobi(x, y);
+    }
+  }
+
+  template <MatrixFormat Format, Preconditioner Precond>
+  void iterate(floatType rho, floatType nrm2_0);
+
+  template <MatrixFormat Format>
+  void dispatchPreconditioner(floatType rho, floatType nrm2_0) {
+    switch (preconditioner) {
+    case PreconditionerNone:
+      iterate<Format, PreconditionerNone>(rho, nrm2_0);
+      break;
+    case PreconditionerJacobi:
+      iterate<Format, PreconditionerJacobi>(rho, nrm2_0);
+      break;
+    default:
+      assert(0 && "Invalid preconditioner!");
+    }
+  }
+
+protected:
+  using CG::CG;
+
+  /// @return the width of the ELL matrix if there is a kernel unrolled for it
+  /// at compile time, 0 otherwise.
+  int getFixedWidthELL() const {
+    // Reading the padding must not cost more than skipping it.
+    if (4 * (matrixELL->elements - matrixELL->nz) > matrixELL->elements) {
+      return 0;
+    }
+
+    switch (matrixELL->maxNz) {
+    case 5:
+    case 7:
+    case 9:
+    case 19:
+    case 27:
+      return matrixELL->maxNz;
+    }
+    return 0;
+  }
+
+  /// Multiply the ELL matrix with \a x into \a y. Uses the kernel unrolled
+  /// for the width of the matrix if available, which does not read the length
+  /// of the rows.
+  void matvecELL(floatType *x, floatType *y) {
+    switch (getFixedWidthELL()) {
+    case 5:
+      derived().template matvecKernelELLFixed<5>(x, y);
+      break;
+    case 7:
+      derived().template matvecKernelELLFixed<7>(x, y);
+      break;
+    case 9:
+      derived().template matvecKernelELLFixed<9>(x, y);
+      break;
+    case 19:
+      derived().template matvecKernelELLFixed<19>(x, y);
+      break;
+    case 27:
+      derived().template matvecKernelELLFixed<27>(x, y);
+      break;
+    default:
+      derived().matvecKernelELL(x, y);
+    }
+  }
+
+  virtual bool supportsSpecializedSolve() override {
+    return matrixFormat == MatrixFormatCRS || matrixFormat == MatrixFormatELL;
+  }
+
+  virtual void solveSpecialized(floatType rho, floatType nrm2_0) override {
+    // Dispatch once, the iterations only call the instantiated kernels.
+    switch (matrixFormat) {
+    case MatrixFormatCRS:
+      dispatchPreconditioner<MatrixFormatCRS>(rho, nrm2_0);
+      break;
+    case MatrixFormatELL:
+      dispatchPreconditioner<MatrixFormatELL>(rho, nrm2_0);
+      break;
+    default:
+      assert(0 && "Invalid matrix format!");
+    }
+  }
+
+  virtual void printSummary() override {
+    CG::printSummary();
+
+    if (matrixFormat == MatrixFormatELL && getFixedWidthELL() != 0) {
+      std::cout << std::endl;
+      printPadded("Unrolled ELL width:", std::to_string(getFixedWidthELL()));
+    }
+  }
+};
+
+/// Same algorithm as in CG::solve().
+template <class Derived>
+template <CG::MatrixFormat Format, CG::Preconditioner Precond>
+void CGSpecialized<Derived>::iterate(floatType rho, floatType nrm2_0) {
+  Derived &d = derived();
+  floatType *x = getVector(VectorX);
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
+  floatType *z = nullptr;
+  if (Precond != PreconditionerNone) {
+    z = getVector(VectorZ);
+  }
+
+  floatType rho_old, r2, dot_pq, a, b;
+  for (iteration = 0; iteration < maxIterations; iteration++) {
+    // q(i) = A * p(i) (for (3:1b) and (3:1d))
+    timed(timing.matvec, [&] { matvecSpecialized<Format>(p, q); });
+
+    // dot_pq = <p(i), q(i)> (for (3:1b))
+    timed(timing.vectorDot, [&] { dot_pq = d.vectorDotKernel(p, q); });
+
+    // a(i) = rho(i) / dot_pq (3:1b)
+    a = rho / dot_pq;
+
+    timed(timing.axpy, [&] {
+      // x(i + 1) = x(i) + a * p(i) (3:1c)
+      d.axpyKernel(a, p, x);
+      // r(i + 1) = r(i) - a * q(i) (3:1d)
+      d.axpyKernel(-a, q, r);
+    });
+
+    timed(timing.vectorDot, [&] { r2 = d.vectorDotKernel(r, r); });
+
+    // Check convergence with relative residual.
+    residual = std::sqrt(r2) / nrm2_0;
+    if (residual <= tolerance) {
+      // We have (at least partly) done this iteration...
+      iteration++;
+      break;
+    }
+
+    rho_old = rho;
+    if (Precond == PreconditionerNone) {
+      // rho(i + 1) = <r(i + 1), r(i + 1)> (for (3:1b) and (3:1e))
+      rho = r2;
+    } else {
+      // z(i + 1) = B * r(i + 1)
+      timed(timing.preconditioner,
+            [&] { applyPreconditionerSpecialized<Precond>(r, z); });
+
+      // rho(i + 1) = <r(i + 1), z(i + 1)> ((10:4); for (3:1b) and (3:1e))
+      timed(timing.vectorDot, [&] { rho = d.vectorDotKernel(r, z); });
+    }
+
+    // b(i) = rho(i + 1) / rho(i) (3:1e)
+    b = rho / rho_old;
+
+    if (Precond == PreconditionerNone) {
+      // p(i + 1) = r(i + 1) + b(i) * p(i) (3:1f)
+      timed(timing.xpay, [&] { d.xpayKernel(r, b, p); });
+    } else {
+      // p(i + 1) = z(i + 1) + b(i) * p(i)
+      timed(timing.xpay, [&] { d.xpayKernel(z, b, p); });
+    }
+  }
+}
+
+#endif
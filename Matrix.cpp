@@ -23,6 +23,7 @@
 #include <iostream>
 #include <sstream>
 
+#include "Allocator.h"
 #include "Matrix.h"
 #include "WorkDistribution.h"
 
@@ -126,6 +127,30 @@ MatrixCOO::MatrixCOO(const char *file) {
   }
 }
 
+void Matrix::refreshValues(const floatType *values) {
+  for (int i = 0; i < nz; i++) {
+    if (valueMap[i] != NULL) {
+      *valueMap[i] = values[i];
+    }
+  }
+}
+
+uint64_t MatrixCOO::getStructureHash() const {
+  // FNV-1a over the rows and columns.
+  uint64_t hash = 14695981039346656037ull;
+  auto update = [&hash](int value) {
+    for (int b = 0; b < (int)sizeof(value); b++) {
+      hash ^= (value >> (8 * b)) & 0xff;
+      hash *= 1099511628211ull;
+    }
+  };
+  for (int i = 0; i < nz; i++) {
+    update(I[i]);
+    update(J[i]);
+  }
+  return hash;
+}
+
 int MatrixCOO::getMaxNz(int from, int to) const {
   int maxNz = 0;
   for (int i = from; i < to; i++) {
@@ -142,6 +167,8 @@ void MatrixCOO::countNz(const WorkDistribution &wd,
   // Allocate temporary memory.
   nzDiag.reset(new int[N]);
   nzMinor.reset(new int[N]);
+  std::memset(nzDiag.get(), 0, sizeof(int) * N);
+  std::memset(nzMinor.get(), 0, sizeof(int) * N);
 
   for (int i = 0; i < nz; i++) {
     int row = I[i];
@@ -160,26 +187,30 @@ void MatrixCOO::countNz(const WorkDistribution &wd,
 // Otherwise, they are included from openacc/ which makes the PGI compiler use
 // page-locked memory for the matrix. That would decrease overall performance.
 
-void MatrixDataCRS::allocatePtr(int rows) { ptr = new int[rows + 1]; }
-void MatrixDataCRS::deallocatePtr() { delete[] ptr; }
+void MatrixDataCRS::allocatePtr(int rows) {
+  ptr = Allocator::get().allocate<int>(rows + 1);
+}
+void MatrixDataCRS::deallocatePtr() { Allocator::get().deallocate(ptr); }
 void MatrixDataCRS::allocateIndexAndValue(int values) {
-  index = new int[values];
-  value = new floatType[values];
+  index = Allocator::get().allocate<int>(values);
+  value = Allocator::get().allocate<floatType>(values);
 }
 void MatrixDataCRS::deallocateIndexAndValue() {
-  delete[] index;
-  delete[] value;
+  Allocator::get().deallocate(index);
+  Allocator::get().deallocate(value);
 }
 
-void MatrixDataELL::allocateLength(int rows) { length = new int[rows]; }
-void MatrixDataELL::deallocateLength() { delete[] length; }
+void MatrixDataELL::allocateLength(int rows) {
+  length = Allocator::get().allocate<int>(rows);
+}
+void MatrixDataELL::deallocateLength() { Allocator::get().deallocate(length); }
 void MatrixDataELL::allocateIndexAndData() {
-  index = new int[elements];
-  data = new floatType[elements];
+  index = Allocator::get().allocate<int>(elements);
+  data = Allocator::get().allocate<floatType>(elements);
 }
 void MatrixDataELL::deallocateIndexAndData() {
-  delete[] index;
-  delete[] data;
+  Allocator::get().deallocate(index);
+  Allocator::get().deallocate(data);
 }
 
 template <class Data> void SplitMatrix<Data>::allocateData() {
@@ -235,10 +266,12 @@ template <> void DataMatrix<MatrixDataCRS>::convert(const MatrixCOO &coo) {
 
   // Construct index and value.
   allocateIndexAndValue(nz);
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     index[offsets[row]] = coo.J[i];
     value[offsets[row]] = coo.V[i];
+    recordValue(i, &value[offsets[row]]);
     offsets[row]++;
   }
 }
@@ -277,12 +310,14 @@ void SplitMatrix<MatrixDataCRS>::convert(const MatrixCOO &coo,
   }
 
   // Construct index and value for all chunks.
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     int chunk = wd.findChunk(row);
 
     data[chunk].index[offsets[row]] = coo.J[i];
     data[chunk].value[offsets[row]] = coo.V[i];
+    recordValue(i, &data[chunk].value[offsets[row]]);
     offsets[row]++;
   }
 }
@@ -328,13 +363,14 @@ void PartitionedMatrix<MatrixDataCRS>::convert(const MatrixCOO &coo,
   for (int c = 0; c < numberOfChunks; c++) {
     int length = wd.lengths[c];
     int valuesDiag = diag[c].ptr[length];
-    int valuesMinor = diag[c].ptr[length];
+    int valuesMinor = minor[c].ptr[length];
 
     diag[c].allocateIndexAndValue(valuesDiag);
     minor[c].allocateIndexAndValue(valuesMinor);
   }
 
   // Construct index and value for all chunks.
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     int column = coo.J[i];
@@ -343,19 +379,34 @@ void PartitionedMatrix<MatrixDataCRS>::convert(const MatrixCOO &coo,
     if (wd.isOnDiagonal(chunk, column)) {
       diag[chunk].index[offsetsDiag[row]] = column;
       diag[chunk].value[offsetsDiag[row]] = coo.V[i];
+      recordValue(i, &diag[chunk].value[offsetsDiag[row]]);
       offsetsDiag[row]++;
     } else {
       minor[chunk].index[offsetsMinor[row]] = column;
       minor[chunk].value[offsetsMinor[row]] = coo.V[i];
+      recordValue(i, &minor[chunk].value[offsetsMinor[row]]);
       offsetsMinor[row]++;
     }
   }
 }
 
+/// Zero the padding of \a data with \a rows so that kernels may read all
+/// MatrixDataELL#maxNz elements of a row.
+static void zeroPadding(MatrixDataELL &data, int rows) {
+  for (int i = 0; i < rows; i++) {
+    for (int j = data.length[i]; j < data.maxNz; j++) {
+      int k = j * rows + i;
+      data.index[k] = 0;
+      data.data[k] = 0;
+    }
+  }
+}
+
 template <> void DataMatrix<MatrixDataELL>::convert(const MatrixCOO &coo) {
   N = coo.N;
   nz = coo.nz;
-  elements = N * coo.getMaxNz();
+  maxNz = coo.getMaxNz();
+  elements = N * maxNz;
 
   // Copy over already collected nonzeros per row.
   allocateLength(N);
@@ -367,13 +418,16 @@ template <> void DataMatrix<MatrixDataELL>::convert(const MatrixCOO &coo) {
 
   // Construct column and data.
   allocateIndexAndData();
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     int k = offsets[row] * N + row;
     index[k] = coo.J[i];
     data[k] = coo.V[i];
+    recordValue(i, &data[k]);
     offsets[row]++;
   }
+  zeroPadding(*this, N);
 }
 
 template <>
@@ -396,6 +450,7 @@ void SplitMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
     std::memcpy(data[c].length, coo.nzPerRow.get() + offset,
                 sizeof(int) * length);
 
+    data[c].maxNz = maxNz;
     data[c].elements = maxNz * length;
     data[c].allocateIndexAndData();
   }
@@ -405,6 +460,7 @@ void SplitMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
   std::memset(offsets.get(), 0, sizeof(int) * N);
 
   // Construct column and data for all chunks.
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     int chunk = wd.findChunk(row);
@@ -412,8 +468,13 @@ void SplitMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
     int k = offsets[row] * wd.lengths[chunk] + row - wd.offsets[chunk];
     data[chunk].index[k] = coo.J[i];
     data[chunk].data[k] = coo.V[i];
+    recordValue(i, &data[chunk].data[k]);
     offsets[row]++;
   }
+
+  for (int c = 0; c < numberOfChunks; c++) {
+    zeroPadding(data[c], wd.lengths[c]);
+  }
 }
 
 template <>
@@ -449,8 +510,10 @@ void PartitionedMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
     minor[c].allocateLength(length);
     std::memcpy(minor[c].length, nzMinor.get() + offset, sizeof(int) * length);
 
+    diag[c].maxNz = maxNzDiag;
     diag[c].elements = maxNzDiag * length;
     diag[c].allocateIndexAndData();
+    minor[c].maxNz = maxNzMinor;
     minor[c].elements = maxNzMinor * length;
     minor[c].allocateIndexAndData();
   }
@@ -462,6 +525,7 @@ void PartitionedMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
   std::memset(offsetsMinor.get(), 0, sizeof(int) * N);
 
   // Construct column and data for all chunks.
+  allocateValueMap();
   for (int i = 0; i < nz; i++) {
     int row = coo.I[i];
     int column = coo.J[i];
@@ -471,14 +535,21 @@ void PartitionedMatrix<MatrixDataELL>::convert(const MatrixCOO &coo,
       int k = offsetsDiag[row] * wd.lengths[chunk] + row - wd.offsets[chunk];
       diag[chunk].index[k] = coo.J[i];
       diag[chunk].data[k] = coo.V[i];
+      recordValue(i, &diag[chunk].data[k]);
       offsetsDiag[row]++;
     } else {
       int k = offsetsMinor[row] * wd.lengths[chunk] + row - wd.offsets[chunk];
       minor[chunk].index[k] = coo.J[i];
       minor[chunk].data[k] = coo.V[i];
+      recordValue(i, &minor[chunk].data[k]);
       offsetsMinor[row]++;
     }
   }
+
+  for (int c = 0; c < numberOfChunks; c++) {
+    zeroPadding(diag[c], wd.lengths[c]);
+    zeroPadding(minor[c], wd.lengths[c]);
+  }
 }
 
 // Instantiate templates:
@@ -19,6 +19,7 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <cstdint>
 #include <memory>
 
 #include "def.h"
@@ -32,6 +33,29 @@ struct Matrix {
   int N;
   /// Nonzeros in this matrix.
   int nz;
+
+  /// Whether the conversion records #valueMap.
+  bool recordValueMap = false;
+  /// Location of each value of the MatrixCOO this matrix was converted from,
+  /// NULL for values in chunks that were released after the conversion.
+  std::unique_ptr<floatType *[]> valueMap;
+
+  /// Allocate #valueMap if requested by #recordValueMap.
+  void allocateValueMap() {
+    if (recordValueMap) {
+      valueMap.reset(new floatType *[nz]);
+    }
+  }
+  /// Record \a location for value \a i of the MatrixCOO.
+  void recordValue(int i, floatType *location) {
+    if (valueMap) {
+      valueMap[i] = location;
+    }
+  }
+
+  /// Replace the values with \a values in the order of the MatrixCOO this
+  /// matrix was converted from. Needs #valueMap.
+  void refreshValues(const floatType *values);
 };
 
 /// %Matrix stored in coordinate format.
@@ -55,6 +79,9 @@ struct MatrixCOO : Matrix {
   /// Get maximum number of nonzeros in a row between \a from and \a to.
   int getMaxNz(int from, int to) const;
 
+  /// @return a hash of the rows and columns of all entries, in their order.
+  uint64_t getStructureHash() const;
+
   /// @return number of nonzeros for each chunk in \a wd.
   void countNz(const WorkDistribution &wd, std::unique_ptr<int[]> &nzDiag,
                std::unique_ptr<int[]> &nzMinor) const;
@@ -84,7 +111,8 @@ struct MatrixDataCRS {
   }
 };
 
-/// Data for storing a matrix in ELLPACK format.
+/// Data for storing a matrix in ELLPACK format. The rows are padded to
+/// #maxNz elements with zeros in #index and #data.
 struct MatrixDataELL {
   /// Maximum number of nonzeros in a row.
   /// @see MatrixCOO#getMaxNz()
@@ -117,7 +145,7 @@ struct MatrixDataELL {
 /// %Matrix with specified data.
 template <class Data> struct DataMatrix : Matrix, Data {
   /// Convert \a coo.
-  void convert(const MatrixCOO &coo);
+  virtual void convert(const MatrixCOO &coo);
 };
 using MatrixCRS = DataMatrix<MatrixDataCRS>;
 using MatrixELL = DataMatrix<MatrixDataELL>;
@@ -17,18 +17,22 @@
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "Preconditioner.h"
+#include "Allocator.h"
 #include "Matrix.h"
 
 // The functions for allocation and deallocation cannot live in the header file:
 // Otherwise, they are included from openacc/ which makes the PGI compiler use
 // page-locked memory for the preconditioner. That would decrease performance.
 
-void Jacobi::allocateC(int N) { C = new floatType[N]; }
-void Jacobi::deallocateC() { delete[] C; }
+void Jacobi::allocateC(int N) { C = Allocator::get().allocate<floatType>(N); }
+void Jacobi::deallocateC() { Allocator::get().deallocate(C); }
 
 void Jacobi::init(const MatrixCOO &coo) {
   allocateC(coo.N);
+  refresh(coo);
+}
 
+void Jacobi::refresh(const MatrixCOO &coo) {
   for (int i = 0; i < coo.nz; i++) {
     if (coo.I[i] != coo.J[i]) {
       // We need to find the diagonal elements.
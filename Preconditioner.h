@@ -31,6 +31,8 @@ struct Jacobi {
 
   /// Initialize object with \a coo for an efficient %Jacobi preconditioner.
   void init(const MatrixCOO &coo);
+  /// Recompute #C from the values in \a coo.
+  void refresh(const MatrixCOO &coo);
 
   /// Allocate #C.
   virtual void allocateC(int N);
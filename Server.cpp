@@ -0,0 +1,377 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "CG.h"
+#include "Server.h"
+#include "VectorIO.h"
+
+const char *CG_SERVER_CACHE_SIZE = "CG_SERVER_CACHE_SIZE";
+
+static volatile std::sig_atomic_t stopRequested = 0;
+static void requestStop(int) { stopRequested = 1; }
+
+void Server::parseEnvironment() {
+  const char *env;
+  char *endptr;
+
+  env = std::getenv(CG_SERVER_CACHE_SIZE);
+  if (env != NULL && *env != 0) {
+    errno = 0;
+    int capacity = strtol(env, &endptr, 0);
+    if (errno == 0 && *endptr == 0 && capacity > 0) {
+      this->capacity = capacity;
+    } else {
+      std::cerr << "Invalid value for " << CG_SERVER_CACHE_SIZE << "!"
+                << std::endl;
+      std::exit(1);
+    }
+  }
+}
+
+Server::~Server() {
+  if (fd != -1) {
+    close(fd);
+    unlink(path.c_str());
+  }
+  for (Entry &entry : cache) {
+    entry.cg->cleanup();
+  }
+}
+
+std::string Server::parseRequest(const std::string &text, Request &request) {
+  std::istringstream is(text);
+  std::string command;
+  while (is >> command) {
+    if (command == "matrix") {
+      is >> std::ws;
+      std::getline(is, request.matrix);
+    } else if (command == "option") {
+      std::string option;
+      is >> option;
+      size_t equals = option.find('=');
+      if (option.compare(0, 3, "CG_") != 0 || equals == std::string::npos) {
+        return "Invalid option " + option + "!";
+      }
+      if (option.compare(0, equals, "CG_PRECISION") == 0) {
+        return "The precision is fixed for the server!";
+      }
+      request.options.push_back(option);
+    } else if (command == "rhs") {
+      is >> std::ws;
+      std::getline(is, request.rhs);
+    } else if (command == "shutdown") {
+      request.shutdown = true;
+    } else {
+      return "Invalid command " + command + "!";
+    }
+  }
+
+  if (request.matrix.empty() && !request.shutdown) {
+    return "No matrix in request!";
+  }
+  // The options are part of the key, so their order must not matter.
+  std::sort(request.options.begin(), request.options.end());
+  return "";
+}
+
+bool Server::getKey(const Request &request, std::string &key,
+                    std::string &fingerprint) {
+  char real[PATH_MAX];
+  struct stat st;
+  if (realpath(request.matrix.c_str(), real) == NULL ||
+      stat(real, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+
+  std::ostringstream os;
+  os << real;
+  for (const std::string &option : request.options) {
+    os << ";" << option;
+  }
+  key = os.str();
+
+  // Rewriting the file changes its size or modification time. Use the full
+  // resolution so that a rewrite within the same second is noticed.
+  fingerprint = std::to_string(st.st_size) + ";" +
+                std::to_string(st.st_mtim.tv_sec) + "." +
+                std::to_string(st.st_mtim.tv_nsec);
+  return true;
+}
+
+CG *Server::getSolver(const Request &request, const std::string &key,
+                      const std::string &fingerprint, CacheResult &result,
+                      std::string &error) {
+  for (auto it = cache.begin(); it != cache.end(); it++) {
+    if (it->key != key) {
+      continue;
+    }
+
+    if (it->fingerprint == fingerprint) {
+      result = CacheHit;
+      hits++;
+    } else if (it->cg->refresh(request.matrix.c_str())) {
+      it->fingerprint = fingerprint;
+      result = CacheRefreshed;
+      refreshes++;
+    } else {
+      // The structure has changed, initialize a new solver.
+      it->cg->cleanup();
+      cache.erase(it);
+      break;
+    }
+
+    // Move to the front as the most recently used.
+    cache.splice(cache.begin(), cache, it);
+    return cache.front().cg.get();
+  }
+
+  // Set the options only while initializing the solver.
+  struct SavedVariable {
+    std::string name;
+    std::string value;
+    bool set;
+  };
+  std::vector<SavedVariable> saved;
+  for (const std::string &option : request.options) {
+    size_t equals = option.find('=');
+    std::string name = option.substr(0, equals);
+    const char *old = std::getenv(name.c_str());
+    saved.push_back({name, old != NULL ? old : "", old != NULL});
+    setenv(name.c_str(), option.c_str() + equals + 1, 1);
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.fingerprint = fingerprint;
+  entry.cg.reset(CG::getInstance());
+  entry.cg->throwOnInvalidEnvironment();
+
+  // Report invalid options to the client instead of exiting.
+  std::ostringstream errors;
+  std::streambuf *stderrBuf = std::cerr.rdbuf(errors.rdbuf());
+  bool valid = true;
+  try {
+    entry.cg->parseEnvironment();
+  } catch (const CG::InvalidEnvironment &) {
+    valid = false;
+  }
+  std::cerr.rdbuf(stderrBuf);
+
+  if (valid) {
+    std::cerr << errors.str();
+    if ((int)cache.size() >= capacity) {
+      cache.back().cg->cleanup();
+      cache.pop_back();
+    }
+
+    entry.cg->enableRefresh();
+    entry.cg->enableResidentMatrix();
+    entry.cg->init(request.matrix.c_str());
+    cache.push_front(std::move(entry));
+  }
+
+  for (auto it = saved.rbegin(); it != saved.rend(); it++) {
+    if (it->set) {
+      setenv(it->name.c_str(), it->value.c_str(), 1);
+    } else {
+      unsetenv(it->name.c_str());
+    }
+  }
+
+  if (!valid) {
+    error = errors.str();
+    // Only the first line, the response continues after it.
+    error = error.substr(0, error.find('\n'));
+    return NULL;
+  }
+
+  misses++;
+  result = CacheMiss;
+  return cache.front().cg.get();
+}
+
+std::string Server::solve(const Request &request, std::string &response) {
+  std::string key, fingerprint;
+  if (!getKey(request, key, fingerprint)) {
+    return "Could not read matrix " + request.matrix + "!";
+  }
+
+  // Capture the output of the solver for the client.
+  std::ostringstream output;
+  std::streambuf *stdoutBuf = std::cout.rdbuf(output.rdbuf());
+
+  CacheResult result;
+  std::string error;
+  CG *solver = getSolver(request, key, fingerprint, result, error);
+  std::vector<floatType> rhs;
+  if (solver != NULL && !request.rhs.empty()) {
+    // Report an invalid file to the client instead of exiting.
+    std::ostringstream errors;
+    std::streambuf *stderrBuf = std::cerr.rdbuf(errors.rdbuf());
+    rhs.resize(solver->getNumberOfRows());
+    if (!readVector(request.rhs.c_str(), rhs.size(), rhs.data())) {
+      error = errors.str();
+      error = error.substr(0, error.find('\n'));
+    }
+    std::cerr.rdbuf(stderrBuf);
+  }
+
+  if (solver == NULL) {
+    // The error describes the invalid option.
+  } else if (!error.empty()) {
+    // The error describes the invalid right-hand side.
+  } else {
+    CG &cg = *solver;
+    cg.reset(rhs.empty() ? NULL : rhs.data());
+    if (cg.needsTransfer()) {
+      cg.transferTo();
+    }
+    cg.solve();
+    cg.check();
+    if (cg.needsTransfer()) {
+      cg.transferFrom();
+    }
+    cg.writeSolution();
+
+    cg.printSummary();
+    std::cout << std::endl;
+    std::string resultName;
+    switch (result) {
+    case CacheHit:
+      resultName = "yes";
+      break;
+    case CacheRefreshed:
+      resultName = "refreshed";
+      break;
+    case CacheMiss:
+      resultName = "no";
+      break;
+    }
+    CG::printPadded("Cached solver:", resultName);
+    CG::printPadded("Hits/refreshes/misses:",
+                    std::to_string(hits) + " / " + std::to_string(refreshes) +
+                        " / " + std::to_string(misses));
+  }
+
+  std::cout.rdbuf(stdoutBuf);
+  response = output.str();
+  return error;
+}
+
+bool Server::handle(int client) {
+  std::string text;
+  char buffer[4096];
+  ssize_t length;
+  while ((length = recv(client, buffer, sizeof(buffer), 0)) != 0) {
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return true;
+    }
+    text.append(buffer, length);
+  }
+
+  Request request;
+  std::string output;
+  std::string error = parseRequest(text, request);
+  if (error.empty() && !request.shutdown) {
+    error = solve(request, output);
+  }
+  std::string response = (error.empty() ? "ok" : "error " + error) + "\n";
+  response += output;
+
+  size_t sent = 0;
+  while (sent < response.size()) {
+    // The client may have gone away, which must not kill the server.
+    length = send(client, response.data() + sent, response.size() - sent,
+                  MSG_NOSIGNAL);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    sent += length;
+  }
+
+  return !(error.empty() && request.shutdown);
+}
+
+void Server::run() {
+  struct sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Path for socket is too long!" << std::endl;
+    std::exit(1);
+  }
+  std::strcpy(address.sun_path, path.c_str());
+
+  // Remove a socket left behind by a server that did not shut down cleanly.
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, 16) != 0) {
+    std::cerr << "Could not listen on " << path << ": " << std::strerror(errno)
+              << std::endl;
+    std::exit(1);
+  }
+  this->fd = fd;
+
+  // No SA_RESTART so that accept() returns when the process is signaled.
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  std::cout << "Listening on " << path << "..." << std::endl;
+  while (!stopRequested) {
+    int client = accept(fd, NULL, NULL);
+    if (client == -1) {
+      continue;
+    }
+    bool keepRunning = handle(client);
+    close(client);
+    if (!keepRunning) {
+      break;
+    }
+  }
+  std::cout << "Shutting down..." << std::endl;
+}
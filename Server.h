@@ -0,0 +1,117 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Forward declaration to not include CG.h
+class CG;
+
+/// Server that keeps initialized solvers in memory and solves the requests of
+/// clients on a UNIX domain socket, see cg_client.
+///
+/// A request is sent as text until the client shuts down its side of the
+/// connection:
+///  - "matrix <path>" names the matrix file,
+///  - "option <name>=<value>" sets an environment variable for the solver,
+///  - "rhs <path>" names the file with the right-hand side, which is read
+///    like CG_RHS,
+///  - "shutdown" stops the server.
+///
+/// The response starts with "ok" or "error <message>" on the first line,
+/// followed by the output of the solver.
+class Server {
+  /// Solver in the cache.
+  struct Entry {
+    /// Path of the matrix and the options.
+    std::string key;
+    /// Size and modification time in nanoseconds of the matrix file.
+    std::string fingerprint;
+    std::unique_ptr<CG> cg;
+  };
+
+  /// How the solver for a request was found.
+  enum CacheResult {
+    /// The solver was in the cache.
+    CacheHit,
+    /// The solver was in the cache and got the new values of the matrix.
+    CacheRefreshed,
+    /// The solver was initialized.
+    CacheMiss,
+  };
+
+  /// Parsed request of a client.
+  struct Request {
+    std::string matrix;
+    std::vector<std::string> options;
+    std::string rhs;
+    bool shutdown = false;
+  };
+
+  std::string path;
+  int fd = -1;
+
+  /// Maximum number of solvers in #cache.
+  int capacity = 4;
+  /// Solvers, the most recently used first.
+  std::list<Entry> cache;
+  int hits = 0;
+  int refreshes = 0;
+  int misses = 0;
+
+  /// Parse \a text into \a request.
+  /// @return an empty string on success, the error otherwise.
+  static std::string parseRequest(const std::string &text, Request &request);
+  /// Get the \a key and the \a fingerprint of the matrix for \a request.
+  /// @return \a false if the matrix cannot be read.
+  static bool getKey(const Request &request, std::string &key,
+                     std::string &fingerprint);
+
+  /// @return the solver for \a request, initialized if not in #cache and
+  /// refreshed if only the values of the matrix changed, or NULL with the
+  /// \a error if the options of \a request are invalid.
+  CG *getSolver(const Request &request, const std::string &key,
+                const std::string &fingerprint, CacheResult &result,
+                std::string &error);
+  /// Solve \a request and write the output to \a response.
+  /// @return the error, or an empty string on success.
+  std::string solve(const Request &request, std::string &response);
+  /// Handle the request on connection \a client.
+  /// @return \a false if the server should stop.
+  bool handle(int client);
+
+public:
+  /// Construct a server listening on \a path.
+  Server(const std::string &path) : path(path) {}
+  ~Server();
+
+  /// Parse and validate environment variables.
+  void parseEnvironment();
+
+  /// Handle requests until one asks to shut down or the process receives
+  /// SIGINT or SIGTERM.
+  void run();
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "VectorIO.h"
+
+static const char MatrixMarketBanner[] = "%%MatrixMarket";
+
+static bool readMatrixMarketVector(const char *file, int N, floatType *values) {
+  std::ifstream is(file);
+  std::string line;
+  std::stringstream ss;
+  getline(is, line);
+  ss.str(line);
+
+  std::string banner, mtx, array, type, storage;
+  ss >> banner >> mtx >> array >> type >> storage;
+  // Transform to lower case for comparison.
+  std::transform(mtx.begin(), mtx.end(), mtx.begin(), ::tolower);
+  std::transform(array.begin(), array.end(), array.begin(), ::tolower);
+  std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+  std::transform(storage.begin(), storage.end(), storage.begin(), ::tolower);
+
+  if (mtx != "matrix" || array != "array" || type != "real" ||
+      storage != "general") {
+    std::cerr << "Only supporting real vectors in array format!" << std::endl;
+    return false;
+  }
+
+  // Skip following lines with comments.
+  do {
+    getline(is, line);
+  } while (is && (line.size() == 0 || line[0] == '%'));
+
+  int rows, columns;
+  ss.str(line);
+  ss.clear();
+  ss >> rows >> columns;
+  if (rows != N || columns != 1) {
+    std::cerr << "Vector in " << file << " must have " << N << " rows!"
+              << std::endl;
+    return false;
+  }
+
+  for (int i = 0; i < N; i++) {
+    if (!(is >> values[i])) {
+      std::cerr << "Could not read " << N << " values from " << file << "!"
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readVector(const char *file, int N, floatType *values) {
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    std::cerr << "Can't open file with vector " << file << "!" << std::endl;
+    if (fd != -1) {
+      close(fd);
+    }
+    return false;
+  }
+
+  size_t size = sizeof(floatType) * N;
+  char banner[sizeof(MatrixMarketBanner) - 1];
+  if (read(fd, banner, sizeof(banner)) == sizeof(banner) &&
+      std::memcmp(banner, MatrixMarketBanner, sizeof(banner)) == 0) {
+    close(fd);
+    return readMatrixMarketVector(file, N, values);
+  }
+
+  if ((size_t)st.st_size != size) {
+    std::cerr << "Binary vector in " << file << " must have " << size
+              << " bytes!" << std::endl;
+    close(fd);
+    return false;
+  }
+  if (size > 0) {
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      std::cerr << "Could not map " << file << "!" << std::endl;
+      close(fd);
+      return false;
+    }
+    std::memcpy(values, mapped, size);
+    munmap(mapped, size);
+  }
+  close(fd);
+  return true;
+}
+
+void writeVector(const char *file, int N, const floatType *values) {
+  size_t size = sizeof(floatType) * N;
+  int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 || ftruncate(fd, size) != 0) {
+    std::cerr << "Could not write vector to " << file << "!" << std::endl;
+    std::exit(1);
+  }
+
+  if (size > 0) {
+    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+      std::cerr << "Could not map " << file << "!" << std::endl;
+      std::exit(1);
+    }
+    std::memcpy(mapped, values, size);
+    munmap(mapped, size);
+  }
+  close(fd);
+}
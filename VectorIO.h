@@ -0,0 +1,34 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef VECTOR_IO_H
+#define VECTOR_IO_H
+
+#include "def.h"
+
+/// Read \a N values from \a file into \a values. The file is either a dense
+/// vector in Matrix Market array format or a binary file with the values of
+/// type floatType.
+/// @return false after writing the error to std::cerr.
+bool readVector(const char *file, int N, floatType *values);
+
+/// Write \a N values to the binary \a file, which is mapped into memory.
+void writeVector(const char *file, int N, const floatType *values);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef VECTOR_POOL_H
+#define VECTOR_POOL_H
+
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+/// Pool of work vectors addressed by handle. The storage is allocated on first
+/// use and can be reused by other vectors after it has been released.
+///
+/// \a Storage is the type of a vector, for example a pointer to host memory or
+/// a buffer on a device.
+template <class Storage> class VectorPool {
+public:
+  /// Function to allocate a new vector.
+  using AllocateFunction = std::function<Storage()>;
+  /// Function to deallocate a vector.
+  using DeallocateFunction = std::function<void(Storage)>;
+
+private:
+  struct Entry {
+    std::string name;
+    Storage storage{};
+    bool allocated = false;
+    /// Whether the storage belongs to this pool.
+    bool owned = false;
+  };
+
+  AllocateFunction allocate;
+  DeallocateFunction deallocate;
+
+  std::vector<Entry> entries;
+  /// Released storage that can be reused.
+  std::vector<Storage> released;
+
+  /// Number of allocations, reused storage is not counted.
+  int allocations = 0;
+
+public:
+  /// Construct a pool with \a names for the first handles.
+  VectorPool(std::initializer_list<const char *> names) {
+    for (const char *name : names) {
+      Entry entry;
+      entry.name = name;
+      entries.push_back(entry);
+    }
+  }
+
+  /// Set the functions to \a allocate and \a deallocate vectors.
+  void init(AllocateFunction allocate, DeallocateFunction deallocate) {
+    this->allocate = allocate;
+    this->deallocate = deallocate;
+  }
+
+  /// Use \a storage owned by the caller for vector \a v.
+  void adopt(int v, Storage storage) {
+    Entry &entry = entries[v];
+    assert(!entry.allocated);
+    entry.storage = storage;
+    entry.allocated = true;
+    entry.owned = false;
+  }
+
+  /// @return the handle for a new vector named \a name.
+  int request(const std::string &name) {
+    Entry entry;
+    entry.name = name;
+    entries.push_back(entry);
+    return entries.size() - 1;
+  }
+
+  /// @return the storage of vector \a v, allocated on first use.
+  Storage get(int v) {
+    Entry &entry = entries[v];
+    if (!entry.allocated) {
+      if (!released.empty()) {
+        entry.storage = released.back();
+        released.pop_back();
+      } else {
+        assert(allocate);
+        entry.storage = allocate();
+        allocations++;
+      }
+      entry.allocated = true;
+      entry.owned = true;
+    }
+    return entry.storage;
+  }
+
+  /// @return \a true if vector \a v has storage.
+  bool isAllocated(int v) const { return entries[v].allocated; }
+
+  /// Release vector \a v so that its storage can be reused by other vectors.
+  /// The handle remains valid and gets new storage on the next use.
+  void release(int v) {
+    Entry &entry = entries[v];
+    if (entry.allocated && entry.owned) {
+      released.push_back(entry.storage);
+    }
+    entry.storage = Storage{};
+    entry.allocated = false;
+  }
+
+  /// Deallocate the storage of all vectors.
+  void clear() {
+    for (int v = 0; v < (int)entries.size(); v++) {
+      release(v);
+    }
+    for (Storage storage : released) {
+      deallocate(storage);
+    }
+    released.clear();
+  }
+
+  /// @return the name of vector \a v.
+  const std::string &getName(int v) const { return entries[v].name; }
+  /// @return the number of vectors in this pool.
+  int getNumberOfVectors() const { return entries.size(); }
+  /// @return the number of allocated vectors.
+  int getAllocations() const { return allocations; }
+};
+
+#endif
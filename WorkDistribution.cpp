@@ -16,7 +16,9 @@
     You should have received a copy of the GNU General Public License
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
 
 // #define DEBUG_WORK_DISTRIBUTION
 #ifdef DEBUG_WORK_DISTRIBUTION
@@ -109,3 +111,188 @@ WorkDistribution *WorkDistribution::calculateByNz(const MatrixCOO &coo,
   return new WorkDistribution(numberOfChunks, std::move(offsets),
                               std::move(lengths));
 }
+
+WorkDistribution *WorkDistribution::calculateByCost(const MatrixCOO &coo,
+                                                    int numberOfChunks,
+                                                    const Cost *costs) {
+  int N = coo.N;
+  std::unique_ptr<int[]> offsets(new int[numberOfChunks]);
+  std::unique_ptr<int[]> lengths(new int[numberOfChunks]);
+
+  // Nonzeros before each row to count the nonzeros of any range of rows.
+  std::unique_ptr<long[]> nzBefore(new long[N + 1]);
+  nzBefore[0] = 0;
+  for (int row = 0; row < N; row++) {
+    nzBefore[row + 1] = nzBefore[row] + coo.nzPerRow[row];
+  }
+  // The halo depends on the chunks, so it is taken from the previous split.
+  std::vector<long> halo(numberOfChunks, 0);
+  auto predict = [&](int chunk, int from, int to) {
+    return costs[chunk].row * (to - from) +
+           costs[chunk].nz * (nzBefore[to] - nzBefore[from]) +
+           costs[chunk].halo * halo[chunk];
+  };
+
+  // Give each chunk as many rows as it can process in \a time.
+  // @return true if all rows were distributed.
+  auto split = [&](double time) {
+    int from = 0;
+    for (int i = 0; i < numberOfChunks; i++) {
+      offsets[i] = from;
+      // Leave at least one row for each of the remaining chunks.
+      int maxTo = N - (numberOfChunks - 1 - i);
+      int to = std::min(from + 1, maxTo);
+      int upper = maxTo;
+      while (to < upper) {
+        int middle = to + (upper - to + 1) / 2;
+        if (predict(i, from, middle) <= time) {
+          to = middle;
+        } else {
+          upper = middle - 1;
+        }
+      }
+      lengths[i] = to - from;
+      from = to;
+    }
+    return from == N;
+  };
+
+  std::vector<int> chunkOfRow(N);
+  std::vector<std::vector<bool>> needed(numberOfChunks);
+  static const int Passes = 3;
+  for (int pass = 0; pass < Passes; pass++) {
+    // Search the smallest time that all rows fit in. Giving the first chunk
+    // all rows always does.
+    double lower = 0, upper = 0;
+    for (int i = 0; i < numberOfChunks; i++) {
+      upper = std::max(upper, predict(i, 0, N));
+    }
+    for (int step = 0; step < 64; step++) {
+      double middle = (lower + upper) / 2;
+      if (split(middle)) {
+        upper = middle;
+      } else {
+        lower = middle;
+      }
+    }
+    split(upper);
+    if (pass == Passes - 1) {
+      break;
+    }
+
+    // Count the values each chunk needs from the others.
+    for (int i = 0; i < numberOfChunks; i++) {
+      std::fill(chunkOfRow.begin() + offsets[i],
+                chunkOfRow.begin() + offsets[i] + lengths[i], i);
+      needed[i].assign(N, false);
+      halo[i] = 0;
+    }
+    for (int i = 0; i < coo.nz; i++) {
+      int chunk = chunkOfRow[coo.I[i]];
+      int column = coo.J[i];
+      if (chunkOfRow[column] != chunk && !needed[chunk][column]) {
+        needed[chunk][column] = true;
+        halo[chunk]++;
+      }
+    }
+  }
+
+#ifdef DEBUG_WORK_DISTRIBUTION
+  for (int i = 0; i < numberOfChunks; i++) {
+    std::cout << "Chunk " << i << " of " << numberOfChunks << " with length "
+              << lengths[i] << " (" << halo[i] << " halo values, "
+              << predict(i, offsets[i], offsets[i] + lengths[i])
+              << " s predicted) from offset " << offsets[i] << std::endl;
+  }
+#endif
+
+  return new WorkDistribution(numberOfChunks, std::move(offsets),
+                              std::move(lengths));
+}
+
+WorkDistribution *
+WorkDistribution::calculateByThroughput(const MatrixCOO &coo,
+                                        const WorkDistribution &current,
+                                        const double *times) {
+  int numberOfChunks = current.numberOfChunks;
+  std::unique_ptr<int[]> offsets(new int[numberOfChunks]);
+  std::unique_ptr<int[]> lengths(new int[numberOfChunks]);
+
+  // Nonzeros per second of each chunk.
+  std::unique_ptr<double[]> speeds(new double[numberOfChunks]);
+  double totalSpeed = 0;
+  int measured = 0;
+  for (int i = 0; i < numberOfChunks; i++) {
+    long nz = 0;
+    for (int row = current.offsets[i];
+         row < current.offsets[i] + current.lengths[i]; row++) {
+      nz += coo.nzPerRow[row];
+    }
+
+    speeds[i] = 0;
+    if (nz > 0 && times[i] > 0) {
+      speeds[i] = nz / times[i];
+      totalSpeed += speeds[i];
+      measured++;
+    }
+  }
+  // Assume average speed for chunks that could not be measured.
+  for (int i = 0; i < numberOfChunks; i++) {
+    if (speeds[i] == 0) {
+      speeds[i] = (measured > 0) ? totalSpeed / measured : 1;
+    }
+  }
+  totalSpeed = 0;
+  for (int i = 0; i < numberOfChunks; i++) {
+    totalSpeed += speeds[i];
+  }
+
+  int currentOffset = 0;
+  long currentNz = 0;
+  double chunkEndInNz = 0;
+  for (int i = 0; i < numberOfChunks; i++) {
+    offsets[i] = currentOffset;
+    chunkEndInNz += coo.nz * speeds[i] / totalSpeed;
+
+    if (i == numberOfChunks - 1) {
+      currentOffset = coo.N;
+    } else {
+      // Leave at least one row for each of the remaining chunks.
+      int maxOffset = coo.N - (numberOfChunks - 1 - i);
+      while (currentOffset < maxOffset &&
+             (currentOffset == offsets[i] ||
+              currentNz + coo.nzPerRow[currentOffset] / 2.0 < chunkEndInNz)) {
+        currentNz += coo.nzPerRow[currentOffset];
+        currentOffset++;
+      }
+    }
+
+    lengths[i] = currentOffset - offsets[i];
+
+#ifdef DEBUG_WORK_DISTRIBUTION
+    std::cout << "Chunk " << i << " of " << numberOfChunks << " with length "
+              << lengths[i] << " (" << times[i] << " s measured) from offset "
+              << offsets[i] << std::endl;
+#endif
+  }
+
+  return new WorkDistribution(numberOfChunks, std::move(offsets),
+                              std::move(lengths));
+}
+
+int WorkDistribution::countMovedRows(const WorkDistribution &other) const {
+  assert(numberOfChunks == other.numberOfChunks);
+
+  // Rows that stay in the same chunk are in the intersection of both.
+  int N = offsets[numberOfChunks - 1] + lengths[numberOfChunks - 1];
+  int staying = 0;
+  for (int i = 0; i < numberOfChunks; i++) {
+    int from = std::max(offsets[i], other.offsets[i]);
+    int to = std::min(offsets[i] + lengths[i],
+                      other.offsets[i] + other.lengths[i]);
+    if (from < to) {
+      staying += to - from;
+    }
+  }
+  return N - staying;
+}
@@ -33,6 +33,17 @@ struct WorkDistribution {
   /// Lengths of chunks.
   std::unique_ptr<int[]> lengths;
 
+  /// Cost model of a chunk: The time of an iteration is predicted as the
+  /// weighted sum of its rows, nonzeros and halo values.
+  struct Cost {
+    /// Time per row for the vector operations, in seconds.
+    double row = 0;
+    /// Time per nonzero for matvec, in seconds.
+    double nz = 0;
+    /// Time per value of the vector needed from other chunks, in seconds.
+    double halo = 0;
+  };
+
   /// Fill structure with given data.
   WorkDistribution(int numberOfChunks, std::unique_ptr<int[]> &&offsets,
                    std::unique_ptr<int[]> &&lengths)
@@ -55,6 +66,22 @@ struct WorkDistribution {
   /// of nonzeros.
   static WorkDistribution *calculateByNz(const MatrixCOO &coo,
                                          int numberOfChunks);
+
+  /// @return a distribution where the chunks have roughly the same time
+  /// predicted by their \a costs. Each chunk gets at least one row.
+  static WorkDistribution *calculateByCost(const MatrixCOO &coo,
+                                           int numberOfChunks,
+                                           const Cost *costs);
+
+  /// @return a distribution where each chunk receives a share of the nonzeros
+  /// proportional to its throughput, measured as the \a times to process the
+  /// chunks of \a current. Each chunk keeps at least one row.
+  static WorkDistribution *calculateByThroughput(const MatrixCOO &coo,
+                                                 const WorkDistribution &current,
+                                                 const double *times);
+
+  /// @return the number of rows that are in another chunk in \a other.
+  int countMovedRows(const WorkDistribution &other) const;
 };
 
 #endif
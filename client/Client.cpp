@@ -0,0 +1,139 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " <socket> <matrix.mtx> [--rhs <file>] [CG_<name>=<value>...]"
+            << std::endl;
+  std::cerr << "       " << program << " <socket> --shutdown" << std::endl;
+  std::exit(1);
+}
+
+/// @return the absolute path of \a file for the server, which may run in
+/// another directory, or \a file itself if it does not exist.
+static std::string getFullPath(const char *file) {
+  char real[PATH_MAX];
+  if (realpath(file, real) == NULL) {
+    return file;
+  }
+  return real;
+}
+
+/// @return the request for the arguments, see Server.h for the format.
+static std::string buildRequest(int argc, char *argv[]) {
+  std::ostringstream request;
+  if (std::strcmp(argv[2], "--shutdown") == 0) {
+    if (argc != 3) {
+      usage(argv[0]);
+    }
+    request << "shutdown\n";
+    return request.str();
+  }
+
+  request << "matrix " << getFullPath(argv[2]) << "\n";
+  for (int i = 3; i < argc; i++) {
+    if (std::strcmp(argv[i], "--rhs") == 0) {
+      if (++i == argc) {
+        usage(argv[0]);
+      }
+      // The server reads the file like CG_RHS, so it needs the full path.
+      request << "rhs " << getFullPath(argv[i]) << "\n";
+    } else if (std::strchr(argv[i], '=') != NULL) {
+      request << "option " << argv[i] << "\n";
+    } else {
+      usage(argv[0]);
+    }
+  }
+  return request.str();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage(argv[0]);
+  }
+  std::string request = buildRequest(argc, argv);
+
+  struct sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (std::strlen(argv[1]) >= sizeof(address.sun_path)) {
+    std::cerr << "Path for socket is too long!" << std::endl;
+    std::exit(1);
+  }
+  std::strcpy(address.sun_path, argv[1]);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 ||
+      connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    std::cerr << "Could not connect to " << argv[1] << ": "
+              << std::strerror(errno) << std::endl;
+    std::exit(1);
+  }
+
+  size_t sent = 0;
+  while (sent < request.size()) {
+    ssize_t length = send(fd, request.data() + sent, request.size() - sent,
+                          MSG_NOSIGNAL);
+    if (length < 0) {
+      std::cerr << "Could not send request: " << std::strerror(errno)
+                << std::endl;
+      std::exit(1);
+    }
+    sent += length;
+  }
+  // The server reads the request until the end of the stream.
+  shutdown(fd, SHUT_WR);
+
+  std::string response;
+  char buffer[4096];
+  ssize_t length;
+  while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, length);
+  }
+  close(fd);
+
+  size_t newline = response.find('\n');
+  std::string status = response.substr(0, newline);
+  if (newline != std::string::npos) {
+    std::cout << response.substr(newline + 1);
+  }
+  if (status != "ok") {
+    if (status.compare(0, 6, "error ") == 0) {
+      status = status.substr(6);
+    } else {
+      status = "No response from server!";
+    }
+    std::cerr << status << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -40,6 +40,10 @@ if ("${CMAKE_C_COMPILER_ID}" STREQUAL "PGI")
     set(OPENACC_FLAGS "${OPENACC_FLAGS},${OPENACC_EXTRA_TA_FLAGS}")
   endif ()
   list(APPEND _OPENACC_REQUIRED_VARS OPENACC_FLAGS)
+elseif ("${CMAKE_C_COMPILER_ID}" STREQUAL "GNU" AND GCC_OFFLOADING)
+  # Without a configured offload target this runs on the host.
+  set(OPENACC_FLAGS "-fopenacc")
+  list(APPEND _OPENACC_REQUIRED_VARS OPENACC_FLAGS)
 endif ()
 
 if (_OPENACC_REQUIRED_VARS)
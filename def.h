@@ -19,6 +19,14 @@
 #ifndef DEF_H
 #define DEF_H
 
+// Executables for other precisions are built with one of these defined, see
+// CG_PRECISION.
+#if defined(CG_USE_FLOAT)
+using floatType = float;
+#elif defined(CG_USE_LONG_DOUBLE)
+using floatType = long double;
+#else
 using floatType = double;
+#endif
 
 #endif
@@ -0,0 +1,689 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <mpi.h>
+
+#include "../Allocator.h"
+#include "../CG.h"
+#include "../Matrix.h"
+#include "../Preconditioner.h"
+#include "../WorkDistribution.h"
+
+/// @return the MPI datatype for floatType.
+static MPI_Datatype getFloatType() {
+  if (std::is_same<floatType, float>::value) {
+    return MPI_FLOAT;
+  } else if (std::is_same<floatType, long double>::value) {
+    return MPI_LONG_DOUBLE;
+  }
+  return MPI_DOUBLE;
+}
+
+/// Free the chunk \a data of another rank.
+static void releaseChunk(MatrixDataCRS &data) {
+  data.deallocate();
+  data.ptr = NULL;
+  data.index = NULL;
+  data.value = NULL;
+}
+static void releaseChunk(MatrixDataELL &data) {
+  data.deallocate();
+  data.length = NULL;
+  data.index = NULL;
+  data.data = NULL;
+}
+
+static void finalizeMPI() {
+  int finalized;
+  MPI_Finalized(&finalized);
+  if (!finalized) {
+    MPI_Finalize();
+  }
+}
+
+/// Class implementing a distributed solver with one chunk per MPI rank. Each
+/// rank can use OpenMP for its chunk.
+///
+/// A rank only keeps its chunk of the matrix and the vectors for its rows,
+/// followed by the halo values from other ranks. The columns of the chunk are
+/// renumbered for this local layout.
+class CGMPI : public CG {
+  int rank;
+  int size;
+
+  /// Offset of the rows of this rank.
+  int offset;
+  /// Number of rows of this rank.
+  int length;
+
+  /// Values of the vector to receive from another rank for matvec().
+  struct ReceiveHalo {
+    int rank;
+    /// Position of the values in the local vectors.
+    int position;
+    int count;
+  };
+  /// Values of the vector to send to another rank for matvec().
+  struct SendHalo {
+    int rank;
+    /// Local indices of the values.
+    std::vector<int> indices;
+    std::vector<floatType> buffer;
+  };
+  /// Values this rank needs from the others.
+  std::vector<ReceiveHalo> receiveHalos;
+  /// Values the other ranks need from this one.
+  std::vector<SendHalo> sendHalos;
+  /// Number of values in #receiveHalos.
+  int haloLength = 0;
+  std::vector<MPI_Request> haloRequests;
+
+  /// Rows of CG#k for this rank, copied in doTransferTo().
+  AllocatedArray<floatType> localK;
+  /// Rows of CG#x for this rank and the halo, gathered in doTransferFrom().
+  AllocatedArray<floatType> localX;
+
+  /// Time spent in the kernels of matvec() on this rank, without waiting for
+  /// the halos.
+  double matvecTime = 0;
+
+  virtual bool supportsMatrixFormat(MatrixFormat format) override {
+    return format == MatrixFormatCRS || format == MatrixFormatELL;
+  }
+  virtual bool supportsPreconditioner(Preconditioner preconditioner) override {
+    return preconditioner == PreconditionerJacobi;
+  }
+
+  virtual int getNumberOfChunks() override { return size; }
+  virtual bool supportsOverlappedGather() override { return true; }
+  virtual bool supportsRebalance() override { return true; }
+
+  /// Convert the matrix and release the chunks of all other ranks.
+  virtual void splitMatrix() override;
+
+  /// Add the columns of \a matrix that are not on the diagonal to \a needed.
+  void findNeededColumns(const MatrixDataCRS &matrix,
+                         std::vector<int> &needed);
+  void findNeededColumns(const MatrixDataELL &matrix,
+                         std::vector<int> &needed);
+  /// Renumber the columns of \a matrix for the local vectors with the sorted
+  /// global \a haloColumns.
+  void localizeColumns(MatrixDataCRS &matrix,
+                       const std::vector<int> &haloColumns);
+  void localizeColumns(MatrixDataELL &matrix,
+                       const std::vector<int> &haloColumns);
+  /// Exchange the indices for the halos with all other ranks and renumber the
+  /// columns of the chunk.
+  void initHalos();
+  /// Allocate the vectors for the rows of this rank and the halo.
+  void allocateLocalVectors();
+
+  virtual floatType *allocateVector() override {
+    return Allocator::get().allocate<floatType>(length + haloLength);
+  }
+
+  virtual void init(const char *matrixFile) override;
+
+  virtual bool needsTransfer() override { return true; }
+  virtual void doTransferTo() override;
+  virtual void doTransferFrom() override;
+  virtual void writeSolution() override {
+    // All ranks have the full solution after doTransferFrom().
+    if (rank == 0) {
+      CG::writeSolution();
+    }
+  }
+
+  virtual void getChunkTimes(double *times) override;
+  virtual void migrateChunks(const WorkDistribution &old) override;
+
+  virtual void cpy(Vector _dst, Vector _src) override;
+
+  /// Start to exchange the halos of \a x.
+  void startHaloExchange(floatType *x);
+  /// Wait for the halos started by startHaloExchange().
+  void finishHaloExchange();
+  template <bool roundup = false>
+  void matvecKernelCRS(const MatrixDataCRS &matrix, floatType *x,
+                       floatType *y);
+  template <bool roundup = false>
+  void matvecKernelELL(const MatrixDataELL &matrix, floatType *x,
+                       floatType *y);
+
+  virtual void matvecKernel(Vector _x, Vector _y) override;
+  virtual void axpyKernel(floatType a, Vector _x, Vector _y) override;
+  virtual void xpayKernel(Vector _x, floatType a, Vector _y) override;
+  virtual floatType vectorDotKernel(Vector _a, Vector _b) override;
+
+  void applyPreconditionerKernelJacobi(floatType *x, floatType *y);
+
+  virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
+
+  virtual void printSummary() override;
+
+public:
+  CGMPI()
+      : CG(MatrixFormatCRS, PreconditionerJacobi,
+           /* overlappedGather= */ true) {
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized) {
+      MPI_Init(NULL, NULL);
+      std::atexit(finalizeMPI);
+    }
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (rank != 0) {
+      // Only print the output once.
+      std::cout.rdbuf(NULL);
+    }
+  }
+};
+
+void CGMPI::splitMatrix() {
+  CG::splitMatrix();
+
+  // Release the chunks of the other ranks, their values cannot be refreshed.
+  Matrix *matrix = getHostMatrix();
+  if (matrix->valueMap) {
+    for (int i = 0; i < nz; i++) {
+      if (workDistribution->findChunk(matrixCOO->I[i]) != rank) {
+        matrix->valueMap[i] = NULL;
+      }
+    }
+  }
+  for (int c = 0; c < size; c++) {
+    if (c == rank) {
+      continue;
+    }
+    switch (matrixFormat) {
+    case MatrixFormatCRS:
+      if (!overlappedGather) {
+        releaseChunk(splitMatrixCRS->data[c]);
+      } else {
+        releaseChunk(partitionedMatrixCRS->diag[c]);
+        releaseChunk(partitionedMatrixCRS->minor[c]);
+      }
+      break;
+    case MatrixFormatELL:
+      if (!overlappedGather) {
+        releaseChunk(splitMatrixELL->data[c]);
+      } else {
+        releaseChunk(partitionedMatrixELL->diag[c]);
+        releaseChunk(partitionedMatrixELL->minor[c]);
+      }
+      break;
+    default:
+      assert(0 && "Invalid matrix format!");
+    }
+  }
+}
+
+void CGMPI::findNeededColumns(const MatrixDataCRS &matrix,
+                              std::vector<int> &needed) {
+  for (int i = 0; i < length; i++) {
+    for (int j = matrix.ptr[i]; j < matrix.ptr[i + 1]; j++) {
+      int column = matrix.index[j];
+      if (!workDistribution->isOnDiagonal(rank, column)) {
+        needed.push_back(column);
+      }
+    }
+  }
+}
+
+void CGMPI::findNeededColumns(const MatrixDataELL &matrix,
+                              std::vector<int> &needed) {
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < matrix.length[i]; j++) {
+      int column = matrix.index[j * length + i];
+      if (!workDistribution->isOnDiagonal(rank, column)) {
+        needed.push_back(column);
+      }
+    }
+  }
+}
+
+/// @return the local index of the global \a column, see CGMPI.
+static inline int localizeColumn(int column, int offset, int length,
+                                 const std::vector<int> &haloColumns) {
+  if (offset <= column && column < offset + length) {
+    return column - offset;
+  }
+  auto it = std::lower_bound(haloColumns.begin(), haloColumns.end(), column);
+  assert(it != haloColumns.end() && *it == column);
+  return length + (it - haloColumns.begin());
+}
+
+void CGMPI::localizeColumns(MatrixDataCRS &matrix,
+                            const std::vector<int> &haloColumns) {
+  int nz = matrix.ptr[length];
+  #pragma omp parallel for
+  for (int j = 0; j < nz; j++) {
+    matrix.index[j] =
+        localizeColumn(matrix.index[j], offset, length, haloColumns);
+  }
+}
+
+void CGMPI::localizeColumns(MatrixDataELL &matrix,
+                            const std::vector<int> &haloColumns) {
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < matrix.maxNz; j++) {
+      int k = j * length + i;
+      if (j < matrix.length[i]) {
+        matrix.index[k] =
+            localizeColumn(matrix.index[k], offset, length, haloColumns);
+      } else {
+        // The padding multiplies zero with the first row.
+        matrix.index[k] = 0;
+      }
+    }
+  }
+}
+
+void CGMPI::initHalos() {
+  std::vector<int> haloColumns;
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      findNeededColumns(splitMatrixCRS->data[rank], haloColumns);
+    } else {
+      findNeededColumns(partitionedMatrixCRS->minor[rank], haloColumns);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      findNeededColumns(splitMatrixELL->data[rank], haloColumns);
+    } else {
+      findNeededColumns(partitionedMatrixELL->minor[rank], haloColumns);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+  std::sort(haloColumns.begin(), haloColumns.end());
+  haloColumns.erase(std::unique(haloColumns.begin(), haloColumns.end()),
+                    haloColumns.end());
+  haloLength = haloColumns.size();
+
+  // The sorted columns are grouped by the rank owning them.
+  std::vector<int> receiveCounts(size, 0), sendCounts(size);
+  std::vector<int> receiveDispls(size);
+  for (int column : haloColumns) {
+    receiveCounts[workDistribution->findChunk(column)]++;
+  }
+  int receiveTotal = 0;
+  for (int r = 0; r < size; r++) {
+    receiveDispls[r] = receiveTotal;
+    receiveTotal += receiveCounts[r];
+  }
+
+  // Tell every rank which values to send.
+  MPI_Alltoall(receiveCounts.data(), 1, MPI_INT, sendCounts.data(), 1, MPI_INT,
+               MPI_COMM_WORLD);
+
+  std::vector<int> sendDispls(size);
+  int sendTotal = 0;
+  for (int r = 0; r < size; r++) {
+    sendDispls[r] = sendTotal;
+    sendTotal += sendCounts[r];
+  }
+  std::vector<int> sendAll(sendTotal);
+  MPI_Alltoallv(haloColumns.data(), receiveCounts.data(), receiveDispls.data(),
+                MPI_INT, sendAll.data(), sendCounts.data(), sendDispls.data(),
+                MPI_INT, MPI_COMM_WORLD);
+
+  receiveHalos.clear();
+  sendHalos.clear();
+  for (int r = 0; r < size; r++) {
+    if (receiveCounts[r] > 0) {
+      // Received directly behind the rows of this rank.
+      receiveHalos.push_back({r, length + receiveDispls[r], receiveCounts[r]});
+    }
+    if (sendCounts[r] > 0) {
+      SendHalo halo;
+      halo.rank = r;
+      halo.indices.resize(sendCounts[r]);
+      for (int i = 0; i < sendCounts[r]; i++) {
+        halo.indices[i] = sendAll[sendDispls[r] + i] - offset;
+      }
+      halo.buffer.resize(sendCounts[r]);
+      sendHalos.push_back(std::move(halo));
+    }
+  }
+  haloRequests.resize(receiveHalos.size() + sendHalos.size());
+
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      localizeColumns(splitMatrixCRS->data[rank], haloColumns);
+    } else {
+      localizeColumns(partitionedMatrixCRS->diag[rank], haloColumns);
+      localizeColumns(partitionedMatrixCRS->minor[rank], haloColumns);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      localizeColumns(splitMatrixELL->data[rank], haloColumns);
+    } else {
+      localizeColumns(partitionedMatrixELL->diag[rank], haloColumns);
+      localizeColumns(partitionedMatrixELL->minor[rank], haloColumns);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+}
+
+void CGMPI::allocateLocalVectors() {
+  // CG#k and CG#x keep all rows for the interface of CG.
+  vectors.clear();
+  localK = allocateArray<floatType>(length);
+  localX = allocateArray<floatType>(length + haloLength);
+  vectors.adopt(VectorK, localK.get());
+  vectors.adopt(VectorX, localX.get());
+
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
+  if (preconditioner != PreconditionerNone) {
+    getVector(VectorZ);
+  }
+}
+
+void CGMPI::init(const char *matrixFile) {
+  // Every rank reads the matrix, but only keeps its own chunk after the
+  // conversion, see splitMatrix().
+  CG::init(matrixFile);
+  assert(workDistribution->numberOfChunks == size);
+  offset = workDistribution->offsets[rank];
+  length = workDistribution->lengths[rank];
+
+  initHalos();
+  allocateLocalVectors();
+}
+
+void CGMPI::doTransferTo() {
+  matvecTime = 0;
+  std::copy(k + offset, k + offset + length, localK.get());
+  std::copy(x + offset, x + offset + length, localX.get());
+}
+
+void CGMPI::doTransferFrom() {
+  // Gather the solution on all ranks.
+  MPI_Allgatherv(localX.get(), length, getFloatType(), x,
+                 workDistribution->lengths.get(),
+                 workDistribution->offsets.get(), getFloatType(),
+                 MPI_COMM_WORLD);
+}
+
+void CGMPI::getChunkTimes(double *times) {
+  MPI_Allgather(&matvecTime, 1, MPI_DOUBLE, times, 1, MPI_DOUBLE,
+                MPI_COMM_WORLD);
+}
+
+void CGMPI::migrateChunks(const WorkDistribution &old) {
+  // Only the rows of the vectors carried to the next iteration have to move,
+  // all other vectors are recomputed and k is available on all ranks.
+  std::vector<Vector> migrate = {VectorX, VectorR, VectorP};
+  int oldOffset = offset, oldLength = length;
+  offset = workDistribution->offsets[rank];
+  length = workDistribution->lengths[rank];
+
+  MPI_Datatype type = getFloatType();
+  std::vector<std::vector<floatType>> migrated(migrate.size());
+  std::vector<MPI_Request> requests;
+  for (size_t m = 0; m < migrate.size(); m++) {
+    Vector v = migrate[m];
+    floatType *vector = getVector(v);
+    migrated[m].resize(length);
+    for (int r = 0; r < size; r++) {
+      // Rows that this rank had and that now belong to r...
+      int from = std::max(oldOffset, workDistribution->offsets[r]);
+      int to = std::min(oldOffset + oldLength, workDistribution->offsets[r] +
+                                                   workDistribution->lengths[r]);
+      if (from < to && r == rank) {
+        std::copy(vector + from - oldOffset, vector + to - oldOffset,
+                  migrated[m].begin() + from - offset);
+      } else if (from < to) {
+        requests.emplace_back();
+        MPI_Isend(vector + from - oldOffset, to - from, type, r, v,
+                  MPI_COMM_WORLD, &requests.back());
+      }
+
+      // ... and the rows that r had and that now belong to this rank.
+      from = std::max(old.offsets[r], offset);
+      to = std::min(old.offsets[r] + old.lengths[r], offset + length);
+      if (from < to && r != rank) {
+        requests.emplace_back();
+        MPI_Irecv(migrated[m].data() + from - offset, to - from, type, r, v,
+                  MPI_COMM_WORLD, &requests.back());
+      }
+    }
+  }
+  MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+  initHalos();
+  allocateLocalVectors();
+  for (size_t m = 0; m < migrate.size(); m++) {
+    std::copy(migrated[m].begin(), migrated[m].end(), getVector(migrate[m]));
+  }
+  std::copy(k + offset, k + offset + length, localK.get());
+}
+
+void CGMPI::cpy(Vector _dst, Vector _src) {
+  floatType *dst = getVector(_dst);
+  floatType *src = getVector(_src);
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    dst[i] = src[i];
+  }
+}
+
+void CGMPI::startHaloExchange(floatType *x) {
+  MPI_Datatype type = getFloatType();
+  int request = 0;
+  for (ReceiveHalo &halo : receiveHalos) {
+    MPI_Irecv(x + halo.position, halo.count, type, halo.rank, 0,
+              MPI_COMM_WORLD, &haloRequests[request++]);
+  }
+  for (SendHalo &halo : sendHalos) {
+    for (size_t i = 0; i < halo.indices.size(); i++) {
+      halo.buffer[i] = x[halo.indices[i]];
+    }
+    MPI_Isend(halo.buffer.data(), halo.buffer.size(), type, halo.rank, 0,
+              MPI_COMM_WORLD, &haloRequests[request++]);
+  }
+}
+
+void CGMPI::finishHaloExchange() {
+  MPI_Waitall(haloRequests.size(), haloRequests.data(), MPI_STATUSES_IGNORE);
+}
+
+template <bool roundup>
+void CGMPI::matvecKernelCRS(const MatrixDataCRS &matrix, floatType *x,
+                            floatType *y) {
+  int *ptr = matrix.ptr;
+  int *index = matrix.index;
+  floatType *value = matrix.value;
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    // Skip load and store if nothing to be done...
+    if (!roundup || ptr[i] != ptr[i + 1]) {
+      floatType tmp = (roundup ? y[i] : 0);
+      for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+        tmp += value[j] * x[index[j]];
+      }
+      y[i] = tmp;
+    }
+  }
+}
+
+template <bool roundup>
+void CGMPI::matvecKernelELL(const MatrixDataELL &matrix, floatType *x,
+                            floatType *y) {
+  int *lengthA = matrix.length;
+  int *index = matrix.index;
+  floatType *data = matrix.data;
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    // Skip load and store if nothing to be done...
+    if (!roundup || lengthA[i] > 0) {
+      floatType tmp = (roundup ? y[i] : 0);
+      for (int j = 0; j < lengthA[i]; j++) {
+        int k = j * length + i;
+        tmp += data[k] * x[index[k]];
+      }
+      y[i] = tmp;
+    }
+  }
+}
+
+void CGMPI::matvecKernel(Vector _x, Vector _y) {
+  floatType *x = getVector(_x);
+  floatType *y = getVector(_y);
+
+  startHaloExchange(x);
+
+  double start = MPI_Wtime();
+  if (overlappedGather) {
+    // Compute the diagonal that only needs the values of this rank while the
+    // halos are in flight.
+    switch (matrixFormat) {
+    case MatrixFormatCRS:
+      matvecKernelCRS(partitionedMatrixCRS->diag[rank], x, y);
+      break;
+    case MatrixFormatELL:
+      matvecKernelELL(partitionedMatrixELL->diag[rank], x, y);
+      break;
+    default:
+      assert(0 && "Invalid matrix format!");
+    }
+  }
+  matvecTime += MPI_Wtime() - start;
+
+  finishHaloExchange();
+
+  start = MPI_Wtime();
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      matvecKernelCRS(splitMatrixCRS->data[rank], x, y);
+    } else {
+      matvecKernelCRS<true>(partitionedMatrixCRS->minor[rank], x, y);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      matvecKernelELL(splitMatrixELL->data[rank], x, y);
+    } else {
+      matvecKernelELL<true>(partitionedMatrixELL->minor[rank], x, y);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+  matvecTime += MPI_Wtime() - start;
+}
+
+void CGMPI::axpyKernel(floatType a, Vector _x, Vector _y) {
+  floatType *x = getVector(_x);
+  floatType *y = getVector(_y);
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+void CGMPI::xpayKernel(Vector _x, floatType a, Vector _y) {
+  floatType *x = getVector(_x);
+  floatType *y = getVector(_y);
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    y[i] = x[i] + a * y[i];
+  }
+}
+
+floatType CGMPI::vectorDotKernel(Vector _a, Vector _b) {
+  floatType local = 0;
+  floatType *a = getVector(_a);
+  floatType *b = getVector(_b);
+
+  #pragma omp parallel for reduction(+:local)
+  for (int i = 0; i < length; i++) {
+    local += a[i] * b[i];
+  }
+
+  // The result is needed right away for the next step of the algorithm, so
+  // there is nothing to overlap with.
+  floatType res;
+  MPI_Allreduce(&local, &res, 1, getFloatType(), MPI_SUM, MPI_COMM_WORLD);
+  return res;
+}
+
+void CGMPI::applyPreconditionerKernelJacobi(floatType *x, floatType *y) {
+  floatType *C = jacobi->C + offset;
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    y[i] = C[i] * x[i];
+  }
+}
+
+void CGMPI::applyPreconditionerKernel(Vector _x, Vector _y) {
+  floatType *x = getVector(_x);
+  floatType *y = getVector(_y);
+
+  switch (preconditioner) {
+  case PreconditionerJacobi:
+    applyPreconditionerKernelJacobi(x, y);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+}
+
+void CGMPI::printSummary() {
+  CG::printSummary();
+
+  long long halo = haloLength;
+  long long totalHalo;
+  MPI_Reduce(&halo, &totalHalo, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  std::cout << std::endl;
+  printPadded("MPI ranks:", std::to_string(size));
+  printPadded("Halo values per matvec:", std::to_string(totalHalo));
+}
+
+CG *CG::getInstance() { return new CGMPI; }
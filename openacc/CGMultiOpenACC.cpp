@@ -24,6 +24,7 @@
 #include "../CG.h"
 #include "../Matrix.h"
 #include "../Preconditioner.h"
+#include "DataDirectives.h"
 
 static inline int getNumberOfDevices() {
   return acc_get_num_devices(acc_get_device_type());
@@ -33,30 +34,6 @@ static inline int getNumberOfDevices() {
 class CGMultiOpenACC : public CG {
   const int GatherQueue = 2;
 
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
-
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCRS || format == MatrixFormatELL;
   }
@@ -68,8 +45,10 @@ class CGMultiOpenACC : public CG {
   virtual bool supportsOverlappedGather() override { return true; }
 
   // Keep them here so they can make use of pinned memory.
-  virtual void allocateX() override { x = new floatType[N]; }
-  virtual void deallocateX() override { delete[] x; }
+  virtual void allocateX() override {
+    x = Allocator::get().allocate<floatType>(N);
+  }
+  virtual void deallocateX() override { Allocator::get().deallocate(x); }
 
   virtual void init(const char *matrixFile) override;
 
@@ -109,11 +88,12 @@ void CGMultiOpenACC::init(const char *matrixFile) {
   CG::init(matrixFile);
   assert(workDistribution->numberOfChunks == getNumberOfDevices());
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they can be mapped to the device.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 }
 
@@ -132,41 +112,34 @@ void CGMultiOpenACC::waitForAllDevicesGatherQueue() {
 }
 
 static inline void enterMatrixCRS(const MatrixDataCRS &matrix, int N) {
-  int *ptr = matrix.ptr;
-  int nz = ptr[N];
-  int *index = matrix.index;
-  floatType *value = matrix.value;
-
-  #pragma acc enter data async copyin(ptr[0:N+1], index[0:nz], value[0:nz])
+  int nz = matrix.ptr[N];
+  accCopyin(matrix.ptr, 0, N + 1, acc_async_noval);
+  accCopyin(matrix.index, 0, nz, acc_async_noval);
+  accCopyin(matrix.value, 0, nz, acc_async_noval);
 }
 
 static inline void enterMatrixELL(const MatrixDataELL &matrix, int N) {
-  int elements = matrix.elements;
-  int *length = matrix.length;
-  int *index = matrix.index;
-  floatType *data = matrix.data;
-
-  #pragma acc enter data async copyin(length[0:N], index[0:elements]) \
-                               copyin(data[0:elements])
+  accCopyin(matrix.length, 0, N, acc_async_noval);
+  accCopyin(matrix.index, 0, matrix.elements, acc_async_noval);
+  accCopyin(matrix.data, 0, matrix.elements, acc_async_noval);
 }
 
 void CGMultiOpenACC::doTransferTo() {
   // Allocate memory on the device with plain pointers.
-  int N = this->N;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
-  floatType *x = this->x;
-  floatType *k = this->k;
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
 
   for (int d = 0; d < getNumberOfDevices(); d++) {
     acc_set_device_num(d, acc_get_device_type());
     int offset = workDistribution->offsets[d];
     int length = workDistribution->lengths[d];
 
-    #pragma acc enter data async create(p[0:N], q[offset:length]) \
-                                 create(r[offset:length]) \
-                                 copyin(x[0:N], k[offset:length])
+    accCreate(p, 0, N, acc_async_noval);
+    accCreate(q, offset, length, acc_async_noval);
+    accCreate(r, offset, length, acc_async_noval);
+    accCopyin(x, 0, N, acc_async_noval);
+    accCopyin(k, offset, length, acc_async_noval);
     switch (matrixFormat) {
     case MatrixFormatCRS:
       if (!overlappedGather) {
@@ -188,15 +161,12 @@ void CGMultiOpenACC::doTransferTo() {
       assert(0 && "Invalid matrix format!");
     }
     if (preconditioner != PreconditionerNone) {
-      floatType *z = this->z.get();
-      #pragma acc enter data async create(z[offset:length])
+      accCreate(getVector(VectorZ), offset, length, acc_async_noval);
 
       switch (preconditioner) {
-      case PreconditionerJacobi: {
-        floatType *C = jacobi->C;
-        #pragma acc enter data async copyin(C[offset:length])
+      case PreconditionerJacobi:
+        accCopyin(jacobi->C, offset, length, acc_async_noval);
         break;
-      }
       default:
         assert(0 && "Invalid preconditioner!");
       }
@@ -207,32 +177,24 @@ void CGMultiOpenACC::doTransferTo() {
 }
 
 static inline void exitMatrixCRS(const MatrixDataCRS &matrix, int N) {
-  int *ptr = matrix.ptr;
-  int nz = ptr[N];
-  int *index = matrix.index;
-  floatType *value = matrix.value;
-
-  #pragma acc exit data async delete(ptr[0:N+1], index[0:nz], value[0:nz])
+  int nz = matrix.ptr[N];
+  accDelete(matrix.ptr, 0, N + 1, acc_async_noval);
+  accDelete(matrix.index, 0, nz, acc_async_noval);
+  accDelete(matrix.value, 0, nz, acc_async_noval);
 }
 
 static inline void exitMatrixELL(const MatrixDataELL &matrix, int N) {
-  int elements = matrix.elements;
-  int *length = matrix.length;
-  int *index = matrix.index;
-  floatType *data = matrix.data;
-
-  #pragma acc exit data async delete(length[0:N], index[0:elements]) \
-                              delete(data[0:elements])
+  accDelete(matrix.length, 0, N, acc_async_noval);
+  accDelete(matrix.index, 0, matrix.elements, acc_async_noval);
+  accDelete(matrix.data, 0, matrix.elements, acc_async_noval);
 }
 
 void CGMultiOpenACC::doTransferFrom() {
   // Free memory on the device with plain pointers.
-  int N = this->N;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
   floatType *x = this->x;
-  floatType *k = this->k;
 
   for (int d = 0; d < getNumberOfDevices(); d++) {
     acc_set_device_num(d, acc_get_device_type());
@@ -240,9 +202,11 @@ void CGMultiOpenACC::doTransferFrom() {
     int length = workDistribution->lengths[d];
 
     #pragma acc update async host(x[offset:length])
-    #pragma acc exit data async delete(p[0:N], q[offset:length]) \
-                                delete(r[offset:length], k[offset:length]) \
-                                delete(x[0:N])
+    accDelete(p, 0, N, acc_async_noval);
+    accDelete(q, offset, length, acc_async_noval);
+    accDelete(r, offset, length, acc_async_noval);
+    accDelete(k, offset, length, acc_async_noval);
+    accDelete(x, 0, N, acc_async_noval);
     switch (matrixFormat) {
     case MatrixFormatCRS:
       if (!overlappedGather) {
@@ -264,15 +228,12 @@ void CGMultiOpenACC::doTransferFrom() {
       assert(0 && "Invalid matrix format!");
     }
     if (preconditioner != PreconditionerNone) {
-      floatType *z = this->z.get();
-      #pragma acc exit data async delete(z[offset:length])
+      accDelete(getVector(VectorZ), offset, length, acc_async_noval);
 
       switch (preconditioner) {
-      case PreconditionerJacobi: {
-        floatType *C = jacobi->C;
-        #pragma acc exit data async delete(C[offset:length])
+      case PreconditionerJacobi:
+        accDelete(jacobi->C, offset, length, acc_async_noval);
         break;
-      }
       default:
         assert(0 && "Invalid preconditioner!");
       }
@@ -17,39 +17,57 @@
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <cassert>
+#include <chrono>
+#include <iostream>
 #include <memory>
+#include <string>
 
 #include <openacc.h>
 
 #include "../CG.h"
 #include "../Matrix.h"
 #include "../Preconditioner.h"
+#include "DataDirectives.h"
 
-/// Class implementing parallel kernels with OpenACC.
+/// Class implementing parallel kernels with OpenACC. All kernels are launched
+/// asynchronously on the same queue, the host only waits when it needs a
+/// scalar or the results.
 class CGOpenACC : public CG {
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
+  /// Queue for all kernels and transfers during the solve.
+  static const int Queue = 1;
+  /// Number of gangs for reductions, each stores a partial result.
+  static const int ReductionGangs = 256;
+
+  /// Scalars on the device.
+  enum Scalar {
+    ScalarRho,
+    ScalarAlpha,
+    ScalarBeta,
+    ScalarR2,
+    ScalarDot,
+    NumberOfScalars,
+  };
+  /// Partial results of the gangs.
+  enum Partial {
+    PartialPQ,
+    PartialRR,
+    PartialRZ,
+    NumberOfPartials,
+  };
+
+  floatType scalars[NumberOfScalars];
+  floatType partials[NumberOfPartials * ReductionGangs];
+
+  /// Time the host spent waiting for the queue.
+  std::chrono::duration<double> hostWait{0};
+
+  /// Wait for all kernels on the queue and add the time to #hostWait.
+  void wait();
+  /// @return scalar \a s after waiting for the queue.
+  floatType readScalar(Scalar s);
+
+  /// Store the partial results of <\a a, \a b> in \a partial.
+  void reducePartials(floatType *a, floatType *b, Partial partial);
 
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCRS || format == MatrixFormatELL;
@@ -78,6 +96,15 @@ class CGOpenACC : public CG {
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
 
+  virtual bool supportsFusedSolve() override { return true; }
+  virtual void fusedInitKernel(floatType rho) override;
+  virtual void fusedAlphaKernel(Vector _p, Vector _q) override;
+  virtual void fusedUpdateKernel() override;
+  virtual void fusedXpayKernel(Vector _x, Vector _y) override;
+  virtual floatType fusedResidualKernel() override;
+
+  virtual void printSummary() override;
+
 public:
   CGOpenACC() : CG(MatrixFormatELL, PreconditionerJacobi) {}
 };
@@ -88,54 +115,47 @@ void CGOpenACC::init(const char *matrixFile) {
 
   CG::init(matrixFile);
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they can be mapped to the device.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 }
 
 void CGOpenACC::doTransferTo() {
-  // Allocate memory on the device with plain pointers.
-  int N = this->N, nz = this->nz;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
-  floatType *x = this->x;
-  floatType *k = this->k;
+  hostWait = std::chrono::duration<double>(0);
 
-  #pragma acc enter data create(p[0:N], q[0:N], r[0:N]) copyin(x[0:N], k[0:N])
+  // Allocate memory on the device with plain pointers.
+  accCreate(getVector(VectorP), 0, N);
+  accCreate(getVector(VectorQ), 0, N);
+  accCreate(getVector(VectorR), 0, N);
+  accCopyin(x, 0, N);
+  accCopyin(k, 0, N);
+  accCreate(scalars, 0, NumberOfScalars);
+  accCreate(partials, 0, NumberOfPartials * ReductionGangs);
   switch (matrixFormat) {
-  case MatrixFormatCRS: {
-    int *ptr = matrixCRS->ptr;
-    int *index = matrixCRS->index;
-    floatType *value = matrixCRS->value;
-    #pragma acc enter data copyin(ptr[0:N+1], index[0:nz], value[0:nz])
+  case MatrixFormatCRS:
+    accCopyin(matrixCRS->ptr, 0, N + 1);
+    accCopyin(matrixCRS->index, 0, nz);
+    accCopyin(matrixCRS->value, 0, nz);
     break;
-  }
-  case MatrixFormatELL: {
-    int elements = matrixELL->elements;
-    int *length = matrixELL->length;
-    int *index = matrixELL->index;
-    floatType *data = matrixELL->data;
-    #pragma acc enter data copyin(length[0:N]) \
-                           copyin(index[0:elements], data[0:elements])
+  case MatrixFormatELL:
+    accCopyin(matrixELL->length, 0, N);
+    accCopyin(matrixELL->index, 0, matrixELL->elements);
+    accCopyin(matrixELL->data, 0, matrixELL->elements);
     break;
-  }
   default:
     assert(0 && "Invalid matrix format!");
   }
   if (preconditioner != PreconditionerNone) {
-    floatType *z = this->z.get();
-    #pragma acc enter data create(z[0:N])
+    accCreate(getVector(VectorZ), 0, N);
 
     switch (preconditioner) {
-    case PreconditionerJacobi: {
-      floatType *C = jacobi->C;
-      #pragma acc enter data copyin(C[0:N])
+    case PreconditionerJacobi:
+      accCopyin(jacobi->C, 0, N);
       break;
-    }
     default:
       assert(0 && "Invalid preconditioner!");
     }
@@ -143,45 +163,38 @@ void CGOpenACC::doTransferTo() {
 }
 
 void CGOpenACC::doTransferFrom() {
-  // Free memory on the device with plain pointers.
-  int N = this->N, nz = this->nz;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
-  floatType *x = this->x;
-  floatType *k = this->k;
+  // Finish all kernels before copying the solution.
+  wait();
 
-  #pragma acc exit data delete(p[0:N], q[0:N], r[0:N], k[0:N]) copyout(x[0:N])
+  // Free memory on the device with plain pointers.
+  accDelete(getVector(VectorP), 0, N);
+  accDelete(getVector(VectorQ), 0, N);
+  accDelete(getVector(VectorR), 0, N);
+  accDelete(k, 0, N);
+  accCopyout(x, 0, N);
+  accDelete(scalars, 0, NumberOfScalars);
+  accDelete(partials, 0, NumberOfPartials * ReductionGangs);
   switch (matrixFormat) {
-  case MatrixFormatCRS: {
-    int *ptr = matrixCRS->ptr;
-    int *index = matrixCRS->index;
-    floatType *value = matrixCRS->value;
-    #pragma acc exit data delete(ptr[0:N+1], index[0:nz], value[0:nz])
+  case MatrixFormatCRS:
+    accDelete(matrixCRS->ptr, 0, N + 1);
+    accDelete(matrixCRS->index, 0, nz);
+    accDelete(matrixCRS->value, 0, nz);
     break;
-  }
-  case MatrixFormatELL: {
-    int elements = matrixELL->elements;
-    int *length = matrixELL->length;
-    int *index = matrixELL->index;
-    floatType *data = matrixELL->data;
-    #pragma acc exit data delete(length[0:N]) \
-                          delete(index[0:elements], data[0:elements])
+  case MatrixFormatELL:
+    accDelete(matrixELL->length, 0, N);
+    accDelete(matrixELL->index, 0, matrixELL->elements);
+    accDelete(matrixELL->data, 0, matrixELL->elements);
     break;
-  }
   default:
     assert(0 && "Invalid matrix format!");
   }
   if (preconditioner != PreconditionerNone) {
-    floatType *z = this->z.get();
-    #pragma acc exit data delete(z[0:N])
+    accDelete(getVector(VectorZ), 0, N);
 
     switch (preconditioner) {
-    case PreconditionerJacobi: {
-      floatType *C = jacobi->C;
-      #pragma acc exit data delete(C[0:N])
+    case PreconditionerJacobi:
+      accDelete(jacobi->C, 0, N);
       break;
-    }
     default:
       assert(0 && "Invalid preconditioner!");
     }
@@ -193,7 +206,7 @@ void CGOpenACC::cpy(Vector _dst, Vector _src) {
   floatType *dst = getVector(_dst);
   floatType *src = getVector(_src);
 
-#pragma acc parallel loop present(dst[0:N], src[0:N])
+#pragma acc parallel loop present(dst[0:N], src[0:N]) async(Queue)
   for (int i = 0; i < N; i++) {
     dst[i] = src[i];
   }
@@ -207,7 +220,8 @@ void CGOpenACC::matvecKernelCRS(floatType *x, floatType *y) {
   floatType *value = matrixCRS->value;
 
 #pragma acc parallel loop gang vector present(x[0:N], y[0:N]) \
-                          present(ptr[0:N+1], index[0:nz], value[0:nz])
+                          present(ptr[0:N+1], index[0:nz], value[0:nz]) \
+                          async(Queue)
   for (int i = 0; i < N; i++) {
     floatType tmp = 0;
     for (int j = ptr[i]; j < ptr[i + 1]; j++) {
@@ -225,7 +239,8 @@ void CGOpenACC::matvecKernelELL(floatType *x, floatType *y) {
   floatType *data = matrixELL->data;
 
 #pragma acc parallel loop gang vector present(x[0:N], y[0:N], length[0:N]) \
-                          present(index[0:elements], data[0:elements])
+                          present(index[0:elements], data[0:elements]) \
+                          async(Queue)
   for (int i = 0; i < N; i++) {
     floatType tmp = 0;
     for (int j = 0; j < length[i]; j++) {
@@ -258,7 +273,7 @@ void CGOpenACC::axpyKernel(floatType a, Vector _x, Vector _y) {
   floatType *x = getVector(_x);
   floatType *y = getVector(_y);
 
-#pragma acc parallel loop present(x[0:N], y[0:N])
+#pragma acc parallel loop present(x[0:N], y[0:N]) async(Queue)
   for (int i = 0; i < N; i++) {
     y[i] += a * x[i];
   }
@@ -269,31 +284,60 @@ void CGOpenACC::xpayKernel(Vector _x, floatType a, Vector _y) {
   floatType *x = getVector(_x);
   floatType *y = getVector(_y);
 
-#pragma acc parallel loop present(x[0:N], y[0:N])
+#pragma acc parallel loop present(x[0:N], y[0:N]) async(Queue)
   for (int i = 0; i < N; i++) {
     y[i] = x[i] + a * y[i];
   }
 }
 
-floatType CGOpenACC::vectorDotKernel(Vector _a, Vector _b) {
+void CGOpenACC::reducePartials(floatType *a, floatType *b, Partial partial) {
   int N = this->N;
-  floatType res = 0;
+  int chunk = (N + ReductionGangs - 1) / ReductionGangs;
+  floatType *partials = this->partials;
+
+#pragma acc parallel loop gang num_gangs(ReductionGangs) \
+                          present(a[0:N], b[0:N]) \
+                          present(partials[0:NumberOfPartials * ReductionGangs]) \
+                          async(Queue)
+  for (int g = 0; g < ReductionGangs; g++) {
+    int end = (g + 1) * chunk < N ? (g + 1) * chunk : N;
+    floatType sum = 0;
+    #pragma acc loop vector reduction(+:sum)
+    for (int i = g * chunk; i < end; i++) {
+      sum += a[i] * b[i];
+    }
+    partials[partial * ReductionGangs + g] = sum;
+  }
+}
+
+floatType CGOpenACC::vectorDotKernel(Vector _a, Vector _b) {
   floatType *a = getVector(_a);
   floatType *b = getVector(_b);
-
-#pragma acc parallel loop reduction(+:res) copy(res) present(a[0:N], b[0:N])
-  for (int i = 0; i < N; i++) {
-    res += a[i] * b[i];
+  floatType *scalars = this->scalars;
+  floatType *partials = this->partials;
+
+  reducePartials(a, b, PartialPQ);
+
+#pragma acc parallel num_gangs(1) num_workers(1) vector_length(1) \
+                     present(scalars[0:NumberOfScalars]) \
+                     present(partials[0:NumberOfPartials * ReductionGangs]) \
+                     async(Queue)
+  {
+    floatType sum = 0;
+    for (int g = 0; g < ReductionGangs; g++) {
+      sum += partials[PartialPQ * ReductionGangs + g];
+    }
+    scalars[ScalarDot] = sum;
   }
 
-  return res;
+  return readScalar(ScalarDot);
 }
 
 void CGOpenACC::applyPreconditionerKernelJacobi(floatType *x, floatType *y) {
   int N = this->N;
   floatType *C = jacobi->C;
 
-#pragma acc parallel loop present(x[0:N], y[0:N], C[0:N])
+#pragma acc parallel loop present(x[0:N], y[0:N], C[0:N]) async(Queue)
   for (int i = 0; i < N; i++) {
     y[i] = C[i] * x[i];
   }
@@ -312,4 +356,130 @@ void CGOpenACC::applyPreconditionerKernel(Vector _x, Vector _y) {
   }
 }
 
+void CGOpenACC::wait() {
+  auto start = std::chrono::steady_clock::now();
+  #pragma acc wait(Queue)
+  hostWait += std::chrono::steady_clock::now() - start;
+}
+
+floatType CGOpenACC::readScalar(Scalar s) {
+  floatType *scalars = this->scalars;
+
+  #pragma acc update self(scalars[s:1]) async(Queue)
+  wait();
+
+  return scalars[s];
+}
+
+void CGOpenACC::fusedInitKernel(floatType rho) {
+  floatType *scalars = this->scalars;
+
+  scalars[ScalarRho] = rho;
+  #pragma acc update device(scalars[ScalarRho:1]) async(Queue)
+}
+
+void CGOpenACC::fusedAlphaKernel(Vector _p, Vector _q) {
+  floatType *p = getVector(_p);
+  floatType *q = getVector(_q);
+  floatType *scalars = this->scalars;
+  floatType *partials = this->partials;
+
+  reducePartials(p, q, PartialPQ);
+
+#pragma acc parallel num_gangs(1) num_workers(1) vector_length(1) \
+                     present(scalars[0:NumberOfScalars]) \
+                     present(partials[0:NumberOfPartials * ReductionGangs]) \
+                     async(Queue)
+  {
+    floatType pq = 0;
+    for (int g = 0; g < ReductionGangs; g++) {
+      pq += partials[PartialPQ * ReductionGangs + g];
+    }
+    scalars[ScalarAlpha] = (pq != 0) ? scalars[ScalarRho] / pq : 0;
+  }
+}
+
+void CGOpenACC::fusedUpdateKernel() {
+  int N = this->N;
+  int chunk = (N + ReductionGangs - 1) / ReductionGangs;
+  bool precondition = (preconditioner == PreconditionerJacobi);
+  floatType *x = this->x;
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
+  // Without preconditioner, z and C are never accessed.
+  floatType *z = precondition ? getVector(VectorZ) : r;
+  floatType *C = precondition ? jacobi->C : r;
+  floatType *scalars = this->scalars;
+  floatType *partials = this->partials;
+
+  // x += alpha * p, r -= alpha * q and z = C * r, including the partial
+  // results of r * r and r * z for each gang.
+#pragma acc parallel loop gang num_gangs(ReductionGangs) \
+                          present(x[0:N], p[0:N], q[0:N], r[0:N]) \
+                          present(z[0:N], C[0:N]) \
+                          present(scalars[0:NumberOfScalars]) \
+                          present(partials[0:NumberOfPartials * ReductionGangs]) \
+                          async(Queue)
+  for (int g = 0; g < ReductionGangs; g++) {
+    int end = (g + 1) * chunk < N ? (g + 1) * chunk : N;
+    floatType alpha = scalars[ScalarAlpha];
+    floatType rr = 0, rz = 0;
+    #pragma acc loop vector reduction(+:rr, rz)
+    for (int i = g * chunk; i < end; i++) {
+      x[i] += alpha * p[i];
+      floatType ri = r[i] - alpha * q[i];
+      r[i] = ri;
+      rr += ri * ri;
+      if (precondition) {
+        floatType zi = C[i] * ri;
+        z[i] = zi;
+        rz += ri * zi;
+      }
+    }
+    partials[PartialRR * ReductionGangs + g] = rr;
+    partials[PartialRZ * ReductionGangs + g] = rz;
+  }
+
+#pragma acc parallel num_gangs(1) num_workers(1) vector_length(1) \
+                     present(scalars[0:NumberOfScalars]) \
+                     present(partials[0:NumberOfPartials * ReductionGangs]) \
+                     async(Queue)
+  {
+    floatType r2 = 0, rz = 0;
+    for (int g = 0; g < ReductionGangs; g++) {
+      r2 += partials[PartialRR * ReductionGangs + g];
+      rz += partials[PartialRZ * ReductionGangs + g];
+    }
+    floatType rho = precondition ? rz : r2;
+    floatType oldRho = scalars[ScalarRho];
+
+    scalars[ScalarBeta] = (oldRho != 0) ? rho / oldRho : 0;
+    scalars[ScalarRho] = rho;
+    scalars[ScalarR2] = r2;
+  }
+}
+
+void CGOpenACC::fusedXpayKernel(Vector _x, Vector _y) {
+  int N = this->N;
+  floatType *x = getVector(_x);
+  floatType *y = getVector(_y);
+  floatType *scalars = this->scalars;
+
+#pragma acc parallel loop present(x[0:N], y[0:N]) \
+                          present(scalars[0:NumberOfScalars]) async(Queue)
+  for (int i = 0; i < N; i++) {
+    y[i] = x[i] + scalars[ScalarBeta] * y[i];
+  }
+}
+
+floatType CGOpenACC::fusedResidualKernel() { return readScalar(ScalarR2); }
+
+void CGOpenACC::printSummary() {
+  CG::printSummary();
+
+  std::cout << std::endl;
+  printPadded("Host wait time:", std::to_string(hostWait.count()));
+}
+
 CG *CG::getInstance() { return new CGOpenACC; }
@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2017  Jonas Hahnfeld
+
+    This file is part of CGxx.
+
+    CGxx is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    CGxx is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef DATA_DIRECTIVES_H
+#define DATA_DIRECTIVES_H
+
+#include <openacc.h>
+
+// Unstructured data directives for \a length elements of \a array starting at
+// \a offset, on \a queue (acc_async_sync to wait for completion). GCC does not
+// count a local variable that only appears in the clauses of these directives
+// as used, so the arrays are passed as parameters.
+
+/// Allocate the elements on the device.
+template <class T>
+static inline void accCreate(T *array, int offset, int length,
+                             int queue = acc_async_sync) {
+  #pragma acc enter data create(array[offset:length]) async(queue)
+}
+
+/// Allocate the elements on the device and copy them from the host.
+template <class T>
+static inline void accCopyin(T *array, int offset, int length,
+                             int queue = acc_async_sync) {
+  #pragma acc enter data copyin(array[offset:length]) async(queue)
+}
+
+/// Free the elements on the device.
+template <class T>
+static inline void accDelete(T *array, int offset, int length,
+                             int queue = acc_async_sync) {
+  #pragma acc exit data delete(array[offset:length]) async(queue)
+}
+
+/// Copy the elements from the device to the host and free them.
+template <class T>
+static inline void accCopyout(T *array, int offset, int length,
+                              int queue = acc_async_sync) {
+  #pragma acc exit data copyout(array[offset:length]) async(queue)
+}
+
+#endif
@@ -18,7 +18,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -34,6 +39,10 @@
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include "CL/opencl.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /// Class implementing parallel kernels with OpenCL.
 class CGMultiOpenCL : public CGOpenCLBase {
   enum GatherImpl {
@@ -41,23 +50,101 @@ class CGMultiOpenCL : public CGOpenCLBase {
     GatherImplDevice,
   };
 
+  enum SubDevices {
+    SubDevicesNone,
+    SubDevicesNUMA,
+    SubDevicesEqually,
+  };
+
+  /// Last write to a resource and the reads since then. Used to order the
+  /// commands by events with out-of-order queues.
+  struct Dependencies {
+    cl_event write = NULL;
+    std::vector<cl_event> reads;
+
+    /// Release all events.
+    void release() {
+      if (write != NULL) {
+        checkError(clReleaseEvent(write));
+        write = NULL;
+      }
+      for (cl_event event : reads) {
+        checkError(clReleaseEvent(event));
+      }
+      reads.clear();
+    }
+  };
+  /// Access of enqueued commands to some Dependencies.
+  struct Access {
+    Dependencies *dependencies;
+    bool write;
+  };
+  static Access read(Dependencies &dependencies) {
+    return {&dependencies, false};
+  }
+  static Access write(Dependencies &dependencies) {
+    return {&dependencies, true};
+  }
+
+  /// Resources on each device with separate Dependencies.
+  enum Resource {
+    ResourceK,
+    /// Part of CG#VectorX computed on this device.
+    ResourceXLocal,
+    /// Parts of CG#VectorX gathered from the other devices.
+    ResourceXRemote,
+    ResourcePLocal,
+    ResourcePRemote,
+    ResourceQ,
+    ResourceR,
+    ResourceZ,
+    /// Temporary memory used for reductions.
+    ResourceTmp,
+    /// Scalars and partial results of the fused kernels.
+    ResourceFused,
+    NumberOfResources,
+  };
+
   struct MultiDevice : Device {
     int id;
+    Dependencies dependencies[NumberOfResources];
     WorkDistribution *workDistribution;
 
     MatrixCRSDevice diagMatrixCRS;
     MatrixELLDevice diagMatrixELL;
-    cl_command_queue gatherQueue;
+    /// Queue for the transfers of CG#matvec.
+    cl_command_queue gatherQueue = NULL;
+
+    /// Queue for streaming the transfers if #pipelinedTransferTo.
+    cl_command_queue transferQueue = NULL;
+    /// Pinned host buffers to double-buffer the streamed transfers.
+    cl_mem staging[2] = {NULL, NULL};
+    /// Mapped pointers of #staging.
+    void *stagingPtr[2] = {NULL, NULL};
+    /// Events of the last transfer from each buffer in #staging.
+    cl_event stagingEvents[2] = {NULL, NULL};
+    /// Index of the next buffer in #staging to use.
+    int nextStaging = 0;
 
     floatType vectorDotResult;
 
-    ~MultiDevice() { clReleaseCommandQueue(gatherQueue); }
+    /// Profiled time of the matvec kernels at the end of doTransferTo().
+    double matvecTimeStart = 0;
+
+    ~MultiDevice() {
+      if (gatherQueue != NULL) {
+        clReleaseCommandQueue(gatherQueue);
+      }
+      if (transferQueue != NULL) {
+        clReleaseCommandQueue(transferQueue);
+      }
+    }
 
     virtual void init(cl_device_id device_id, CGOpenCLBase *cg) override {
       Device::init(device_id, cg);
 
       cl_int err;
-      gatherQueue = clCreateCommandQueue(ctx, device_id, 0, &err);
+      gatherQueue = clCreateCommandQueue(ctx, device_id, queueProperties, &err);
       checkError(err);
     }
 
@@ -73,29 +160,138 @@ class CGMultiOpenCL : public CGOpenCLBase {
 
   bool parallelTransferTo = true;
 
+  /// Size of the blocks for streaming the transfers.
+  static const size_t TransferBlockSize = 4 * 1024 * 1024;
+  /// Whether to stream the transfers in blocks and let each device start to
+  /// compute as soon as its data has arrived.
+  bool pipelinedTransferTo = false;
+
+  /// Whether to use out-of-order queues and order the commands by events.
+  /// The host then only waits when it needs a result.
+  bool outOfOrder = false;
+  /// Dependencies of the host buffers for gathering CG#VectorX and
+  /// CG#VectorP, per chunk.
+  std::vector<Dependencies> hostXDependencies, hostPDependencies;
+  /// Time the host spent waiting for the devices.
+  std::chrono::duration<double> hostWait{0};
+
   std::vector<MultiDevice> devices;
   GatherImpl gatherImpl = GatherImplHost;
 
+  SubDevices subDevices = SubDevicesNone;
+  /// Number of sub-devices per device for SubDevicesEqually.
+  int numberOfSubDevices = 0;
+  /// Sub-devices created by createSubDevices() that need to be released.
+  std::vector<cl_device_id> createdSubDevices;
+
   floatType *p;
 
-  cl_kernel matvecKernelCRSRoundup = NULL;
-  cl_kernel matvecKernelELLRoundup = NULL;
+  /// Whether to compute an additional chunk with OpenMP threads on the host.
+  bool hostChunk = false;
+  /// Time the host spent computing its chunk.
+  std::chrono::duration<double> hostCompute{0};
 
-  virtual int getNumberOfChunks() override { return devices.size(); }
+  virtual int getNumberOfChunks() override {
+    return devices.size() + (hostChunk ? 1 : 0);
+  }
+  /// @return the index of the host chunk, which comes after all devices.
+  int getHostChunk() const { return devices.size(); }
+  /// @return the vector \a v in host memory for the host chunk. CG#VectorX and
+  /// CG#VectorP are the buffers of the gather, so the part of the host chunk
+  /// is sent to the devices without a copy.
+  floatType *getHostVector(Vector v) {
+    return (v == VectorP) ? p : getVector(v);
+  }
   virtual bool supportsOverlappedGather() override { return true; }
+  virtual bool supportsRebalance() override { return true; }
+  virtual bool supportsCalibration() override { return true; }
 
   virtual void parseEnvironment() override;
+
+  /// @return sub-devices of \a device_ids according to #subDevices. Devices
+  /// that cannot be partitioned are returned unchanged.
+  std::vector<cl_device_id>
+  createSubDevices(const std::vector<cl_device_id> &device_ids);
+
   virtual void init(const char *matrixFile) override;
 
   void finishAllDevices();
   void finishAllDevicesGatherQueue();
+  /// Flush all devices so that they compute while the host runs its chunk,
+  /// or before waiting for their events on other queues.
+  void flushAllDevices();
+  /// Flush all devices and call \a kernel with the rows of the host chunk.
+  void computeOnHost(const std::function<void(int offset, int length)> &kernel);
+  /// Wait for and release \a events.
+  void waitForEvents(std::vector<cl_event> &events);
+
+  /// @return the Dependencies of \a v on \a device, either of the part
+  /// computed on this device or of the parts gathered from the others.
+  Dependencies &getDependencies(MultiDevice &device, Vector v,
+                                bool remote = false);
+  /// @return the Dependencies of the chunk \a c of the host buffer for \a v.
+  Dependencies &getHostDependencies(Vector v, int c);
+  /// Release all events and wait lists, the queues must be finished.
+  void releaseDependencies();
+  /// Call \a enqueue so that its commands on \a device wait for all previous
+  /// commands with conflicting \a accesses if #outOfOrder. \a enqueue must
+  /// enqueue at least one command, optionally return the \a event of the last
+  /// one.
+  void ordered(MultiDevice &device, std::initializer_list<Access> accesses,
+               const std::function<void()> &enqueue, cl_event *event = NULL);
+
+  /// Allocate and map the pinned #MultiDevice::staging buffers.
+  void allocateStaging(MultiDevice &device);
+  /// Unmap and free the #MultiDevice::staging buffers after the last transfer.
+  void freeStaging(MultiDevice &device);
+  /// Stream the transfer in blocks through the #MultiDevice::staging buffers
+  /// if #pipelinedTransferTo.
+  virtual void enqueueTransferTo(Device &device, cl_mem buffer, size_t size,
+                                 const void *hostPtr) override;
+
+  /// Allocate the chunk of the matrix on \a device and copy it.
+  void allocateAndCopyMatrix(MultiDevice &device, int length);
+  /// Free the chunk of the matrix on \a device.
+  void freeMatrix(MultiDevice &device);
+  /// Free the chunks of the matrix and the preconditioner on \a device.
+  void freeMatrixAndPreconditioner(MultiDevice &device);
+  virtual void freeResidentMatrix() override;
+  /// Transfer the values of the chunk of the matrix and the preconditioner on
+  /// \a device.
+  void copyMatrixValues(MultiDevice &device, int length);
+  virtual void refreshResidentMatrix() override;
 
   void doTransferToForDevice(int index);
   virtual void doTransferTo() override;
   virtual void doTransferFrom() override;
 
+  /// @return the profiled time of all matvec kernels on \a device.
+  double getMatvecTime(MultiDevice &device);
+  virtual void getChunkTimes(double *times) override;
+  virtual void migrateChunks(const WorkDistribution &old) override;
+
   virtual void cpy(Vector _dst, Vector _src) override;
 
+  /// Enqueue CG#matvec on \a device from \a x into \a y, adding to the
+  /// result of the diagonal part if #overlappedGather.
+  void enqueueMatvec(MultiDevice &device, cl_mem x, cl_mem y, int yOffset,
+                     int length);
+
+  /// Multiply the rows of the host chunk in \a data with \a x into \a y,
+  /// adding to \a y if \a roundup.
+  void matvecOnHost(const MatrixDataCRS &data, floatType *x, floatType *y,
+                    bool roundup);
+  /// Multiply the rows of the host chunk in \a data with \a x into \a y,
+  /// adding to \a y if \a roundup.
+  void matvecOnHost(const MatrixDataELL &data, floatType *x, floatType *y,
+                    bool roundup);
+  /// Measure the \a cost of the host chunk with the OpenMP threads.
+  virtual void calibrateHost(const MatrixDataCRS &sample, int sampleRows,
+                             WorkDistribution::Cost &cost) override;
+  /// Compute CG#matvec for the host chunk from \a _x into \a _y, only the
+  /// diagonal part if \a diag.
+  void matvecHostChunk(Vector _x, Vector _y, bool diag);
+
   void matvecGatherXViaHost(Vector _x);
   void matvecGatherXOnDevices(Vector _x);
   virtual void matvecKernel(Vector _x, Vector _y) override;
@@ -106,21 +302,30 @@ class CGMultiOpenCL : public CGOpenCLBase {
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
 
+  /// Copy the partial results of each device to all other devices after
+  /// waiting for the corresponding \a events, which are released.
+  void exchangePartials(std::vector<cl_event> &events);
+
+  virtual void fusedInitKernel(floatType rho) override;
+  virtual void fusedAlphaKernel(Vector _p, Vector _q) override;
+  virtual void fusedUpdateKernel() override;
+  virtual void fusedXpayKernel(Vector _x, Vector _y) override;
+  virtual floatType fusedResidualKernel() override;
+
   virtual void printSummary() override;
   virtual void cleanup() override {
     if (gatherImpl == GatherImplHost) {
 #if OPENCL_USE_SVM
       clSVMFree(ctx, p);
 #else
-      delete[] p;
+      Allocator::get().deallocate(p);
 #endif
     }
 
     CGOpenCLBase::cleanup();
 
-    if (overlappedGather) {
-      clReleaseKernel(matvecKernelCRSRoundup);
-      clReleaseKernel(matvecKernelELLRoundup);
+    for (cl_device_id device : createdSubDevices) {
+      clReleaseDevice(device);
     }
   }
 
@@ -130,18 +335,48 @@ public:
 
 const char *CG_OCL_PARALLEL_TRANSFER_TO = "CG_OCL_PARALLEL_TRANSFER_TO";
 
+const char *CG_OCL_PIPELINED_TRANSFER_TO = "CG_OCL_PIPELINED_TRANSFER_TO";
+
+const char *CG_OCL_OUT_OF_ORDER = "CG_OCL_OUT_OF_ORDER";
+
 const char *CG_OCL_GATHER_IMPL = "CG_OCL_GATHER_IMPL";
 const char *CG_OCL_GATHER_IMPL_HOST = "host";
 const char *CG_OCL_GATHER_IMPL_DEVICE = "device";
 
+const char *CG_OCL_SUB_DEVICES = "CG_OCL_SUB_DEVICES";
+const char *CG_OCL_SUB_DEVICES_NONE = "none";
+const char *CG_OCL_SUB_DEVICES_NUMA = "numa";
+
+const char *CG_OCL_HOST_CHUNK = "CG_OCL_HOST_CHUNK";
+
+// Defined in CG.cpp, for the defaults with a host chunk.
+extern const char *CG_WORK_DISTRIBUTION;
+extern const char *CG_FUSED_SOLVE;
+
+/// @return \a true if the environment variable \a name is set.
+static inline bool isSet(const char *name) {
+  const char *env = std::getenv(name);
+  return env != NULL && *env != 0;
+}
+
 void CGMultiOpenCL::parseEnvironment() {
-  CG::parseEnvironment();
+  CGOpenCLBase::parseEnvironment();
 
   const char *env = std::getenv(CG_OCL_PARALLEL_TRANSFER_TO);
   if (env != NULL && *env != 0) {
     parallelTransferTo = (std::string(env) != "0");
   }
 
+  env = std::getenv(CG_OCL_PIPELINED_TRANSFER_TO);
+  if (env != NULL && *env != 0) {
+    pipelinedTransferTo = (std::string(env) != "0");
+  }
+
+  env = std::getenv(CG_OCL_OUT_OF_ORDER);
+  if (env != NULL && *env != 0) {
+    outOfOrder = (std::string(env) != "0");
+  }
+
   env = std::getenv(CG_OCL_GATHER_IMPL);
   if (env != NULL && *env != 0) {
     std::string lower(env);
@@ -155,14 +390,126 @@ void CGMultiOpenCL::parseEnvironment() {
       std::cerr << "Invalid value for " << CG_OCL_GATHER_IMPL << "! ("
                 << CG_OCL_GATHER_IMPL_HOST << ", or "
                 << CG_OCL_GATHER_IMPL_DEVICE << ")" << std::endl;
-      std::exit(1);
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_OCL_SUB_DEVICES);
+  if (env != NULL && *env != 0) {
+    std::string lower(env);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    char *endptr;
+    errno = 0;
+    int numberOfSubDevices = strtol(env, &endptr, 0);
+    if (lower == CG_OCL_SUB_DEVICES_NONE) {
+      subDevices = SubDevicesNone;
+    } else if (lower == CG_OCL_SUB_DEVICES_NUMA) {
+      subDevices = SubDevicesNUMA;
+    } else if (errno == 0 && *endptr == 0 && numberOfSubDevices > 0) {
+      subDevices = SubDevicesEqually;
+      this->numberOfSubDevices = numberOfSubDevices;
+    } else {
+      std::cerr << "Invalid value for " << CG_OCL_SUB_DEVICES << "! ("
+                << CG_OCL_SUB_DEVICES_NONE << ", " << CG_OCL_SUB_DEVICES_NUMA
+                << ", or number of sub-devices)" << std::endl;
+      invalidEnvironment();
+    }
+  }
+
+  env = std::getenv(CG_OCL_HOST_CHUNK);
+  if (env != NULL && *env != 0) {
+    hostChunk = (std::string(env) != "0");
+  }
+  if (hostChunk) {
+    // The host chunk computes directly in the buffers of the gather and
+    // synchronizes with the devices after each kernel.
+    if (gatherImpl != GatherImplHost || outOfOrder) {
+      std::cerr << "No support for host chunk without gather via host and "
+                << "in-order queues!" << std::endl;
+      invalidEnvironment();
+    }
+    // The fused kernels are only the default, so the requested host chunk
+    // takes precedence.
+    if (fusedSolve && !isSet(CG_FUSED_SOLVE)) {
+      std::cerr << "Disabling fused kernels, which do not support the host "
+                << "chunk!" << std::endl;
+      fusedSolve = false;
+    }
+    if (fusedSolve || rebalanceIterations > 0) {
+      std::cerr << "No support for host chunk with fused kernels or "
+                << "rebalancing!" << std::endl;
+      invalidEnvironment();
+    }
+    // A fixed share of the rows does not reflect the speed of the host.
+    if (!isSet(CG_WORK_DISTRIBUTION)) {
+      workDistributionCalc = WorkDistributionCalibrated;
     }
   }
 }
 
+std::vector<cl_device_id>
+CGMultiOpenCL::createSubDevices(const std::vector<cl_device_id> &device_ids) {
+  if (subDevices == SubDevicesNone) {
+    return device_ids;
+  }
+
+  std::vector<cl_device_id> result;
+  for (cl_device_id device : device_ids) {
+    std::vector<cl_device_partition_property> properties;
+    cl_uint maxSubDevices;
+    checkError(clGetDeviceInfo(device, CL_DEVICE_PARTITION_MAX_SUB_DEVICES,
+                               sizeof(cl_uint), &maxSubDevices, NULL));
+
+    switch (subDevices) {
+    case SubDevicesNUMA:
+      properties = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+                    CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+      break;
+    case SubDevicesEqually: {
+      cl_uint computeUnits;
+      checkError(clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS,
+                                 sizeof(cl_uint), &computeUnits, NULL));
+      cl_uint unitsPerSubDevice = computeUnits / numberOfSubDevices;
+      if (unitsPerSubDevice == 0) {
+        unitsPerSubDevice = 1;
+      }
+      properties = {CL_DEVICE_PARTITION_EQUALLY,
+                    (cl_device_partition_property)unitsPerSubDevice, 0};
+      break;
+    }
+    default:
+      assert(0 && "Invalid sub-devices!");
+    }
+
+    cl_uint num_devices = 0;
+    cl_int err = CL_DEVICE_PARTITION_FAILED;
+    if (maxSubDevices > 1) {
+      err = clCreateSubDevices(device, properties.data(), 0, NULL,
+                               &num_devices);
+    }
+    if (err != CL_SUCCESS || num_devices <= 1) {
+      std::cout << "Could not partition device, using it as a whole"
+                << std::endl;
+      result.push_back(device);
+      continue;
+    }
+
+    std::vector<cl_device_id> partitioned(num_devices);
+    checkError(clCreateSubDevices(device, properties.data(), num_devices,
+                                  partitioned.data(), NULL));
+    result.insert(result.end(), partitioned.begin(), partitioned.end());
+    createdSubDevices.insert(createdSubDevices.end(), partitioned.begin(),
+                             partitioned.end());
+  }
+
+  return result;
+}
+
 void CGMultiOpenCL::init(const char *matrixFile) {
   // Init all devices and don't read matrix when there is none available.
-  std::vector<cl_device_id> device_ids = getAllDevices();
+  // Each sub-device gets its own chunk of the work distribution.
+  std::vector<cl_device_id> device_ids = createSubDevices(getAllDevices());
   int numberOfDevices = device_ids.size();
 
   cl_int err;
@@ -172,20 +519,34 @@ void CGMultiOpenCL::init(const char *matrixFile) {
 
   // Resize the vector so that getNumberOfChunks() can get the right value.
   devices.resize(numberOfDevices);
+  // The chunks of split and partitioned matrices are not allocated separately.
+  zeroCopy = false;
 
-  // Now that we have working devices, compile the program and read the matrix.
+  // Now that we have working devices, read the matrix and build the program.
   CGOpenCLBase::init(matrixFile);
-  assert(workDistribution->numberOfChunks == numberOfDevices);
-
-  if (overlappedGather) {
-    matvecKernelCRSRoundup = checkedCreateKernel("matvecKernelCRSRoundup");
-    matvecKernelELLRoundup = checkedCreateKernel("matvecKernelELLRoundup");
-  }
+  assert(workDistribution->numberOfChunks == getNumberOfChunks());
 
   for (int d = 0; d < numberOfDevices; d++) {
     MultiDevice &device = devices[d];
     device.id = d;
+    if (outOfOrder) {
+      // The events are still needed between the queues if the device does
+      // not support out-of-order execution.
+      cl_command_queue_properties supported;
+      checkError(clGetDeviceInfo(device_ids[d], CL_DEVICE_QUEUE_PROPERTIES,
+                                 sizeof(supported), &supported, NULL));
+      device.queueProperties =
+          supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+      device.orderByEvents = true;
+    }
     device.init(device_ids[d], this);
+    if (pipelinedTransferTo) {
+      // The transfers must stay in order to reuse the staging buffers.
+      device.transferQueue = clCreateCommandQueue(
+          ctx, device_ids[d], device.queueProperties & CL_QUEUE_PROFILING_ENABLE,
+          &err);
+      checkError(err);
+    }
 
     device.workDistribution = workDistribution.get();
     int length = workDistribution->lengths[device.id];
@@ -197,41 +558,252 @@ void CGMultiOpenCL::init(const char *matrixFile) {
     p = (floatType *)clSVMAlloc(ctx, CL_MEM_READ_WRITE, sizeof(floatType) * N,
                                 0);
 #else
-    p = new floatType[N];
+    p = Allocator::get().allocate<floatType>(N);
 #endif
   }
+  hostXDependencies.resize(getNumberOfChunks());
+  hostPDependencies.resize(getNumberOfChunks());
 }
 
 void CGMultiOpenCL::finishAllDevices() {
+  auto start = std::chrono::steady_clock::now();
   for (MultiDevice &device : devices) {
     device.checkedFinish();
   }
+  hostWait += std::chrono::steady_clock::now() - start;
 }
 
 void CGMultiOpenCL::finishAllDevicesGatherQueue() {
+  auto start = std::chrono::steady_clock::now();
   for (MultiDevice &device : devices) {
     checkError(clFinish(device.gatherQueue));
   }
+  hostWait += std::chrono::steady_clock::now() - start;
 }
 
-void CGMultiOpenCL::doTransferToForDevice(int index) {
-  size_t fullVectorSize = sizeof(floatType) * N;
+void CGMultiOpenCL::flushAllDevices() {
+  for (MultiDevice &device : devices) {
+    device.checkedFlush();
+  }
+}
 
-  MultiDevice &device = devices[index];
-  int d = device.id;
-  int offset = workDistribution->offsets[d];
-  int length = workDistribution->lengths[d];
+void CGMultiOpenCL::computeOnHost(
+    const std::function<void(int offset, int length)> &kernel) {
+  flushAllDevices();
 
-  size_t vectorSize = sizeof(floatType) * length;
-  device.k = checkedCreateReadBuffer(vectorSize);
-  device.x = checkedCreateBuffer(fullVectorSize);
-  device.checkedEnqueueWriteBuffer(device.k, vectorSize, k + offset);
-  device.checkedEnqueueWriteBuffer(device.x, fullVectorSize, x);
+  auto start = std::chrono::steady_clock::now();
+  kernel(workDistribution->offsets[getHostChunk()],
+         workDistribution->lengths[getHostChunk()]);
+  hostCompute += std::chrono::steady_clock::now() - start;
+}
 
-  device.p = checkedCreateBuffer(fullVectorSize);
-  device.q = checkedCreateBuffer(vectorSize);
-  device.r = checkedCreateBuffer(vectorSize);
+void CGMultiOpenCL::waitForEvents(std::vector<cl_event> &events) {
+  auto start = std::chrono::steady_clock::now();
+  checkError(clWaitForEvents(events.size(), events.data()));
+  hostWait += std::chrono::steady_clock::now() - start;
+
+  for (cl_event event : events) {
+    checkError(clReleaseEvent(event));
+  }
+}
+
+CGMultiOpenCL::Dependencies &
+CGMultiOpenCL::getDependencies(MultiDevice &device, Vector v, bool remote) {
+  switch (v) {
+  case VectorK:
+    return device.dependencies[ResourceK];
+  case VectorX:
+    return device.dependencies[remote ? ResourceXRemote : ResourceXLocal];
+  case VectorP:
+    return device.dependencies[remote ? ResourcePRemote : ResourcePLocal];
+  case VectorQ:
+    return device.dependencies[ResourceQ];
+  case VectorR:
+    return device.dependencies[ResourceR];
+  case VectorZ:
+    return device.dependencies[ResourceZ];
+  }
+  assert(0 && "Invalid value of v!");
+  return device.dependencies[ResourceK];
+}
+
+CGMultiOpenCL::Dependencies &CGMultiOpenCL::getHostDependencies(Vector v,
+                                                                int c) {
+  switch (v) {
+  case VectorX:
+    return hostXDependencies[c];
+  case VectorP:
+    return hostPDependencies[c];
+  default:
+    assert(0 && "Invalid vector!");
+    return hostXDependencies[c];
+  }
+}
+
+void CGMultiOpenCL::releaseDependencies() {
+  for (MultiDevice &device : devices) {
+    for (Dependencies &dependencies : device.dependencies) {
+      dependencies.release();
+    }
+    for (cl_event event : device.waitList) {
+      checkError(clReleaseEvent(event));
+    }
+    device.waitList.clear();
+  }
+  for (Dependencies &dependencies : hostXDependencies) {
+    dependencies.release();
+  }
+  for (Dependencies &dependencies : hostPDependencies) {
+    dependencies.release();
+  }
+}
+
+/// Flush the queues of \a events. Commands waiting for an event of another
+/// queue may never start if that queue is not flushed (OpenCL 1.2, 5.13).
+static void flushQueuesOf(const std::vector<cl_event> &events) {
+  std::vector<cl_command_queue> flushed;
+  for (cl_event event : events) {
+    cl_command_queue queue;
+    checkError(clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(queue),
+                              &queue, NULL));
+    if (queue != NULL &&
+        std::find(flushed.begin(), flushed.end(), queue) == flushed.end()) {
+      checkError(clFlush(queue));
+      flushed.push_back(queue);
+    }
+  }
+}
+
+void CGMultiOpenCL::ordered(MultiDevice &device,
+                            std::initializer_list<Access> accesses,
+                            const std::function<void()> &enqueue,
+                            cl_event *event) {
+  if (!outOfOrder) {
+    enqueue();
+    return;
+  }
+
+  // Read after write, write after write and write after read.
+  assert(device.waitList.empty());
+  for (const Access &access : accesses) {
+    Dependencies &dependencies = *access.dependencies;
+    if (dependencies.write != NULL) {
+      checkError(clRetainEvent(dependencies.write));
+      device.waitList.push_back(dependencies.write);
+    }
+    if (access.write) {
+      for (cl_event read : dependencies.reads) {
+        checkError(clRetainEvent(read));
+        device.waitList.push_back(read);
+      }
+    }
+  }
+  // The events may come from other queues, including the gather queue.
+  flushQueuesOf(device.waitList);
+
+  enqueue();
+
+  // The enqueued commands are chained, so the last one completes all of them.
+  assert(device.waitList.size() == 1);
+  cl_event last = device.waitList[0];
+  device.waitList.clear();
+
+  for (const Access &access : accesses) {
+    Dependencies &dependencies = *access.dependencies;
+    checkError(clRetainEvent(last));
+    if (access.write) {
+      dependencies.release();
+      dependencies.write = last;
+    } else {
+      dependencies.reads.push_back(last);
+    }
+  }
+  if (event != NULL) {
+    *event = last;
+  } else {
+    checkError(clReleaseEvent(last));
+  }
+}
+
+void CGMultiOpenCL::allocateStaging(MultiDevice &device) {
+  for (int s = 0; s < 2; s++) {
+    // Memory allocated by the implementation is pinned for fast transfers.
+    device.staging[s] = checkedCreateBufferWithFlags(
+        CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, TransferBlockSize);
+    cl_int err;
+    device.stagingPtr[s] = clEnqueueMapBuffer(
+        device.transferQueue, device.staging[s], CL_TRUE, CL_MAP_WRITE, 0,
+        TransferBlockSize, 0, NULL, NULL, &err);
+    checkError(err);
+  }
+  device.nextStaging = 0;
+}
+
+void CGMultiOpenCL::freeStaging(MultiDevice &device) {
+  // The unmap is ordered after the transfers in the (in-order) queue.
+  for (int s = 0; s < 2; s++) {
+    checkError(clEnqueueUnmapMemObject(device.transferQueue, device.staging[s],
+                                       device.stagingPtr[s], 0, NULL, NULL));
+    checkedReleaseMemObject(device.staging[s]);
+    device.staging[s] = NULL;
+    device.stagingPtr[s] = NULL;
+
+    if (device.stagingEvents[s] != NULL) {
+      checkError(clReleaseEvent(device.stagingEvents[s]));
+      device.stagingEvents[s] = NULL;
+    }
+  }
+  checkError(clFlush(device.transferQueue));
+}
+
+void CGMultiOpenCL::enqueueTransferTo(Device &baseDevice, cl_mem buffer,
+                                      size_t size, const void *hostPtr) {
+  if (!pipelinedTransferTo) {
+    CGOpenCLBase::enqueueTransferTo(baseDevice, buffer, size, hostPtr);
+    return;
+  }
+  MultiDevice &device = static_cast<MultiDevice &>(baseDevice);
 
+  std::vector<cl_event> events;
+  for (size_t offset = 0; offset < size; offset += TransferBlockSize) {
+    size_t cb = size - offset;
+    if (cb > TransferBlockSize) {
+      cb = TransferBlockSize;
+    }
+
+    // Wait until the previous transfer from this staging buffer has finished.
+    // Meanwhile, the other staging buffer is transferred.
+    int s = device.nextStaging;
+    device.nextStaging = 1 - s;
+    if (device.stagingEvents[s] != NULL) {
+      checkError(clWaitForEvents(1, &device.stagingEvents[s]));
+      checkError(clReleaseEvent(device.stagingEvents[s]));
+    }
+
+    std::memcpy(device.stagingPtr[s], (const char *)hostPtr + offset, cb);
+    cl_event event;
+    checkError(clEnqueueWriteBuffer(device.transferQueue, buffer, CL_FALSE,
+                                    offset, cb, device.stagingPtr[s], 0, NULL,
+                                    &event));
+    checkError(clRetainEvent(event));
+    device.stagingEvents[s] = event;
+    events.push_back(event);
+  }
+  checkError(clFlush(device.transferQueue));
+
+  // Later commands on the device only wait for the blocks of this buffer.
+  // This includes the gather, which reads the vectors on its own queue.
+  for (cl_command_queue queue : {device.queue, device.gatherQueue}) {
+    checkError(clEnqueueBarrierWithWaitList(
+        queue, events.size(), events.empty() ? NULL : events.data(), NULL));
+  }
+  for (cl_event event : events) {
+    checkError(clReleaseEvent(event));
+  }
+}
+
+void CGMultiOpenCL::allocateAndCopyMatrix(MultiDevice &device, int length) {
+  int d = device.id;
   switch (matrixFormat) {
   case MatrixFormatCRS:
     if (!overlappedGather) {
@@ -245,7 +817,15 @@ void CGMultiOpenCL::doTransferToForDevice(int index) {
     }
     break;
   case MatrixFormatELL:
-    if (!overlappedGather) {
+    if (deviceConversion && !overlappedGather) {
+      allocateAndConvertMatrixDataELL(length, splitMatrixCRS->data[d], device,
+                                      device.matrixELL);
+    } else if (deviceConversion) {
+      allocateAndConvertMatrixDataELL(length, partitionedMatrixCRS->diag[d],
+                                      device, device.diagMatrixELL);
+      allocateAndConvertMatrixDataELL(length, partitionedMatrixCRS->minor[d],
+                                      device, device.matrixELL);
+    } else if (!overlappedGather) {
       allocateAndCopyMatrixDataELL(length, splitMatrixELL->data[d], device,
                                    device.matrixELL);
     } else {
@@ -258,25 +838,169 @@ void CGMultiOpenCL::doTransferToForDevice(int index) {
   default:
     assert(0 && "Invalid matrix format!");
   }
+}
+
+void CGMultiOpenCL::freeMatrix(MultiDevice &device) {
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    if (overlappedGather) {
+      freeMatrixCRSDevice(device.diagMatrixCRS);
+    }
+    freeMatrixCRSDevice(device.matrixCRS);
+    break;
+  case MatrixFormatELL:
+    if (overlappedGather) {
+      freeMatrixELLDevice(device.diagMatrixELL);
+    }
+    freeMatrixELLDevice(device.matrixELL);
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+}
+
+void CGMultiOpenCL::freeMatrixAndPreconditioner(MultiDevice &device) {
+  freeMatrix(device);
+
+  switch (preconditioner) {
+  case PreconditionerNone:
+    break;
+  case PreconditionerJacobi:
+    checkedReleaseMemObject(device.jacobi.C);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+}
+
+void CGMultiOpenCL::freeResidentMatrix() {
+  if (matrixOnDevices) {
+    for (MultiDevice &device : devices) {
+      freeMatrixAndPreconditioner(device);
+    }
+    matrixOnDevices = false;
+  }
+}
+
+void CGMultiOpenCL::copyMatrixValues(MultiDevice &device, int length) {
+  int d = device.id;
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      copyMatrixValuesCRS(length, splitMatrixCRS->data[d], device,
+                          device.matrixCRS);
+    } else {
+      copyMatrixValuesCRS(length, partitionedMatrixCRS->diag[d], device,
+                          device.diagMatrixCRS);
+      copyMatrixValuesCRS(length, partitionedMatrixCRS->minor[d], device,
+                          device.matrixCRS);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      copyMatrixValuesELL(splitMatrixELL->data[d], device, device.matrixELL);
+    } else {
+      copyMatrixValuesELL(partitionedMatrixELL->diag[d], device,
+                          device.diagMatrixELL);
+      copyMatrixValuesELL(partitionedMatrixELL->minor[d], device,
+                          device.matrixELL);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+
+  switch (preconditioner) {
+  case PreconditionerNone:
+    break;
+  case PreconditionerJacobi:
+    copyIntoBuffer(device, device.jacobi.C, sizeof(floatType) * length,
+                   jacobi->C + workDistribution->offsets[d]);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+}
+
+void CGMultiOpenCL::refreshResidentMatrix() {
+  if (!matrixOnDevices) {
+    return;
+  } else if (deviceConversion) {
+    // The chunks have to be converted on the devices again.
+    freeResidentMatrix();
+    return;
+  }
+
+  // Only the values have changed, so keep the buffers for the structure.
+  for (MultiDevice &device : devices) {
+    if (pipelinedTransferTo) {
+      allocateStaging(device);
+    }
+    copyMatrixValues(device, workDistribution->lengths[device.id]);
+    if (pipelinedTransferTo) {
+      freeStaging(device);
+    }
+  }
+  finishAllDevices();
+}
+
+void CGMultiOpenCL::doTransferToForDevice(int index) {
+  size_t fullVectorSize = sizeof(floatType) * N;
+
+  MultiDevice &device = devices[index];
+  int d = device.id;
+  int offset = workDistribution->offsets[d];
+  int length = workDistribution->lengths[d];
+
+  if (pipelinedTransferTo) {
+    allocateStaging(device);
+  }
+
+  size_t vectorSize = sizeof(floatType) * length;
+  device.k = checkedCreateReadBuffer(vectorSize);
+  device.x = checkedCreateBuffer(fullVectorSize);
+  enqueueTransferTo(device, device.k, vectorSize, k + offset);
+  enqueueTransferTo(device, device.x, fullVectorSize, x);
+
+  device.p = checkedCreateBuffer(fullVectorSize);
+  device.q = checkedCreateBuffer(vectorSize);
+  device.r = checkedCreateBuffer(vectorSize);
   if (preconditioner != PreconditionerNone) {
     device.z = checkedCreateBuffer(vectorSize);
+  }
+
+  // The matrix may still be on the device from an earlier solve.
+  if (!matrixOnDevices) {
+    allocateAndCopyMatrix(device, length);
 
     switch (preconditioner) {
+    case PreconditionerNone:
+      break;
     case PreconditionerJacobi:
       device.jacobi.C = checkedCreateBuffer(vectorSize);
-      device.checkedEnqueueWriteBuffer(device.jacobi.C, vectorSize,
-                                       jacobi->C + offset);
+      enqueueTransferTo(device, device.jacobi.C, vectorSize,
+                        jacobi->C + offset);
       break;
     default:
       assert(0 && "Invalid preconditioner!");
     }
   }
 
-  device.tmp = checkedCreateBuffer(sizeof(floatType) * Device::MaxGroups);
+  allocateTmp(device);
+  if (fusedSolve) {
+    allocateFused(device, getNumberOfChunks());
+  }
+
+  if (pipelinedTransferTo) {
+    freeStaging(device);
+    // Start the transfers and possibly the conversion of the matrix.
+    device.checkedFlush();
+  }
 }
 
 void CGMultiOpenCL::doTransferTo() {
-  int numDevices = getNumberOfChunks();
+  int numDevices = devices.size();
+  bool transferMatrix = !matrixOnDevices;
 
   // In theory, all enqueued transfers in doTransferToForDevice are nonblocking.
   // However in practice, CUDA and hence pocl-cuda cannot overlap asynchronous
@@ -302,7 +1026,29 @@ void CGMultiOpenCL::doTransferTo() {
   }
 
   // We have to wait in both cases because doTransferToForDevice does not!
-  finishAllDevices();
+  // If pipelined, the first kernels of the solver wait for the transfers on
+  // their device instead.
+  if (!pipelinedTransferTo) {
+    finishAllDevices();
+  }
+  matrixOnDevices = residentMatrix;
+
+  if (tuning && transferMatrix) {
+    for (MultiDevice &device : devices) {
+      int length = workDistribution->lengths[device.id];
+      tuneLaunchConfiguration(device, length, [&] {
+        enqueueMatvec(device, device.x, device.q, 0, length);
+      });
+    }
+  }
+  if (rebalanceIterations > 0) {
+    // Only measure the matvec kernels of the solver.
+    for (MultiDevice &device : devices) {
+      device.collectProfile();
+      device.matvecTimeStart = getMatvecTime(device);
+    }
+  }
+  releaseDependencies();
 }
 
 void CGMultiOpenCL::doTransferFrom() {
@@ -312,8 +1058,10 @@ void CGMultiOpenCL::doTransferFrom() {
     int offset = workDistribution->offsets[d];
     int length = workDistribution->lengths[d];
 
-    device.checkedEnqueueReadBuffer(device.x, sizeof(floatType) * offset,
-                                    sizeof(floatType) * length, x + offset);
+    ordered(device, {read(getDependencies(device, VectorX))}, [&] {
+      device.checkedEnqueueReadBuffer(device.x, sizeof(floatType) * offset,
+                                      sizeof(floatType) * length, x + offset);
+    });
 
     checkedReleaseMemObject(device.k);
     checkedReleaseMemObject(device.x);
@@ -322,39 +1070,162 @@ void CGMultiOpenCL::doTransferFrom() {
     checkedReleaseMemObject(device.q);
     checkedReleaseMemObject(device.r);
 
-    switch (matrixFormat) {
-    case MatrixFormatCRS:
-      if (overlappedGather) {
-        freeMatrixCRSDevice(device.diagMatrixCRS);
+    if (!matrixOnDevices) {
+      freeMatrixAndPreconditioner(device);
+    }
+    if (preconditioner != PreconditionerNone) {
+      checkedReleaseMemObject(device.z);
+    }
+
+    checkedReleaseMemObject(device.tmp);
+    if (fusedSolve) {
+      freeFused(device);
+    }
+  }
+
+  finishAllDevices();
+  releaseDependencies();
+}
+
+double CGMultiOpenCL::getMatvecTime(MultiDevice &device) {
+  double time = 0;
+  for (auto &entry : device.profile) {
+    if (entry.first.compare(0, 6, "matvec") == 0) {
+      time += entry.second.execution;
+    }
+  }
+  return time;
+}
+
+void CGMultiOpenCL::getChunkTimes(double *times) {
+  // Also collects the profiling information of all completed commands.
+  finishAllDevices();
+  for (MultiDevice &device : devices) {
+    times[device.id] = getMatvecTime(device) - device.matvecTimeStart;
+  }
+}
+
+/// @return the parts of [\a from, \a to) that are not in [\a from2, \a to2).
+static std::vector<std::pair<int, int>> subtractRange(int from, int to,
+                                                      int from2, int to2) {
+  std::vector<std::pair<int, int>> ranges;
+  if (from < std::min(to, from2)) {
+    ranges.emplace_back(from, std::min(to, from2));
+  }
+  if (std::max(from, to2) < to) {
+    ranges.emplace_back(std::max(from, to2), to);
+  }
+  return ranges;
+}
+
+void CGMultiOpenCL::migrateChunks(const WorkDistribution &old) {
+  finishAllDevices();
+  releaseDependencies();
+
+  // Only the rows of the vectors carried to the next iteration have to move,
+  // CG#VectorQ and CG#VectorZ are recomputed from them.
+  const Vector migrate[] = {VectorX, VectorP, VectorR};
+  const int NumberOfMigrated = 3;
+  std::unique_ptr<floatType[]> moved[NumberOfMigrated];
+  for (int m = 0; m < NumberOfMigrated; m++) {
+    moved[m].reset(new floatType[N]);
+  }
+  size_t size = sizeof(floatType);
+
+  // Read the rows that leave a device...
+  for (MultiDevice &device : devices) {
+    int d = device.id;
+    int oldOffset = old.offsets[d], oldLength = old.lengths[d];
+    int newOffset = workDistribution->offsets[d];
+    int newLength = workDistribution->lengths[d];
+    for (auto &range : subtractRange(oldOffset, oldOffset + oldLength,
+                                     newOffset, newOffset + newLength)) {
+      for (int m = 0; m < NumberOfMigrated; m++) {
+        // CG#VectorR is only allocated for the chunk.
+        int bufferOffset = (migrate[m] == VectorR ? oldOffset : 0);
+        device.checkedEnqueueReadBuffer(
+            device.getVector(migrate[m]),
+            size * (range.first - bufferOffset),
+            size * (range.second - range.first), moved[m].get() + range.first);
       }
-      freeMatrixCRSDevice(device.matrixCRS);
-      break;
-    case MatrixFormatELL:
-      if (overlappedGather) {
-        freeMatrixELLDevice(device.diagMatrixELL);
+    }
+  }
+  finishAllDevices();
+
+  // ... and write them to their new device.
+  std::vector<cl_mem> released;
+  for (MultiDevice &device : devices) {
+    int d = device.id;
+    int oldOffset = old.offsets[d], oldLength = old.lengths[d];
+    int newOffset = workDistribution->offsets[d];
+    int newLength = workDistribution->lengths[d];
+    device.workDistribution = workDistribution.get();
+    if (oldOffset == newOffset && oldLength == newLength) {
+      // The chunk of the matrix did not change either.
+      continue;
+    }
+
+    size_t vectorSize = size * newLength;
+    cl_mem r = checkedCreateBuffer(vectorSize);
+    int retainedFrom = std::max(oldOffset, newOffset);
+    int retainedTo = std::min(oldOffset + oldLength, newOffset + newLength);
+    if (retainedFrom < retainedTo) {
+      device.checkedEnqueueCopyBuffer(
+          device.queue, device.r, r, size * (retainedFrom - oldOffset),
+          size * (retainedFrom - newOffset), size * (retainedTo - retainedFrom));
+    }
+    released.push_back(device.r);
+    device.r = r;
+
+    for (auto &range : subtractRange(newOffset, newOffset + newLength,
+                                     oldOffset, oldOffset + oldLength)) {
+      for (int m = 0; m < NumberOfMigrated; m++) {
+        int bufferOffset = (migrate[m] == VectorR ? newOffset : 0);
+        device.checkedEnqueueWriteBuffer(
+            device.getVector(migrate[m]),
+            size * (range.first - bufferOffset),
+            size * (range.second - range.first), moved[m].get() + range.first);
       }
-      freeMatrixELLDevice(device.matrixELL);
-      break;
-    default:
-      assert(0 && "Invalid matrix format!");
     }
+
+    // The other vectors and the matrix are allocated for the chunk.
+    released.push_back(device.k);
+    device.k = checkedCreateReadBuffer(vectorSize);
+    device.checkedEnqueueWriteBuffer(device.k, vectorSize, k + newOffset);
+    released.push_back(device.q);
+    device.q = checkedCreateBuffer(vectorSize);
     if (preconditioner != PreconditionerNone) {
-      checkedReleaseMemObject(device.z);
+      released.push_back(device.z);
+      device.z = checkedCreateBuffer(vectorSize);
 
       switch (preconditioner) {
-      case PreconditionerJacobi: {
-        checkedReleaseMemObject(device.jacobi.C);
+      case PreconditionerJacobi:
+        released.push_back(device.jacobi.C);
+        device.jacobi.C = checkedCreateBuffer(vectorSize);
+        device.checkedEnqueueWriteBuffer(device.jacobi.C, vectorSize,
+                                         jacobi->C + newOffset);
         break;
-      }
       default:
         assert(0 && "Invalid preconditioner!");
       }
     }
 
-    checkedReleaseMemObject(device.tmp);
+    freeMatrix(device);
+    if (pipelinedTransferTo) {
+      allocateStaging(device);
+    }
+    allocateAndCopyMatrix(device, newLength);
+    if (pipelinedTransferTo) {
+      freeStaging(device);
+    }
+    device.calculateLaunchConfiguration(newLength);
   }
 
   finishAllDevices();
+  releaseDependencies();
+  for (cl_mem buffer : released) {
+    checkedReleaseMemObject(buffer);
+  }
 }
 
 void CGMultiOpenCL::cpy(Vector _dst, Vector _src) {
@@ -365,13 +1236,28 @@ void CGMultiOpenCL::cpy(Vector _dst, Vector _src) {
     cl_mem src = device.getVector(_src);
     int srcOffset = device.getOffset(_src);
 
-    checkError(clEnqueueCopyBuffer(device.queue, src, dst,
-                                   sizeof(floatType) * srcOffset,
-                                   sizeof(floatType) * dstOffset,
-                                   sizeof(floatType) * length, 0, NULL, NULL));
+    ordered(device, {write(getDependencies(device, _dst)),
+                     read(getDependencies(device, _src))},
+            [&] {
+              device.checkedEnqueueCopyBuffer(
+                  device.queue, src, dst, sizeof(floatType) * srcOffset,
+                  sizeof(floatType) * dstOffset, sizeof(floatType) * length);
+            });
+  }
+  if (hostChunk) {
+    floatType *dst = getHostVector(_dst);
+    floatType *src = getHostVector(_src);
+    computeOnHost([&](int offset, int length) {
+      #pragma omp parallel for
+      for (int i = offset; i < offset + length; i++) {
+        dst[i] = src[i];
+      }
+    });
   }
 
-  finishAllDevices();
+  if (!outOfOrder) {
+    finishAllDevices();
+  }
 }
 
 void CGMultiOpenCL::matvecGatherXViaHost(Vector _x) {
@@ -395,30 +1281,43 @@ void CGMultiOpenCL::matvecGatherXViaHost(Vector _x) {
     cl_mem x = device.getVector(_x);
     assert(offset == device.getOffset(_x));
 
-    device.checkedEnqueueReadBuffer(device.gatherQueue, x,
-                                    sizeof(floatType) * offset,
-                                    sizeof(floatType) * length, xHost + offset);
+    ordered(device, {read(getDependencies(device, _x)),
+                     write(getHostDependencies(_x, device.id))},
+            [&] {
+              device.checkedEnqueueReadBuffer(
+                  device.gatherQueue, x, sizeof(floatType) * offset,
+                  sizeof(floatType) * length, xHost + offset);
+            });
+  }
+  if (!outOfOrder) {
+    finishAllDevicesGatherQueue();
   }
-  finishAllDevicesGatherQueue();
 
   // Transfer x to devices.
   for (MultiDevice &device : devices) {
     cl_mem x = device.getVector(_x);
 
-    for (MultiDevice &src : devices) {
-      if (src.id == device.id) {
+    // Also transfer the chunk computed on the host, if any.
+    for (int c = 0; c < getNumberOfChunks(); c++) {
+      if (c == device.id) {
         // Don't transfer chunk that is already on the device.
         continue;
       }
-      int offset = workDistribution->offsets[src.id];
-      int length = workDistribution->lengths[src.id];
-
-      device.checkedEnqueueWriteBuffer(
-          device.gatherQueue, x, sizeof(floatType) * offset,
-          sizeof(floatType) * length, xHost + offset);
+      int offset = workDistribution->offsets[c];
+      int length = workDistribution->lengths[c];
+
+      ordered(device, {read(getHostDependencies(_x, c)),
+                       write(getDependencies(device, _x, /* remote= */ true))},
+              [&] {
+                device.checkedEnqueueWriteBuffer(
+                    device.gatherQueue, x, sizeof(floatType) * offset,
+                    sizeof(floatType) * length, xHost + offset);
+              });
     }
   }
-  finishAllDevicesGatherQueue();
+  if (!outOfOrder) {
+    finishAllDevicesGatherQueue();
+  }
 }
 
 void CGMultiOpenCL::matvecGatherXOnDevices(Vector _x) {
@@ -437,13 +1336,158 @@ void CGMultiOpenCL::matvecGatherXOnDevices(Vector _x) {
       assert(offset == device.getOffset(_x));
       size_t offsetInBytes = sizeof(floatType) * offset;
 
-      checkError(clEnqueueCopyBuffer(device.gatherQueue, xSrc, x, offsetInBytes,
-                                     offsetInBytes, sizeof(floatType) * length,
-                                     0, NULL, NULL));
+      ordered(device, {read(getDependencies(src, _x)),
+                       write(getDependencies(device, _x, /* remote= */ true))},
+              [&] {
+                device.checkedEnqueueCopyBuffer(
+                    device.gatherQueue, xSrc, x, offsetInBytes, offsetInBytes,
+                    sizeof(floatType) * length);
+              });
+    }
+  }
+
+  if (!outOfOrder) {
+    finishAllDevicesGatherQueue();
+  }
+}
+
+void CGMultiOpenCL::matvecOnHost(const MatrixDataCRS &data, floatType *x,
+                                 floatType *y, bool roundup) {
+  int offset = workDistribution->offsets[getHostChunk()];
+  int length = workDistribution->lengths[getHostChunk()];
+  int *ptr = data.ptr;
+  int *index = data.index;
+  floatType *value = data.value;
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    floatType tmp = (roundup ? y[offset + i] : 0);
+    for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+      tmp += value[j] * x[index[j]];
+    }
+    y[offset + i] = tmp;
+  }
+}
+
+void CGMultiOpenCL::matvecOnHost(const MatrixDataELL &data, floatType *x,
+                                 floatType *y, bool roundup) {
+  int offset = workDistribution->offsets[getHostChunk()];
+  int length = workDistribution->lengths[getHostChunk()];
+  int *lengthA = data.length;
+  int *index = data.index;
+  floatType *values = data.data;
+
+  #pragma omp parallel for
+  for (int i = 0; i < length; i++) {
+    floatType tmp = (roundup ? y[offset + i] : 0);
+    for (int j = 0; j < lengthA[i]; j++) {
+      int k = j * length + i;
+      tmp += values[k] * x[index[k]];
     }
+    y[offset + i] = tmp;
   }
+}
+
+void CGMultiOpenCL::calibrateHost(const MatrixDataCRS &sample, int sampleRows,
+                                  WorkDistribution::Cost &cost) {
+  // The columns of the sample may refer to any row.
+  std::vector<floatType> x(N, 1), y(N, 1);
+  auto time = [](const std::function<void()> &kernel) {
+    // Warm up so that starting the threads is not measured.
+    kernel();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < TuningRepetitions; i++) {
+      kernel();
+    }
+    std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start;
+    return duration.count();
+  };
 
-  finishAllDevicesGatherQueue();
+  // Measure the kernels of the host chunk for some rows.
+  auto measure = [&](int rows) {
+    int *ptr = sample.ptr;
+    int *index = sample.index;
+    floatType *value = sample.value;
+    floatType *xp = x.data();
+    floatType *yp = y.data();
+
+    CalibrationTimes times;
+    times.matvec = time([&] {
+      #pragma omp parallel for
+      for (int i = 0; i < rows; i++) {
+        floatType tmp = 0;
+        for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+          tmp += value[j] * xp[index[j]];
+        }
+        yp[i] = tmp;
+      }
+    });
+    times.vector = time([&] {
+      #pragma omp parallel for
+      for (int i = 0; i < rows; i++) {
+        yp[i] += 0 * xp[i];
+      }
+    });
+    // The gather via host already transfers all values to the host.
+    times.transfer = 0;
+    return times;
+  };
+  int halfRows = std::max(sampleRows / 2, 1);
+  CalibrationTimes half = measure(halfRows);
+  CalibrationTimes full = measure(sampleRows);
+  fitCalibration(sample, halfRows, sampleRows, half, full, cost);
+}
+
+void CGMultiOpenCL::matvecHostChunk(Vector _x, Vector _y, bool diag) {
+  int h = getHostChunk();
+  floatType *x = getHostVector(_x);
+  floatType *y = getHostVector(_y);
+
+  // The host has the matrix in the format transferred to the devices.
+  switch (getHostMatrixFormat()) {
+  case MatrixFormatCRS:
+    if (!overlappedGather) {
+      matvecOnHost(splitMatrixCRS->data[h], x, y, /* roundup= */ false);
+    } else if (diag) {
+      matvecOnHost(partitionedMatrixCRS->diag[h], x, y, /* roundup= */ false);
+    } else {
+      matvecOnHost(partitionedMatrixCRS->minor[h], x, y, /* roundup= */ true);
+    }
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      matvecOnHost(splitMatrixELL->data[h], x, y, /* roundup= */ false);
+    } else if (diag) {
+      matvecOnHost(partitionedMatrixELL->diag[h], x, y, /* roundup= */ false);
+    } else {
+      matvecOnHost(partitionedMatrixELL->minor[h], x, y, /* roundup= */ true);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+}
+
+void CGMultiOpenCL::enqueueMatvec(MultiDevice &device, cl_mem x, cl_mem y,
+                                  int yOffset, int length) {
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    enqueueMatvecCRS(device, device.matrixCRS, x, y, yOffset, length,
+                     /* roundup= */ overlappedGather);
+    break;
+  case MatrixFormatELL:
+    if (!overlappedGather) {
+      device.checkedEnqueueMatvecKernelELL(matvecKernelELL, device.matrixELL,
+                                           x, y, yOffset, length);
+    } else {
+      device.checkedEnqueueMatvecKernelELL(
+          matvecKernelELLRoundup, device.matrixELL, x, y, yOffset, length);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
 }
 
 void CGMultiOpenCL::matvecKernel(Vector _x, Vector _y) {
@@ -458,18 +1502,29 @@ void CGMultiOpenCL::matvecKernel(Vector _x, Vector _y) {
       cl_mem y = device.getVector(_y);
       int yOffset = device.getOffset(_y);
 
-      switch (matrixFormat) {
-      case MatrixFormatCRS:
-        device.checkedEnqueueMatvecKernelCRS(
-            matvecKernelCRS, device.diagMatrixCRS, x, y, yOffset, length);
-        break;
-      case MatrixFormatELL:
-        device.checkedEnqueueMatvecKernelELL(
-            matvecKernelELL, device.diagMatrixELL, x, y, yOffset, length);
-        break;
-      default:
-        assert(0 && "Invalid matrix format!");
-      }
+      ordered(device, {read(getDependencies(device, _x)),
+                       write(getDependencies(device, _y))},
+              [&] {
+                switch (matrixFormat) {
+                case MatrixFormatCRS:
+                  enqueueMatvecCRS(device, device.diagMatrixCRS, x, y, yOffset,
+                                   length, /* roundup= */ false);
+                  break;
+                case MatrixFormatELL:
+                  device.checkedEnqueueMatvecKernelELL(matvecKernelELL,
+                                                       device.diagMatrixELL, x,
+                                                       y, yOffset, length);
+                  break;
+                default:
+                  assert(0 && "Invalid matrix format!");
+                }
+              });
+    }
+    if (hostChunk) {
+      // Only needs the part of the host chunk, which is already on the host.
+      computeOnHost([&](int, int) {
+        matvecHostChunk(_x, _y, /* diag= */ true);
+      });
     }
   }
 
@@ -490,31 +1545,22 @@ void CGMultiOpenCL::matvecKernel(Vector _x, Vector _y) {
     cl_mem y = device.getVector(_y);
     int yOffset = device.getOffset(_y);
 
-    switch (matrixFormat) {
-    case MatrixFormatCRS:
-      if (!overlappedGather) {
-        device.checkedEnqueueMatvecKernelCRS(matvecKernelCRS, device.matrixCRS,
-                                             x, y, yOffset, length);
-      } else {
-        device.checkedEnqueueMatvecKernelCRS(
-            matvecKernelCRSRoundup, device.matrixCRS, x, y, yOffset, length);
-      }
-      break;
-    case MatrixFormatELL:
-      if (!overlappedGather) {
-        device.checkedEnqueueMatvecKernelELL(matvecKernelELL, device.matrixELL,
-                                             x, y, yOffset, length);
-      } else {
-        device.checkedEnqueueMatvecKernelELL(
-            matvecKernelELLRoundup, device.matrixELL, x, y, yOffset, length);
-      }
-      break;
-    default:
-      assert(0 && "Invalid matrix format!");
-    }
+    ordered(
+        device,
+        {read(getDependencies(device, _x)),
+         read(getDependencies(device, _x, /* remote= */ true)),
+         write(getDependencies(device, _y))},
+        [&] { enqueueMatvec(device, x, y, yOffset, length); });
+  }
+  if (hostChunk) {
+    computeOnHost([&](int, int) {
+      matvecHostChunk(_x, _y, /* diag= */ false);
+    });
   }
 
-  finishAllDevices();
+  if (!outOfOrder) {
+    finishAllDevices();
+  }
 }
 
 void CGMultiOpenCL::axpyKernel(floatType a, Vector _x, Vector _y) {
@@ -531,10 +1577,24 @@ void CGMultiOpenCL::axpyKernel(floatType a, Vector _x, Vector _y) {
     checkedSetKernelArg(axpyKernelCL, 3, sizeof(cl_mem), &y);
     checkedSetKernelArg(axpyKernelCL, 4, sizeof(int), &yOffset);
     checkedSetKernelArg(axpyKernelCL, 5, sizeof(int), &length);
-    device.checkedEnqueueNDRangeKernel(axpyKernelCL);
+    ordered(device, {read(getDependencies(device, _x)),
+                     write(getDependencies(device, _y))},
+            [&] { device.checkedEnqueueNDRangeKernel(axpyKernelCL); });
+  }
+  if (hostChunk) {
+    floatType *x = getHostVector(_x);
+    floatType *y = getHostVector(_y);
+    computeOnHost([&](int offset, int length) {
+      #pragma omp parallel for
+      for (int i = offset; i < offset + length; i++) {
+        y[i] += a * x[i];
+      }
+    });
   }
 
-  finishAllDevices();
+  if (!outOfOrder) {
+    finishAllDevices();
+  }
 }
 
 void CGMultiOpenCL::xpayKernel(Vector _x, floatType a, Vector _y) {
@@ -551,17 +1611,31 @@ void CGMultiOpenCL::xpayKernel(Vector _x, floatType a, Vector _y) {
     checkedSetKernelArg(xpayKernelCL, 3, sizeof(cl_mem), &y);
     checkedSetKernelArg(xpayKernelCL, 4, sizeof(int), &yOffset);
     checkedSetKernelArg(xpayKernelCL, 5, sizeof(int), &length);
-    device.checkedEnqueueNDRangeKernel(xpayKernelCL);
+    ordered(device, {read(getDependencies(device, _x)),
+                     write(getDependencies(device, _y))},
+            [&] { device.checkedEnqueueNDRangeKernel(xpayKernelCL); });
+  }
+  if (hostChunk) {
+    floatType *x = getHostVector(_x);
+    floatType *y = getHostVector(_y);
+    computeOnHost([&](int offset, int length) {
+      #pragma omp parallel for
+      for (int i = offset; i < offset + length; i++) {
+        y[i] = x[i] + a * y[i];
+      }
+    });
   }
 
-  finishAllDevices();
+  if (!outOfOrder) {
+    finishAllDevices();
+  }
 }
 
 floatType CGMultiOpenCL::vectorDotKernel(Vector _a, Vector _b) {
-  size_t localForVectorDot = Device::Local * sizeof(floatType);
-  size_t localForReduce = Device::MaxGroups * sizeof(floatType);
-
+  std::vector<cl_event> events;
   for (MultiDevice &device : devices) {
+    size_t localForVectorDot = device.local * sizeof(floatType);
+    size_t localForReduce = device.maxGroups * sizeof(floatType);
     int length = workDistribution->lengths[device.id];
     cl_mem a = device.getVector(_a);
     int aOffset = device.getOffset(_a);
@@ -571,32 +1645,64 @@ floatType CGMultiOpenCL::vectorDotKernel(Vector _a, Vector _b) {
     // inspired by
     // https://devblogs.nvidia.com/parallelforall/faster-parallel-reductions-kepler/
 
-    checkedSetKernelArg(vectorDotKernelCL, 0, sizeof(cl_mem), &a);
-    checkedSetKernelArg(vectorDotKernelCL, 1, sizeof(int), &aOffset);
-    checkedSetKernelArg(vectorDotKernelCL, 2, sizeof(cl_mem), &b);
-    checkedSetKernelArg(vectorDotKernelCL, 3, sizeof(int), &bOffset);
-    checkedSetKernelArg(vectorDotKernelCL, 4, sizeof(cl_mem), &device.tmp);
-    checkedSetKernelArg(vectorDotKernelCL, 5, localForVectorDot, NULL);
-    checkedSetKernelArg(vectorDotKernelCL, 6, sizeof(int), &length);
-    device.checkedEnqueueNDRangeKernel(vectorDotKernelCL);
-
-    checkedSetKernelArg(deviceReduceKernel, 0, sizeof(cl_mem), &device.tmp);
-    checkedSetKernelArg(deviceReduceKernel, 1, sizeof(cl_mem), &device.tmp);
-    checkedSetKernelArg(deviceReduceKernel, 2, localForReduce, NULL);
-    checkedSetKernelArg(deviceReduceKernel, 3, sizeof(int), &device.groups);
-    device.checkedEnqueueNDRangeKernel(deviceReduceKernel, Device::MaxGroups,
-                                       Device::MaxGroups);
+    cl_event event;
+    ordered(device, {read(getDependencies(device, _a)),
+                     read(getDependencies(device, _b)),
+                     write(device.dependencies[ResourceTmp])},
+            [&] {
+              checkedSetKernelArg(vectorDotKernelCL, 0, sizeof(cl_mem), &a);
+              checkedSetKernelArg(vectorDotKernelCL, 1, sizeof(int), &aOffset);
+              checkedSetKernelArg(vectorDotKernelCL, 2, sizeof(cl_mem), &b);
+              checkedSetKernelArg(vectorDotKernelCL, 3, sizeof(int), &bOffset);
+              checkedSetKernelArg(vectorDotKernelCL, 4, sizeof(cl_mem),
+                                  &device.tmp);
+              checkedSetKernelArg(vectorDotKernelCL, 5, localForVectorDot,
+                                  NULL);
+              checkedSetKernelArg(vectorDotKernelCL, 6, sizeof(int), &length);
+              device.checkedEnqueueNDRangeKernel(vectorDotKernelCL);
+
+              checkedSetKernelArg(deviceReduceKernel, 0, sizeof(cl_mem),
+                                  &device.tmp);
+              checkedSetKernelArg(deviceReduceKernel, 1, sizeof(cl_mem),
+                                  &device.tmp);
+              checkedSetKernelArg(deviceReduceKernel, 2, localForReduce, NULL);
+              checkedSetKernelArg(deviceReduceKernel, 3, sizeof(int),
+                                  &device.groups);
+              device.checkedEnqueueNDRangeKernel(
+                  deviceReduceKernel, device.maxGroups, device.maxGroups);
+
+              device.checkedEnqueueReadBuffer(device.tmp, sizeof(floatType),
+                                              &device.vectorDotResult);
+            },
+            outOfOrder ? &event : NULL);
+    if (outOfOrder) {
+      events.push_back(event);
+    }
+  }
 
-    device.checkedEnqueueReadBuffer(device.tmp, sizeof(floatType),
-                                    &device.vectorDotResult);
+  floatType hostResult = 0;
+  if (hostChunk) {
+    floatType *a = getHostVector(_a);
+    floatType *b = getHostVector(_b);
+    computeOnHost([&](int offset, int length) {
+      #pragma omp parallel for reduction(+:hostResult)
+      for (int i = offset; i < offset + length; i++) {
+        hostResult += a[i] * b[i];
+      }
+    });
   }
 
   // Synchronize devices and reduce partial results.
+  if (outOfOrder) {
+    waitForEvents(events);
+  } else {
+    finishAllDevices();
+  }
   floatType res = 0;
   for (MultiDevice &device : devices) {
-    device.checkedFinish();
     res += device.vectorDotResult;
   }
+  res += hostResult;
 
   return res;
 }
@@ -623,24 +1729,198 @@ void CGMultiOpenCL::applyPreconditionerKernel(Vector _x, Vector _y) {
                           &yOffset);
       checkedSetKernelArg(applyPreconditionerKernelJacobi, 5, sizeof(int),
                           &length);
-      device.checkedEnqueueNDRangeKernel(applyPreconditionerKernelJacobi);
+      ordered(device, {read(getDependencies(device, _x)),
+                       write(getDependencies(device, _y))},
+              [&] {
+                device.checkedEnqueueNDRangeKernel(
+                    applyPreconditionerKernelJacobi);
+              });
       break;
     default:
       assert(0 && "Invalid preconditioner!");
     }
   }
+  if (hostChunk) {
+    floatType *x = getHostVector(_x);
+    floatType *y = getHostVector(_y);
+    floatType *C = jacobi->C;
+    computeOnHost([&](int offset, int length) {
+      #pragma omp parallel for
+      for (int i = offset; i < offset + length; i++) {
+        y[i] = C[i] * x[i];
+      }
+    });
+  }
+
+  if (!outOfOrder) {
+    finishAllDevices();
+  }
+}
+
+void CGMultiOpenCL::exchangePartials(std::vector<cl_event> &events) {
+  size_t partialsSize = sizeof(floatType) * NumberOfFusedPartials;
+  if (!outOfOrder) {
+    // The copies wait for the partial results on the other queues.
+    flushAllDevices();
+  }
+
+  for (MultiDevice &device : devices) {
+    for (MultiDevice &src : devices) {
+      if (src.id == device.id) {
+        // The partial results are already on the device.
+        continue;
+      }
+
+      size_t offset = partialsSize * src.id;
+      if (outOfOrder) {
+        ordered(device, {read(src.dependencies[ResourceFused]),
+                         write(device.dependencies[ResourceFused])},
+                [&] {
+                  device.checkedEnqueueCopyBuffer(device.queue, src.partials,
+                                                  device.partials, offset,
+                                                  offset, partialsSize);
+                });
+      } else {
+        checkError(clEnqueueCopyBuffer(device.queue, src.partials,
+                                       device.partials, offset, offset,
+                                       partialsSize, 1, &events[src.id],
+                                       NULL));
+      }
+    }
+  }
+
+  if (!outOfOrder) {
+    for (cl_event event : events) {
+      checkError(clReleaseEvent(event));
+    }
+  }
+}
+
+void CGMultiOpenCL::fusedInitKernel(floatType rho) {
+  for (MultiDevice &device : devices) {
+    ordered(device, {write(device.dependencies[ResourceFused])}, [&] {
+      device.checkedEnqueueWriteBuffer(device.scalars,
+                                       sizeof(floatType) * FusedScalarRho,
+                                       sizeof(floatType), &rho);
+    });
+  }
 
   finishAllDevices();
 }
 
-void CGMultiOpenCL::printSummary() {
-  CG::printSummary();
+// The following kernels don't synchronize with the host: All devices compute
+// the same scalars from the exchanged partial results.
+
+void CGMultiOpenCL::fusedAlphaKernel(Vector _p, Vector _q) {
+  std::vector<cl_event> events(devices.size());
+  for (MultiDevice &device : devices) {
+    int length = workDistribution->lengths[device.id];
+    assert(device.getOffset(_q) == 0);
+
+    ordered(device, {read(getDependencies(device, _p)),
+                     read(getDependencies(device, _q)),
+                     write(device.dependencies[ResourceTmp]),
+                     write(device.dependencies[ResourceFused])},
+            [&] {
+              enqueueFusedDot(device, device.getVector(_p),
+                              device.getOffset(_p), device.getVector(_q),
+                              length, device.id,
+                              outOfOrder ? NULL : &events[device.id]);
+            });
+  }
+
+  exchangePartials(events);
+
+  for (MultiDevice &device : devices) {
+    ordered(device, {write(device.dependencies[ResourceFused])}, [&] {
+      enqueueFusedScalarKernel(device, computeAlphaKernel, getNumberOfChunks());
+    });
+  }
+}
+
+void CGMultiOpenCL::fusedUpdateKernel() {
+  std::vector<cl_event> events(devices.size());
+  for (MultiDevice &device : devices) {
+    int length = workDistribution->lengths[device.id];
+
+    ordered(device, {write(getDependencies(device, VectorX)),
+                     read(getDependencies(device, VectorP)),
+                     read(getDependencies(device, VectorQ)),
+                     write(getDependencies(device, VectorR)),
+                     write(getDependencies(device, VectorZ)),
+                     write(device.dependencies[ResourceTmp]),
+                     write(device.dependencies[ResourceFused])},
+            [&] {
+              enqueueFusedUpdate(device, device.getOffset(VectorX),
+                                 device.getOffset(VectorP), length, device.id,
+                                 outOfOrder ? NULL : &events[device.id]);
+            });
+  }
+
+  exchangePartials(events);
+
+  for (MultiDevice &device : devices) {
+    ordered(device, {write(device.dependencies[ResourceFused])}, [&] {
+      enqueueFusedScalarKernel(device, computeBetaKernel, getNumberOfChunks());
+    });
+  }
+}
+
+void CGMultiOpenCL::fusedXpayKernel(Vector _x, Vector _y) {
+  for (MultiDevice &device : devices) {
+    int length = workDistribution->lengths[device.id];
+
+    ordered(device, {read(device.dependencies[ResourceFused]),
+                     read(getDependencies(device, _x)),
+                     write(getDependencies(device, _y))},
+            [&] {
+              enqueueFusedXpay(device, device.getVector(_x),
+                               device.getOffset(_x), device.getVector(_y),
+                               device.getOffset(_y), length);
+            });
+  }
 
-  std::cout << std::endl;
+  if (!outOfOrder) {
+    // The gather in matvecKernel uses a different queue.
+    finishAllDevices();
+  }
+}
+
+floatType CGMultiOpenCL::fusedResidualKernel() {
+  // All devices have the same value, so just read it from the first one.
+  MultiDevice &device = devices[0];
+  floatType r2;
+  cl_event event;
+  ordered(device, {read(device.dependencies[ResourceFused])},
+          [&] {
+            device.checkedEnqueueReadBuffer(device.scalars,
+                                            sizeof(floatType) * FusedScalarR2,
+                                            sizeof(floatType), &r2);
+          },
+          outOfOrder ? &event : NULL);
+  if (outOfOrder) {
+    std::vector<cl_event> events{event};
+    waitForEvents(events);
+  } else {
+    device.checkedFinish();
+  }
+
+  return r2;
+}
+
+void CGMultiOpenCL::printSummary() {
+  CGOpenCLBase::printSummary();
 
   if (parallelTransferTo) {
     std::cout << "Parallel transfer to the devices!" << std::endl;
   }
+  if (pipelinedTransferTo) {
+    std::cout << "Pipelined transfer to the devices!" << std::endl;
+  }
+  if (outOfOrder) {
+    std::cout << "Out-of-order queues with event dependencies!" << std::endl;
+  }
+  printPadded("Host wait time:", std::to_string(hostWait.count()));
 
   std::string gatherImplName;
   switch (gatherImpl) {
@@ -653,6 +1933,44 @@ void CGMultiOpenCL::printSummary() {
   }
   assert(gatherImplName.length() > 0);
   printPadded("Gather implementation:", gatherImplName);
+
+  std::string subDevicesName;
+  switch (subDevices) {
+  case SubDevicesNone:
+    subDevicesName = "none";
+    break;
+  case SubDevicesNUMA:
+    subDevicesName = "by NUMA node";
+    break;
+  case SubDevicesEqually:
+    subDevicesName = std::to_string(numberOfSubDevices) + " per device";
+    break;
+  }
+  assert(subDevicesName.length() > 0);
+  printPadded("Sub-devices:", subDevicesName);
+  printPadded("Devices:", std::to_string(devices.size()));
+  if (hostChunk) {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    printPadded("Host chunk threads:", std::to_string(threads));
+    printPadded("Host chunk time:", std::to_string(hostCompute.count()));
+  }
+
+  if (tuning) {
+    for (MultiDevice &device : devices) {
+      std::string label =
+          "Launch configuration " + std::to_string(device.id) + ":";
+      printLaunchConfiguration(device, label.c_str());
+    }
+  }
+  if (profiling) {
+    for (MultiDevice &device : devices) {
+      printProfile(device, "Profile of device " + std::to_string(device.id) +
+                               ":");
+    }
+  }
 }
 
 CG *CG::getInstance() { return new CGMultiOpenCL; }
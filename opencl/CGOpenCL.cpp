@@ -37,9 +37,19 @@ class CGOpenCL : public CGOpenCLBase {
 
   virtual void init(const char *matrixFile) override;
 
+  /// Allocate and transfer the matrix and the preconditioner.
+  void allocateAndCopyMatrix();
+  /// Free the matrix and the preconditioner on the device.
+  void freeMatrix();
+  virtual void freeResidentMatrix() override;
+  virtual void refreshResidentMatrix() override;
+
   virtual void doTransferTo() override;
   virtual void doTransferFrom() override;
 
+  /// Enqueue CG#matvec from \a x into \a y.
+  void enqueueMatvec(cl_mem x, cl_mem y);
+
   virtual void cpy(Vector _dst, Vector _src) override;
   virtual void matvecKernel(Vector _x, Vector _y) override;
   virtual void axpyKernel(floatType a, Vector _x, Vector _y) override;
@@ -47,6 +57,14 @@ class CGOpenCL : public CGOpenCLBase {
   virtual floatType vectorDotKernel(Vector _a, Vector _b) override;
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
+
+  virtual void fusedInitKernel(floatType rho) override;
+  virtual void fusedAlphaKernel(Vector _p, Vector _q) override;
+  virtual void fusedUpdateKernel() override;
+  virtual void fusedXpayKernel(Vector _x, Vector _y) override;
+  virtual floatType fusedResidualKernel() override;
+
+  virtual void printSummary() override;
 };
 const int CGOpenCL::ZERO = 0;
 
@@ -59,56 +77,156 @@ void CGOpenCL::init(const char *matrixFile) {
   checkError(err);
 
   device.init(device_id, this);
+  // The allocations when reading the matrix depend on this!
+  zeroCopy = zeroCopy && hasHostUnifiedMemory(device_id);
 
-  // Now that we have a working device, compile the program and read the matrix.
+  // Now that we have a working device, read the matrix and build the program.
   CGOpenCLBase::init(matrixFile);
 
   device.calculateLaunchConfiguration(N);
 }
 
-void CGOpenCL::doTransferTo() {
-  // Allocate memory on the device and transfer necessary data.
-  size_t vectorSize = sizeof(floatType) * N;
-  device.k = checkedCreateReadBuffer(vectorSize);
-  device.x = checkedCreateBuffer(vectorSize);
-  device.checkedEnqueueWriteBuffer(device.k, vectorSize, k);
-  device.checkedEnqueueWriteBuffer(device.x, vectorSize, x);
+void CGOpenCL::allocateAndCopyMatrix() {
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    allocateAndCopyMatrixDataCRS(N, *matrixCRS, device, device.matrixCRS);
+    break;
+  case MatrixFormatELL:
+    if (deviceConversion) {
+      allocateAndConvertMatrixDataELL(N, *matrixCRS, device, device.matrixELL);
+    } else {
+      allocateAndCopyMatrixDataELL(N, *matrixELL, device, device.matrixELL);
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
 
-  device.p = checkedCreateBuffer(vectorSize);
-  device.q = checkedCreateBuffer(vectorSize);
-  device.r = checkedCreateBuffer(vectorSize);
+  switch (preconditioner) {
+  case PreconditionerNone:
+    break;
+  case PreconditionerJacobi:
+    device.jacobi.C = checkedCreateBufferAndCopy(
+        device, CL_MEM_READ_WRITE, sizeof(floatType) * N, jacobi->C);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+}
 
+void CGOpenCL::freeMatrix() {
   switch (matrixFormat) {
   case MatrixFormatCRS:
-    allocateAndCopyMatrixDataCRS(N, *matrixCRS, device, device.matrixCRS);
+    freeMatrixCRSDevice(device.matrixCRS);
     break;
   case MatrixFormatELL:
-    allocateAndCopyMatrixDataELL(N, *matrixELL, device, device.matrixELL);
+    freeMatrixELLDevice(device.matrixELL);
     break;
   default:
     assert(0 && "Invalid matrix format!");
   }
+
+  switch (preconditioner) {
+  case PreconditionerNone:
+    break;
+  case PreconditionerJacobi:
+    checkedReleaseMemObject(device.jacobi.C);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+}
+
+void CGOpenCL::freeResidentMatrix() {
+  if (matrixOnDevices) {
+    freeMatrix();
+    matrixOnDevices = false;
+  }
+}
+
+void CGOpenCL::refreshResidentMatrix() {
+  if (!matrixOnDevices) {
+    return;
+  } else if (deviceConversion) {
+    // The matrix has to be converted on the device again.
+    freeResidentMatrix();
+    return;
+  }
+
+  // Only the values have changed, so keep the buffers for the structure.
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+    copyMatrixValuesCRS(N, *matrixCRS, device, device.matrixCRS);
+    break;
+  case MatrixFormatELL:
+    copyMatrixValuesELL(*matrixELL, device, device.matrixELL);
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+
+  switch (preconditioner) {
+  case PreconditionerNone:
+    break;
+  case PreconditionerJacobi:
+    copyIntoBuffer(device, device.jacobi.C, sizeof(floatType) * N, jacobi->C);
+    break;
+  default:
+    assert(0 && "Invalid preconditioner!");
+  }
+
+  device.checkedFinish();
+}
+
+void CGOpenCL::doTransferTo() {
+  // Allocate memory on the device and transfer necessary data.
+  size_t vectorSize = sizeof(floatType) * N;
+  device.k =
+      checkedCreateBufferAndCopy(device, CL_MEM_READ_ONLY, vectorSize, k);
+  device.x =
+      checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE, vectorSize, x);
+
+  device.p = checkedCreateBuffer(vectorSize);
+  device.q = checkedCreateBuffer(vectorSize);
+  device.r = checkedCreateBuffer(vectorSize);
+
+  // The matrix may still be on the device from an earlier solve.
+  bool transferMatrix = !matrixOnDevices;
+  if (transferMatrix) {
+    allocateAndCopyMatrix();
+  }
   if (preconditioner != PreconditionerNone) {
     device.z = checkedCreateBuffer(vectorSize);
-
-    switch (preconditioner) {
-    case PreconditionerJacobi:
-      device.jacobi.C = checkedCreateBuffer(vectorSize);
-      device.checkedEnqueueWriteBuffer(device.jacobi.C, vectorSize, jacobi->C);
-      break;
-    default:
-      assert(0 && "Invalid preconditioner!");
-    }
   }
 
-  device.tmp = checkedCreateBuffer(sizeof(floatType) * Device::MaxGroups);
+  allocateTmp(device);
+  if (fusedSolve) {
+    allocateFused(device, 1);
+  }
 
   device.checkedFinish();
+  matrixOnDevices = residentMatrix;
+
+  if (tuning && transferMatrix) {
+    tuneLaunchConfiguration(device, N,
+                            [&] { enqueueMatvec(device.x, device.q); });
+  }
 }
 
 void CGOpenCL::doTransferFrom() {
   // Copy back solution and free memory on the device.
-  device.checkedEnqueueReadBuffer(device.x, sizeof(floatType) * N, x);
+  if (zeroCopy) {
+    // Mapping makes sure that the host memory is up-to-date.
+    cl_int err;
+    void *mapped = clEnqueueMapBuffer(device.queue, device.x, CL_TRUE,
+                                      CL_MAP_READ, 0, sizeof(floatType) * N, 0,
+                                      NULL, NULL, &err);
+    checkError(err);
+    checkError(clEnqueueUnmapMemObject(device.queue, device.x, mapped, 0, NULL,
+                                       NULL));
+  } else {
+    device.checkedEnqueueReadBuffer(device.x, sizeof(floatType) * N, x);
+  }
   device.checkedFinish();
 
   checkedReleaseMemObject(device.k);
@@ -118,49 +236,33 @@ void CGOpenCL::doTransferFrom() {
   checkedReleaseMemObject(device.q);
   checkedReleaseMemObject(device.r);
 
-  switch (matrixFormat) {
-  case MatrixFormatCRS:
-    freeMatrixCRSDevice(device.matrixCRS);
-    break;
-  case MatrixFormatELL:
-    freeMatrixELLDevice(device.matrixELL);
-    break;
-  default:
-    assert(0 && "Invalid matrix format!");
+  if (!matrixOnDevices) {
+    freeMatrix();
   }
   if (preconditioner != PreconditionerNone) {
     checkedReleaseMemObject(device.z);
-
-    switch (preconditioner) {
-    case PreconditionerJacobi: {
-      checkedReleaseMemObject(device.jacobi.C);
-      break;
-    }
-    default:
-      assert(0 && "Invalid preconditioner!");
-    }
   }
 
   checkedReleaseMemObject(device.tmp);
+  if (fusedSolve) {
+    freeFused(device);
+  }
 }
 
 void CGOpenCL::cpy(Vector _dst, Vector _src) {
   cl_mem dst = device.getVector(_dst);
   cl_mem src = device.getVector(_src);
 
-  checkError(clEnqueueCopyBuffer(device.queue, src, dst, 0, 0,
-                                 sizeof(floatType) * N, 0, NULL, NULL));
+  device.checkedEnqueueCopyBuffer(device.queue, src, dst, 0, 0,
+                                  sizeof(floatType) * N);
   device.checkedFinish();
 }
 
-void CGOpenCL::matvecKernel(Vector _x, Vector _y) {
-  cl_mem x = device.getVector(_x);
-  cl_mem y = device.getVector(_y);
-
+void CGOpenCL::enqueueMatvec(cl_mem x, cl_mem y) {
   switch (matrixFormat) {
   case MatrixFormatCRS:
-    device.checkedEnqueueMatvecKernelCRS(matvecKernelCRS, device.matrixCRS, x,
-                                         y, ZERO, N);
+    enqueueMatvecCRS(device, device.matrixCRS, x, y, ZERO, N,
+                     /* roundup= */ false);
     break;
   case MatrixFormatELL:
     device.checkedEnqueueMatvecKernelELL(matvecKernelELL, device.matrixELL, x,
@@ -169,6 +271,10 @@ void CGOpenCL::matvecKernel(Vector _x, Vector _y) {
   default:
     assert(0 && "Invalid matrix format!");
   }
+}
+
+void CGOpenCL::matvecKernel(Vector _x, Vector _y) {
+  enqueueMatvec(device.getVector(_x), device.getVector(_y));
   device.checkedFinish();
 }
 
@@ -207,8 +313,8 @@ floatType CGOpenCL::vectorDotKernel(Vector _a, Vector _b) {
 
   // inspired by
   // https://devblogs.nvidia.com/parallelforall/faster-parallel-reductions-kepler/
-  size_t localForVectorDot = Device::Local * sizeof(floatType);
-  size_t localForReduce = Device::MaxGroups * sizeof(floatType);
+  size_t localForVectorDot = device.local * sizeof(floatType);
+  size_t localForReduce = device.maxGroups * sizeof(floatType);
 
   checkedSetKernelArg(vectorDotKernelCL, 0, sizeof(cl_mem), &a);
   checkedSetKernelArg(vectorDotKernelCL, 1, sizeof(int), &ZERO);
@@ -223,8 +329,8 @@ floatType CGOpenCL::vectorDotKernel(Vector _a, Vector _b) {
   checkedSetKernelArg(deviceReduceKernel, 1, sizeof(cl_mem), &device.tmp);
   checkedSetKernelArg(deviceReduceKernel, 2, localForReduce, NULL);
   checkedSetKernelArg(deviceReduceKernel, 3, sizeof(int), &device.groups);
-  device.checkedEnqueueNDRangeKernel(deviceReduceKernel, Device::MaxGroups,
-                                     Device::MaxGroups);
+  device.checkedEnqueueNDRangeKernel(deviceReduceKernel, device.maxGroups,
+                                     device.maxGroups);
 
   device.checkedEnqueueReadBuffer(device.tmp, sizeof(floatType), &res);
   device.checkedFinish();
@@ -253,4 +359,51 @@ void CGOpenCL::applyPreconditionerKernel(Vector _x, Vector _y) {
   device.checkedFinish();
 }
 
+void CGOpenCL::fusedInitKernel(floatType rho) {
+  device.checkedEnqueueWriteBuffer(device.scalars,
+                                   sizeof(floatType) * FusedScalarRho,
+                                   sizeof(floatType), &rho);
+  device.checkedFinish();
+}
+
+// The following kernels are only enqueued: The in-order queue serializes them
+// and the next blocking call waits for completion.
+
+void CGOpenCL::fusedAlphaKernel(Vector _p, Vector _q) {
+  enqueueFusedDot(device, device.getVector(_p), ZERO, device.getVector(_q), N,
+                  0);
+  enqueueFusedScalarKernel(device, computeAlphaKernel, 1);
+}
+
+void CGOpenCL::fusedUpdateKernel() {
+  enqueueFusedUpdate(device, ZERO, ZERO, N, 0);
+  enqueueFusedScalarKernel(device, computeBetaKernel, 1);
+}
+
+void CGOpenCL::fusedXpayKernel(Vector _x, Vector _y) {
+  enqueueFusedXpay(device, device.getVector(_x), ZERO, device.getVector(_y),
+                   ZERO, N);
+}
+
+floatType CGOpenCL::fusedResidualKernel() {
+  floatType r2;
+  device.checkedEnqueueReadBuffer(device.scalars,
+                                  sizeof(floatType) * FusedScalarR2,
+                                  sizeof(floatType), &r2);
+  device.checkedFinish();
+
+  return r2;
+}
+
+void CGOpenCL::printSummary() {
+  CGOpenCLBase::printSummary();
+
+  if (tuning) {
+    printLaunchConfiguration(device, "Launch configuration:");
+  }
+  if (profiling) {
+    printProfile(device, "Profile of the device:");
+  }
+}
+
 CG *CG::getInstance() { return new CGOpenCL; }
@@ -16,10 +16,27 @@
     You should have received a copy of the GNU General Public License
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <sstream>
+#include <string>
 #include <vector>
 
+#include <unistd.h>
+
+#include "../Matrix.h"
+#include "../Preconditioner.h"
 #include "CGOpenCLBase.h"
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
@@ -29,6 +46,75 @@ const char *source =
 #include "kernel.cl"
     ;
 
+const char *CG_OCL_BINARY_CACHE = "CG_OCL_BINARY_CACHE";
+
+const char *CG_OCL_ZERO_COPY = "CG_OCL_ZERO_COPY";
+
+const char *CG_OCL_PROFILING = "CG_OCL_PROFILING";
+
+const char *CG_OCL_TUNING = "CG_OCL_TUNING";
+
+const char *CG_OCL_DEVICE_CONVERSION = "CG_OCL_DEVICE_CONVERSION";
+
+const char *CG_OCL_CRS_KERNEL = "CG_OCL_CRS_KERNEL";
+const char *CG_OCL_CRS_KERNEL_SCALAR = "scalar";
+const char *CG_OCL_CRS_KERNEL_VECTOR = "vector";
+const char *CG_OCL_CRS_KERNEL_BINNED = "binned";
+const char *CG_OCL_CRS_KERNEL_AUTO = "auto";
+
+void CGOpenCLBase::parseEnvironment() {
+  CG::parseEnvironment();
+
+  const char *env = std::getenv(CG_OCL_BINARY_CACHE);
+  if (env != NULL && *env != 0) {
+    binaryCache = env;
+  }
+
+  env = std::getenv(CG_OCL_ZERO_COPY);
+  if (env != NULL && *env != 0) {
+    zeroCopy = (std::string(env) != "0");
+  }
+
+  env = std::getenv(CG_OCL_PROFILING);
+  if (env != NULL && *env != 0) {
+    profiling = (std::string(env) != "0");
+  }
+
+  env = std::getenv(CG_OCL_TUNING);
+  if (env != NULL && *env != 0) {
+    tuning = (std::string(env) != "0");
+  }
+
+  env = std::getenv(CG_OCL_DEVICE_CONVERSION);
+  if (env != NULL && *env != 0) {
+    deviceConversion = (std::string(env) != "0");
+  }
+  // Only the ELLPACK format is converted on the device.
+  deviceConversion = deviceConversion && matrixFormat == MatrixFormatELL;
+
+  env = std::getenv(CG_OCL_CRS_KERNEL);
+  if (env != NULL && *env != 0) {
+    std::string lower(env);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower == CG_OCL_CRS_KERNEL_SCALAR) {
+      crsKernel = CRSKernelScalar;
+    } else if (lower == CG_OCL_CRS_KERNEL_VECTOR) {
+      crsKernel = CRSKernelVector;
+    } else if (lower == CG_OCL_CRS_KERNEL_BINNED) {
+      crsKernel = CRSKernelBinned;
+    } else if (lower == CG_OCL_CRS_KERNEL_AUTO) {
+      crsKernel = CRSKernelAuto;
+    } else {
+      std::cerr << "Invalid value for " << CG_OCL_CRS_KERNEL << "! ("
+                << CG_OCL_CRS_KERNEL_SCALAR << ", " << CG_OCL_CRS_KERNEL_VECTOR
+                << ", " << CG_OCL_CRS_KERNEL_BINNED << ", or "
+                << CG_OCL_CRS_KERNEL_AUTO << ")" << std::endl;
+      invalidEnvironment();
+    }
+  }
+}
+
 std::vector<cl_device_id> CGOpenCLBase::getAllDevices() {
   cl_platform_id platform;
   checkError(clGetPlatformIDs(1, &platform, NULL));
@@ -41,20 +127,32 @@ std::vector<cl_device_id> CGOpenCLBase::getAllDevices() {
   checkError(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices,
                             queriedDevices.get(), NULL));
 
-  std::vector<cl_device_id> devices;
+  std::vector<cl_device_id> devices, cpus;
+  std::vector<int> cpuIndices;
   for (cl_uint i = 0; i < num_devices; i++) {
     cl_device_type type;
     checkError(clGetDeviceInfo(queriedDevices[i], CL_DEVICE_TYPE,
                                sizeof(cl_device_type), &type, NULL));
 
     if ((type & CL_DEVICE_TYPE_CPU) == CL_DEVICE_TYPE_CPU) {
-      std::cout << "Skipping CPU (device " << i << ")" << std::endl;
+      cpus.push_back(queriedDevices[i]);
+      cpuIndices.push_back(i);
       continue;
     }
 
     devices.push_back(queriedDevices[i]);
   }
 
+  if (devices.size() == 0 && cpus.size() > 0) {
+    // Better use the CPU than nothing, for example with pocl.
+    std::cout << "Using CPU because there is no other device" << std::endl;
+    devices = cpus;
+  } else {
+    for (int i : cpuIndices) {
+      std::cout << "Skipping CPU (device " << i << ")" << std::endl;
+    }
+  }
+
   if (devices.size() == 0) {
     std::cerr << "Could not find any suitable OpenCL device!" << std::endl;
     std::exit(1);
@@ -63,18 +161,72 @@ std::vector<cl_device_id> CGOpenCLBase::getAllDevices() {
   return devices;
 }
 
+bool CGOpenCLBase::hasHostUnifiedMemory(cl_device_id device) {
+  cl_bool unified;
+  checkError(clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                             sizeof(cl_bool), &unified, NULL));
+
+  return unified == CL_TRUE;
+}
+
 void CGOpenCLBase::Device::checkedEnqueueNDRangeKernel(cl_kernel kernel,
                                                        size_t global,
-                                                       size_t local) {
+                                                       size_t local,
+                                                       cl_event *event) {
   if (global == 0) {
     global = this->global;
   }
   if (local == 0) {
-    local = Local;
+    local = this->local;
   }
 
-  checkError(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local, 0,
-                                    NULL, NULL));
+  static const std::string NoName;
+  const std::string &name = profiling ? cg->getKernelName(kernel) : NoName;
+
+  enqueueOrdered(
+      [&](cl_uint num, const cl_event *wait, cl_event *event) {
+        return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local,
+                                      num, wait, event);
+      },
+      name, /* transfer= */ false, event);
+}
+
+void CGOpenCLBase::Device::collectProfile() {
+  std::vector<ProfiledCommand> pending;
+  for (ProfiledCommand &command : profiledCommands) {
+    cl_int status;
+    checkError(clGetEventInfo(command.event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(status), &status, NULL));
+    if (status != CL_COMPLETE) {
+      // Negative values indicate that the command failed.
+      checkError(status < 0 ? status : CL_SUCCESS);
+      pending.push_back(command);
+      continue;
+    }
+
+    cl_ulong queued, submit, start, end;
+    checkError(clGetEventProfilingInfo(command.event,
+                                       CL_PROFILING_COMMAND_QUEUED,
+                                       sizeof(cl_ulong), &queued, NULL));
+    checkError(clGetEventProfilingInfo(command.event,
+                                       CL_PROFILING_COMMAND_SUBMIT,
+                                       sizeof(cl_ulong), &submit, NULL));
+    checkError(clGetEventProfilingInfo(command.event,
+                                       CL_PROFILING_COMMAND_START,
+                                       sizeof(cl_ulong), &start, NULL));
+    checkError(clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END,
+                                       sizeof(cl_ulong), &end, NULL));
+    checkError(clReleaseEvent(command.event));
+
+    // The timestamps are in nanoseconds.
+    Profile &p = profile[command.name];
+    p.transfer = command.transfer;
+    p.count++;
+    p.queued += (submit - queued) * 1e-9;
+    p.launch += (start - submit) * 1e-9;
+    p.execution += (end - start) * 1e-9;
+  }
+  profiledCommands.swap(pending);
 }
 
 void CGOpenCLBase::Device::checkedEnqueueMatvecKernelCRS(
@@ -87,7 +239,7 @@ void CGOpenCLBase::Device::checkedEnqueueMatvecKernelCRS(
   checkedSetKernelArg(kernel, 4, sizeof(cl_mem), &y);
   checkedSetKernelArg(kernel, 5, sizeof(int), &yOffset);
   checkedSetKernelArg(kernel, 6, sizeof(int), &N);
-  checkedEnqueueNDRangeKernel(kernel, globalMatvec);
+  checkedEnqueueNDRangeKernel(kernel, globalMatvec, localMatvec);
 }
 
 void CGOpenCLBase::Device::checkedEnqueueMatvecKernelELL(
@@ -100,33 +252,372 @@ void CGOpenCLBase::Device::checkedEnqueueMatvecKernelELL(
   checkedSetKernelArg(kernel, 4, sizeof(cl_mem), &y);
   checkedSetKernelArg(kernel, 5, sizeof(int), &yOffset);
   checkedSetKernelArg(kernel, 6, sizeof(int), &N);
-  checkedEnqueueNDRangeKernel(kernel, globalMatvec);
+  checkedEnqueueNDRangeKernel(kernel, globalMatvec, localMatvec);
 }
 
-cl_kernel CGOpenCLBase::checkedCreateKernel(const char *kernelName) {
+cl_kernel CGOpenCLBase::checkedCreateKernel(cl_program program,
+                                            const char *kernelName) {
   cl_int err;
   cl_kernel kernel = clCreateKernel(program, kernelName, &err);
   checkError(err);
 
+  // A released kernel may have had the same handle.
+  std::lock_guard<std::mutex> lock(kernelNamesMutex);
+  kernelNames[kernel] = kernelName;
   return kernel;
 }
 
+const std::string &CGOpenCLBase::getKernelName(cl_kernel kernel) {
+  std::lock_guard<std::mutex> lock(kernelNamesMutex);
+  auto it = kernelNames.find(kernel);
+  if (it == kernelNames.end()) {
+    // Not created by checkedCreateKernel(), query the implementation once.
+    size_t size;
+    checkError(clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size));
+    std::unique_ptr<char[]> functionName(new char[size]);
+    checkError(clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size,
+                               functionName.get(), NULL));
+    it = kernelNames.emplace(kernel, functionName.get()).first;
+  }
+  return it->second;
+}
+
 cl_mem CGOpenCLBase::checkedCreateBufferWithFlags(cl_mem_flags flags,
-                                                  size_t size) {
+                                                  size_t size, void *hostPtr) {
   cl_int err;
-  cl_mem mem = clCreateBuffer(ctx, flags, size, NULL, &err);
+  cl_mem mem = clCreateBuffer(ctx, flags, size, hostPtr, &err);
   checkError(err);
 
   return mem;
 }
 
-void CGOpenCLBase::init(const char *matrixFile) {
-  // Compile program.
+cl_mem CGOpenCLBase::checkedCreateBufferAndCopy(Device &device,
+                                                cl_mem_flags flags, size_t size,
+                                                void *hostPtr) {
+  if (zeroCopy) {
+    return checkedCreateBufferWithFlags(flags | CL_MEM_USE_HOST_PTR, size,
+                                        hostPtr);
+  }
+
+  cl_mem buffer = checkedCreateBufferWithFlags(flags, size);
+  enqueueTransferTo(device, buffer, size, hostPtr);
+  return buffer;
+}
+
+// -----------------------------------------------------------------------------
+// Page-aligned allocations so that the OpenCL implementation can use the host
+// memory for buffers created with CL_MEM_USE_HOST_PTR.
+
+template <class T> static void allocateAligned(T *&ptr, size_t count) {
+  static const size_t PageSize = 4096;
+  ptr = Allocator::get().allocate<T>(count, PageSize);
+}
+
+void CGOpenCLBase::AlignedMatrixCRS::allocatePtr(int rows) {
+  allocateAligned(ptr, rows + 1);
+}
+void CGOpenCLBase::AlignedMatrixCRS::deallocatePtr() { Allocator::get().deallocate(ptr); }
+void CGOpenCLBase::AlignedMatrixCRS::allocateIndexAndValue(int values) {
+  allocateAligned(index, values);
+  allocateAligned(value, values);
+}
+void CGOpenCLBase::AlignedMatrixCRS::deallocateIndexAndValue() {
+  Allocator::get().deallocate(index);
+  Allocator::get().deallocate(value);
+}
+
+void CGOpenCLBase::AlignedMatrixELL::allocateLength(int rows) {
+  allocateAligned(length, rows);
+}
+void CGOpenCLBase::AlignedMatrixELL::deallocateLength() { Allocator::get().deallocate(length); }
+void CGOpenCLBase::AlignedMatrixELL::allocateIndexAndData() {
+  allocateAligned(index, elements);
+  allocateAligned(data, elements);
+}
+void CGOpenCLBase::AlignedMatrixELL::deallocateIndexAndData() {
+  Allocator::get().deallocate(index);
+  Allocator::get().deallocate(data);
+}
+
+void CGOpenCLBase::AlignedJacobi::allocateC(int N) { allocateAligned(C, N); }
+void CGOpenCLBase::AlignedJacobi::deallocateC() { Allocator::get().deallocate(C); }
+
+void CGOpenCLBase::allocateMatrixCRS() {
+  if (!zeroCopy) {
+    CG::allocateMatrixCRS();
+    return;
+  }
+  matrixCRS.reset(new AlignedMatrixCRS);
+}
+void CGOpenCLBase::allocateMatrixELL() {
+  if (!zeroCopy) {
+    CG::allocateMatrixELL();
+    return;
+  }
+  matrixELL.reset(new AlignedMatrixELL);
+}
+void CGOpenCLBase::allocateJacobi() {
+  if (!zeroCopy) {
+    CG::allocateJacobi();
+    return;
+  }
+  jacobi.reset(new AlignedJacobi);
+}
+void CGOpenCLBase::allocateK() {
+  if (!zeroCopy) {
+    CG::allocateK();
+    return;
+  }
+  allocateAligned(k, N);
+}
+void CGOpenCLBase::deallocateK() {
+  if (!zeroCopy) {
+    CG::deallocateK();
+    return;
+  }
+  Allocator::get().deallocate(k);
+}
+void CGOpenCLBase::allocateX() {
+  if (!zeroCopy) {
+    CG::allocateX();
+    return;
+  }
+  allocateAligned(x, N);
+}
+void CGOpenCLBase::deallocateX() {
+  if (!zeroCopy) {
+    CG::deallocateX();
+    return;
+  }
+  Allocator::get().deallocate(x);
+}
+
+// -----------------------------------------------------------------------------
+
+int CGOpenCLBase::getMaxNzCRS(int rows, const MatrixDataCRS &data) {
+  int maxNz = 0;
+  for (int i = 0; i < rows; i++) {
+    maxNz = std::max(maxNz, data.ptr[i + 1] - data.ptr[i]);
+  }
+
+  return maxNz;
+}
+
+int CGOpenCLBase::getMaxNzELL() {
+  if (rebalanceIterations > 0) {
+    // Rebalancing splits the matrix again without building the program, so
+    // the bound must hold for every split: No part of a row can be longer.
+    assert(matrixCOO);
+    return matrixCOO->getMaxNz();
+  }
+
+  int maxNz = 0;
+  auto updateMaxNz = [&maxNz](const MatrixDataELL &data) {
+    if (data.maxNz > maxNz) {
+      maxNz = data.maxNz;
+    }
+  };
+  auto updateMaxNzCRS = [&maxNz](int rows, const MatrixDataCRS &data) {
+    maxNz = std::max(maxNz, getMaxNzCRS(rows, data));
+  };
+
+  if (deviceConversion) {
+    // The matrix is only converted on the device.
+    if (matrixCRS) {
+      updateMaxNzCRS(N, *matrixCRS);
+    }
+    if (splitMatrixCRS) {
+      for (int c = 0; c < splitMatrixCRS->numberOfChunks; c++) {
+        updateMaxNzCRS(workDistribution->lengths[c], splitMatrixCRS->data[c]);
+      }
+    }
+    if (partitionedMatrixCRS) {
+      for (int c = 0; c < partitionedMatrixCRS->numberOfChunks; c++) {
+        int length = workDistribution->lengths[c];
+        updateMaxNzCRS(length, partitionedMatrixCRS->diag[c]);
+        updateMaxNzCRS(length, partitionedMatrixCRS->minor[c]);
+      }
+    }
+    return maxNz;
+  }
+
+  if (matrixELL) {
+    updateMaxNz(*matrixELL);
+  }
+  if (splitMatrixELL) {
+    for (int c = 0; c < splitMatrixELL->numberOfChunks; c++) {
+      updateMaxNz(splitMatrixELL->data[c]);
+    }
+  }
+  if (partitionedMatrixELL) {
+    for (int c = 0; c < partitionedMatrixELL->numberOfChunks; c++) {
+      updateMaxNz(partitionedMatrixELL->diag[c]);
+      updateMaxNz(partitionedMatrixELL->minor[c]);
+    }
+  }
+
+  return maxNz;
+}
+
+std::string CGOpenCLBase::getBuildOptions() {
+  std::ostringstream options;
+
+#ifdef CG_USE_FLOAT
+  options << " -DCG_USE_FLOAT";
+#endif
+  if (matrixFormat == MatrixFormatELL) {
+    int maxNz = getMaxNzELL();
+    // A single dense row must not unroll the loop of every row.
+    if (maxNz <= MaxUnrollELL) {
+      options << " -DCG_ELL_MAX_NZ=" << maxNz;
+    }
+  }
+  if (!workDistribution) {
+    // All kernels work on the full vectors.
+    options << " -DCG_CHUNK_LENGTH=" << N;
+  }
+  options << " -DCG_UNROLL=" << UnrollCRS;
+  if (preconditioner == PreconditionerJacobi) {
+    options << " -DCG_PRECONDITIONER_JACOBI";
+  }
+
+  return options.str();
+}
+
+static std::string getDeviceInfoString(cl_device_id device,
+                                       cl_device_info param) {
+  size_t size;
+  checkError(clGetDeviceInfo(device, param, 0, NULL, &size));
+
+  std::unique_ptr<char[]> value(new char[size]);
+  checkError(clGetDeviceInfo(device, param, size, value.get(), NULL));
+
+  return std::string(value.get());
+}
+
+std::string CGOpenCLBase::getBinaryCacheKey(cl_device_id device,
+                                            const std::string &options) {
+  std::ostringstream key;
+  key << getDeviceInfoString(device, CL_DEVICE_VENDOR) << ";";
+  key << getDeviceInfoString(device, CL_DEVICE_NAME) << ";";
+  key << getDeviceInfoString(device, CL_DEVICE_VERSION) << ";";
+  key << getDeviceInfoString(device, CL_DRIVER_VERSION) << ";";
+  key << options << ";";
+  // The source may change without changing any of the above...
+  key << std::hash<std::string>()(source);
+
+  return key.str();
+}
+
+std::string CGOpenCLBase::getBinaryCacheFile(const std::string &key,
+                                             const char *extension) {
+  std::ostringstream file;
+  file << binaryCache << "/cgxx-" << std::hex << std::hash<std::string>()(key)
+       << extension;
+
+  return file.str();
+}
+
+bool CGOpenCLBase::loadProgramBinaries(const std::vector<cl_device_id> &devices,
+                                       const std::string &options) {
+  std::vector<std::string> binaries;
+  for (cl_device_id device : devices) {
+    std::string key = getBinaryCacheKey(device, options);
+    std::ifstream is(getBinaryCacheFile(key), std::ios::binary);
+    if (!is.is_open()) {
+      return false;
+    }
+
+    // The first line contains the full key to detect hash collisions.
+    std::string storedKey;
+    getline(is, storedKey);
+    if (storedKey != key) {
+      return false;
+    }
+
+    std::ostringstream binary;
+    binary << is.rdbuf();
+    binaries.push_back(binary.str());
+  }
+
+  std::vector<size_t> lengths;
+  std::vector<const unsigned char *> pointers;
+  for (const std::string &binary : binaries) {
+    lengths.push_back(binary.size());
+    pointers.push_back((const unsigned char *)binary.data());
+  }
+
   cl_int err;
-  program = clCreateProgramWithSource(ctx, 1, &source, NULL, &err);
-  checkError(err);
+  program = clCreateProgramWithBinary(ctx, devices.size(), devices.data(),
+                                      lengths.data(), pointers.data(), NULL,
+                                      &err);
+  if (err != CL_SUCCESS) {
+    return false;
+  }
 
-  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+  // The program still needs to be built, but that is (supposed to be) cheap.
+  err = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
+  if (err != CL_SUCCESS) {
+    clReleaseProgram(program);
+    program = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void CGOpenCLBase::storeProgramBinaries(
+    const std::vector<cl_device_id> &devices, const std::string &options) {
+  // The binaries are returned in the order of CL_PROGRAM_DEVICES.
+  std::unique_ptr<cl_device_id[]> programDevices(
+      new cl_device_id[devices.size()]);
+  checkError(clGetProgramInfo(program, CL_PROGRAM_DEVICES,
+                              sizeof(cl_device_id) * devices.size(),
+                              programDevices.get(), NULL));
+
+  std::unique_ptr<size_t[]> sizes(new size_t[devices.size()]);
+  checkError(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+                              sizeof(size_t) * devices.size(), sizes.get(),
+                              NULL));
+
+  std::vector<std::unique_ptr<unsigned char[]>> binaries;
+  std::unique_ptr<unsigned char *[]> pointers(
+      new unsigned char *[devices.size()]);
+  for (size_t i = 0; i < devices.size(); i++) {
+    binaries.emplace_back(new unsigned char[sizes[i]]);
+    pointers[i] = binaries[i].get();
+  }
+  checkError(clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+                              sizeof(unsigned char *) * devices.size(),
+                              pointers.get(), NULL));
+
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (sizes[i] == 0) {
+      // Some implementations don't support binaries.
+      continue;
+    }
+
+    std::string key = getBinaryCacheKey(programDevices[i], options);
+    std::string file = getBinaryCacheFile(key);
+    // Write to a temporary file first so that concurrent runs never read a
+    // partially written binary.
+    std::string tmpFile = file + ".tmp";
+    {
+      std::ofstream os(tmpFile, std::ios::binary);
+      if (!os.is_open()) {
+        std::cerr << "Could not write program binary to " << tmpFile << "!"
+                  << std::endl;
+        return;
+      }
+      os << key << "\n";
+      os.write((const char *)binaries[i].get(), sizes[i]);
+    }
+    std::rename(tmpFile.c_str(), file.c_str());
+  }
+}
+
+void CGOpenCLBase::checkedBuildProgram(const std::string &options) {
+  cl_int err = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
   if (err != CL_SUCCESS) {
     std::cerr << "Error " << err << " for clBuildProgram!" << std::endl;
 
@@ -149,18 +640,74 @@ void CGOpenCLBase::init(const char *matrixFile) {
     }
     std::exit(1);
   }
+}
+
+void CGOpenCLBase::buildProgram() {
+  std::string options = getBuildOptions();
+
+  cl_uint numDevices;
+  checkError(clGetContextInfo(ctx, CL_CONTEXT_NUM_DEVICES, sizeof(cl_uint),
+                              &numDevices, NULL));
+  std::vector<cl_device_id> devices(numDevices);
+  checkError(clGetContextInfo(ctx, CL_CONTEXT_DEVICES,
+                              sizeof(cl_device_id) * numDevices, devices.data(),
+                              NULL));
+
+  if (!binaryCache.empty()) {
+    if (loadProgramBinaries(devices, options)) {
+      std::cout << "Loaded program from binary cache..." << std::endl;
+      return;
+    }
+  }
+
+  std::cout << "Building program..." << std::endl;
+  cl_int err;
+  program = clCreateProgramWithSource(ctx, 1, &source, NULL, &err);
+  checkError(err);
+  checkedBuildProgram(options);
+
+  if (!binaryCache.empty()) {
+    storeProgramBinaries(devices, options);
+  }
+}
+
+void CGOpenCLBase::init(const char *matrixFile) {
+  // Read the matrix first: The program is specialized for its properties.
+  CG::init(matrixFile);
+
+  buildProgram();
 
   matvecKernelCRS = checkedCreateKernel("matvecKernelCRS");
   matvecKernelELL = checkedCreateKernel("matvecKernelELL");
+  if (overlappedGather) {
+    matvecKernelCRSRoundup = checkedCreateKernel("matvecKernelCRSRoundup");
+    matvecKernelELLRoundup = checkedCreateKernel("matvecKernelELLRoundup");
+  }
+  if (matrixFormat == MatrixFormatCRS && crsKernel != CRSKernelScalar) {
+    matvecKernelCRSRows = checkedCreateKernel("matvecKernelCRSRows");
+    matvecKernelCRSVector = checkedCreateKernel("matvecKernelCRSVector");
+    if (overlappedGather) {
+      matvecKernelCRSRowsRoundup =
+          checkedCreateKernel("matvecKernelCRSRowsRoundup");
+      matvecKernelCRSVectorRoundup =
+          checkedCreateKernel("matvecKernelCRSVectorRoundup");
+    }
+  }
   axpyKernelCL = checkedCreateKernel("axpyKernel");
   xpayKernelCL = checkedCreateKernel("xpayKernel");
   vectorDotKernelCL = checkedCreateKernel("vectorDotKernel");
   deviceReduceKernel = checkedCreateKernel("deviceReduceKernel");
-  applyPreconditionerKernelJacobi =
-      checkedCreateKernel("applyPreconditionerKernelJacobi");
-
-  // Now that we have a working device, read the matrix.
-  CG::init(matrixFile);
+  if (preconditioner == PreconditionerJacobi) {
+    applyPreconditionerKernelJacobi =
+        checkedCreateKernel("applyPreconditionerKernelJacobi");
+  }
+  if (fusedSolve) {
+    reducePartialKernel = checkedCreateKernel("reducePartialKernel");
+    computeAlphaKernel = checkedCreateKernel("computeAlphaKernel");
+    computeBetaKernel = checkedCreateKernel("computeBetaKernel");
+    fusedUpdateKernelCL = checkedCreateKernel("fusedUpdateKernel");
+    fusedXpayKernelCL = checkedCreateKernel("fusedXpayKernel");
+  }
 }
 
 void CGOpenCLBase::allocateAndCopyMatrixDataCRS(
@@ -171,13 +718,110 @@ void CGOpenCLBase::allocateAndCopyMatrixDataCRS(
   size_t indexSize = sizeof(int) * deviceNz;
   size_t valueSize = sizeof(floatType) * deviceNz;
 
-  deviceMatrix.ptr = checkedCreateBuffer(ptrSize);
-  deviceMatrix.index = checkedCreateBuffer(indexSize);
-  deviceMatrix.value = checkedCreateBuffer(valueSize);
+  deviceMatrix.ptr = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                ptrSize, data.ptr);
+  deviceMatrix.index = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                  indexSize, data.index);
+  deviceMatrix.value = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                  valueSize, data.value);
 
-  device.checkedEnqueueWriteBuffer(deviceMatrix.ptr, ptrSize, data.ptr);
-  device.checkedEnqueueWriteBuffer(deviceMatrix.index, indexSize, data.index);
-  device.checkedEnqueueWriteBuffer(deviceMatrix.value, valueSize, data.value);
+  binRowsCRS(length, data, deviceMatrix);
+}
+
+void CGOpenCLBase::binRowsCRS(int length, const MatrixDataCRS &data,
+                              Device::MatrixCRSDevice &deviceMatrix) {
+  switch (crsKernel) {
+  case CRSKernelScalar:
+    deviceMatrix.binned = false;
+    break;
+  case CRSKernelVector:
+  case CRSKernelBinned:
+    deviceMatrix.binned = true;
+    break;
+  case CRSKernelAuto: {
+    int maxNz = 0;
+    for (int i = 0; i < length; i++) {
+      maxNz = std::max(maxNz, data.ptr[i + 1] - data.ptr[i]);
+    }
+    deviceMatrix.binned = (maxNz >= MinNzVectorCRS);
+    break;
+  }
+  }
+  if (!deviceMatrix.binned) {
+    return;
+  }
+
+  std::vector<int> shortRows, longRows;
+  for (int i = 0; i < length; i++) {
+    int rowLength = data.ptr[i + 1] - data.ptr[i];
+    if (crsKernel == CRSKernelVector || rowLength >= MinNzVectorCRS) {
+      longRows.push_back(i);
+    } else {
+      shortRows.push_back(i);
+    }
+  }
+
+  // Copy the lists on creation because they are only temporary on the host.
+  cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+  deviceMatrix.numShortRows = shortRows.size();
+  if (deviceMatrix.numShortRows > 0) {
+    deviceMatrix.shortRows = checkedCreateBufferWithFlags(
+        flags, sizeof(int) * shortRows.size(), shortRows.data());
+  }
+  deviceMatrix.numLongRows = longRows.size();
+  if (deviceMatrix.numLongRows > 0) {
+    deviceMatrix.longRows = checkedCreateBufferWithFlags(
+        flags, sizeof(int) * longRows.size(), longRows.data());
+  }
+}
+
+void CGOpenCLBase::enqueueMatvecCRS(Device &device,
+                                    Device::MatrixCRSDevice &deviceMatrix,
+                                    cl_mem x, cl_mem y, int yOffset, int N,
+                                    bool roundup) {
+  if (!deviceMatrix.binned) {
+    device.checkedEnqueueMatvecKernelCRS(
+        roundup ? matvecKernelCRSRoundup : matvecKernelCRS, deviceMatrix, x, y,
+        yOffset, N);
+    return;
+  }
+
+  auto setArgs = [&](cl_kernel kernel, cl_mem &rows, int &numRows) {
+    checkedSetKernelArg(kernel, 0, sizeof(cl_mem), &deviceMatrix.ptr);
+    checkedSetKernelArg(kernel, 1, sizeof(cl_mem), &deviceMatrix.index);
+    checkedSetKernelArg(kernel, 2, sizeof(cl_mem), &deviceMatrix.value);
+    checkedSetKernelArg(kernel, 3, sizeof(cl_mem), &x);
+    checkedSetKernelArg(kernel, 4, sizeof(cl_mem), &y);
+    checkedSetKernelArg(kernel, 5, sizeof(int), &yOffset);
+    checkedSetKernelArg(kernel, 6, sizeof(cl_mem), &rows);
+    checkedSetKernelArg(kernel, 7, sizeof(int), &numRows);
+  };
+
+  if (deviceMatrix.numShortRows > 0) {
+    cl_kernel kernel =
+        roundup ? matvecKernelCRSRowsRoundup : matvecKernelCRSRows;
+    setArgs(kernel, deviceMatrix.shortRows, deviceMatrix.numShortRows);
+
+    size_t groups = calculateGroups(deviceMatrix.numShortRows,
+                                    device.localMatvec, device.maxGroupsMatvec);
+    device.checkedEnqueueNDRangeKernel(kernel, groups * device.localMatvec,
+                                       device.localMatvec);
+  }
+  if (deviceMatrix.numLongRows > 0) {
+    cl_kernel kernel =
+        roundup ? matvecKernelCRSVectorRoundup : matvecKernelCRSVector;
+    setArgs(kernel, deviceMatrix.longRows, deviceMatrix.numLongRows);
+    checkedSetKernelArg(kernel, 8, device.localMatvec * sizeof(floatType),
+                        NULL);
+
+    // One group per row.
+    size_t groups = deviceMatrix.numLongRows;
+    if (groups > device.maxGroupsMatvec) {
+      groups = device.maxGroupsMatvec;
+    }
+    device.checkedEnqueueNDRangeKernel(kernel, groups * device.localMatvec,
+                                       device.localMatvec);
+  }
 }
 
 void CGOpenCLBase::allocateAndCopyMatrixDataELL(
@@ -188,40 +832,737 @@ void CGOpenCLBase::allocateAndCopyMatrixDataELL(
   size_t indexSize = sizeof(int) * elements;
   size_t dataSize = sizeof(floatType) * elements;
 
-  deviceMatrix.length = checkedCreateBuffer(lengthSize);
-  deviceMatrix.index = checkedCreateBuffer(indexSize);
-  deviceMatrix.data = checkedCreateBuffer(dataSize);
+  deviceMatrix.length = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                   lengthSize, data.length);
+  deviceMatrix.index = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                  indexSize, data.index);
+  deviceMatrix.data = checkedCreateBufferAndCopy(device, CL_MEM_READ_WRITE,
+                                                 dataSize, data.data);
+}
 
-  device.checkedEnqueueWriteBuffer(deviceMatrix.length, lengthSize,
-                                   data.length);
-  device.checkedEnqueueWriteBuffer(deviceMatrix.index, indexSize, data.index);
-  device.checkedEnqueueWriteBuffer(deviceMatrix.data, dataSize, data.data);
+void CGOpenCLBase::copyIntoBuffer(Device &device, cl_mem buffer, size_t size,
+                                  void *hostPtr) {
+  if (zeroCopy) {
+    // The buffer uses hostPtr, so only tell the implementation that the host
+    // has written to it without reading back the old content.
+    cl_int err;
+    void *mapped = clEnqueueMapBuffer(device.queue, buffer, CL_TRUE,
+                                      CL_MAP_WRITE_INVALIDATE_REGION, 0, size,
+                                      0, NULL, NULL, &err);
+    checkError(err);
+    checkError(
+        clEnqueueUnmapMemObject(device.queue, buffer, mapped, 0, NULL, NULL));
+    return;
+  }
+
+  enqueueTransferTo(device, buffer, size, hostPtr);
+}
+
+void CGOpenCLBase::copyMatrixValuesCRS(int length, const MatrixDataCRS &data,
+                                       Device &device,
+                                       Device::MatrixCRSDevice &deviceMatrix) {
+  copyIntoBuffer(device, deviceMatrix.value,
+                 sizeof(floatType) * data.ptr[length], data.value);
+}
+
+void CGOpenCLBase::copyMatrixValuesELL(const MatrixDataELL &data,
+                                       Device &device,
+                                       Device::MatrixELLDevice &deviceMatrix) {
+  copyIntoBuffer(device, deviceMatrix.data, sizeof(floatType) * data.elements,
+                 data.data);
+}
+
+void CGOpenCLBase::allocateAndConvertMatrixDataELL(
+    int length, const MatrixDataCRS &data, Device &device,
+    Device::MatrixELLDevice &deviceMatrix) {
+  int maxNz = getMaxNzCRS(length, data);
+  int elements = maxNz * length;
+
+  // Transfer the compact MatrixDataCRS, which is released after the conversion.
+  Device::MatrixCRSDevice crs;
+  int deviceNz = data.ptr[length];
+  crs.ptr = checkedCreateBufferAndCopy(device, CL_MEM_READ_ONLY,
+                                       sizeof(int) * (length + 1), data.ptr);
+  crs.index = checkedCreateBufferAndCopy(device, CL_MEM_READ_ONLY,
+                                         sizeof(int) * deviceNz, data.index);
+  crs.value = checkedCreateBufferAndCopy(
+      device, CL_MEM_READ_ONLY, sizeof(floatType) * deviceNz, data.value);
+
+  deviceMatrix.length = checkedCreateBuffer(sizeof(int) * length);
+  deviceMatrix.index = checkedCreateBuffer(sizeof(int) * elements);
+  deviceMatrix.data = checkedCreateBuffer(sizeof(floatType) * elements);
+
+  // The devices may be initialized in parallel, so use a separate kernel
+  // object to not share its arguments.
+  cl_kernel kernel = checkedCreateKernel("convertCRSToELLKernel");
+  checkedSetKernelArg(kernel, 0, sizeof(cl_mem), &crs.ptr);
+  checkedSetKernelArg(kernel, 1, sizeof(cl_mem), &crs.index);
+  checkedSetKernelArg(kernel, 2, sizeof(cl_mem), &crs.value);
+  checkedSetKernelArg(kernel, 3, sizeof(cl_mem), &deviceMatrix.length);
+  checkedSetKernelArg(kernel, 4, sizeof(cl_mem), &deviceMatrix.index);
+  checkedSetKernelArg(kernel, 5, sizeof(cl_mem), &deviceMatrix.data);
+  checkedSetKernelArg(kernel, 6, sizeof(int), &maxNz);
+  checkedSetKernelArg(kernel, 7, sizeof(int), &length);
+  device.checkedEnqueueNDRangeKernel(kernel, device.globalMatvec,
+                                     device.localMatvec);
+
+  // OpenCL keeps the objects alive until the enqueued kernel has finished.
+  checkError(clReleaseKernel(kernel));
+  freeMatrixCRSDevice(crs);
 }
 
 void CGOpenCLBase::freeMatrixCRSDevice(
-    const Device::MatrixCRSDevice &deviceMatrix) {
+    Device::MatrixCRSDevice &deviceMatrix) {
   checkedReleaseMemObject(deviceMatrix.ptr);
   checkedReleaseMemObject(deviceMatrix.index);
   checkedReleaseMemObject(deviceMatrix.value);
+  if (deviceMatrix.shortRows != NULL) {
+    checkedReleaseMemObject(deviceMatrix.shortRows);
+  }
+  if (deviceMatrix.longRows != NULL) {
+    checkedReleaseMemObject(deviceMatrix.longRows);
+  }
+  // binRowsCRS() only sets the bins that are not empty.
+  deviceMatrix = Device::MatrixCRSDevice();
 }
 
 void CGOpenCLBase::freeMatrixELLDevice(
-    const Device::MatrixELLDevice &deviceMatrix) {
+    Device::MatrixELLDevice &deviceMatrix) {
   checkedReleaseMemObject(deviceMatrix.length);
   checkedReleaseMemObject(deviceMatrix.index);
   checkedReleaseMemObject(deviceMatrix.data);
+  deviceMatrix = Device::MatrixELLDevice();
+}
+
+void CGOpenCLBase::allocateTmp(Device &device) {
+  size_t tmpSize = sizeof(floatType) * Device::MaxGroupsLimit;
+  if (fusedSolve) {
+    // fusedUpdateKernel may store two partial results per group.
+    tmpSize *= 2;
+  }
+  device.tmp = checkedCreateBuffer(tmpSize);
+}
+
+void CGOpenCLBase::allocateFused(Device &device, int chunks) {
+  device.scalars =
+      checkedCreateBuffer(sizeof(floatType) * NumberOfFusedScalars);
+  device.partials =
+      checkedCreateBuffer(sizeof(floatType) * NumberOfFusedPartials * chunks);
+}
+
+void CGOpenCLBase::freeFused(Device &device) {
+  checkedReleaseMemObject(device.scalars);
+  checkedReleaseMemObject(device.partials);
+}
+
+void CGOpenCLBase::enqueueReducePartial(Device &device, int tmpOffset,
+                                        int chunk, FusedPartial partial,
+                                        cl_event *event) {
+  size_t localForReduce = device.maxGroups * sizeof(floatType);
+  int partialIndex = chunk * NumberOfFusedPartials + partial;
+
+  checkedSetKernelArg(reducePartialKernel, 0, sizeof(cl_mem), &device.tmp);
+  checkedSetKernelArg(reducePartialKernel, 1, sizeof(int), &tmpOffset);
+  checkedSetKernelArg(reducePartialKernel, 2, sizeof(cl_mem), &device.partials);
+  checkedSetKernelArg(reducePartialKernel, 3, sizeof(int), &partialIndex);
+  checkedSetKernelArg(reducePartialKernel, 4, localForReduce, NULL);
+  checkedSetKernelArg(reducePartialKernel, 5, sizeof(int), &device.groups);
+  device.checkedEnqueueNDRangeKernel(reducePartialKernel, device.maxGroups,
+                                     device.maxGroups, event);
+}
+
+void CGOpenCLBase::enqueueFusedDot(Device &device, cl_mem p, int pOffset,
+                                   cl_mem q, int length, int chunk,
+                                   cl_event *event) {
+  static const int ZERO = 0;
+  size_t localForVectorDot = device.local * sizeof(floatType);
+
+  checkedSetKernelArg(vectorDotKernelCL, 0, sizeof(cl_mem), &p);
+  checkedSetKernelArg(vectorDotKernelCL, 1, sizeof(int), &pOffset);
+  checkedSetKernelArg(vectorDotKernelCL, 2, sizeof(cl_mem), &q);
+  checkedSetKernelArg(vectorDotKernelCL, 3, sizeof(int), &ZERO);
+  checkedSetKernelArg(vectorDotKernelCL, 4, sizeof(cl_mem), &device.tmp);
+  checkedSetKernelArg(vectorDotKernelCL, 5, localForVectorDot, NULL);
+  checkedSetKernelArg(vectorDotKernelCL, 6, sizeof(int), &length);
+  device.checkedEnqueueNDRangeKernel(vectorDotKernelCL);
+
+  enqueueReducePartial(device, 0, chunk, FusedPartialPQ, event);
+}
+
+void CGOpenCLBase::enqueueFusedUpdate(Device &device, int xOffset, int pOffset,
+                                      int length, int chunk, cl_event *event) {
+  size_t localForUpdate = device.local * sizeof(floatType);
+
+  checkedSetKernelArg(fusedUpdateKernelCL, 0, sizeof(cl_mem), &device.scalars);
+  checkedSetKernelArg(fusedUpdateKernelCL, 1, sizeof(cl_mem), &device.x);
+  checkedSetKernelArg(fusedUpdateKernelCL, 2, sizeof(int), &xOffset);
+  checkedSetKernelArg(fusedUpdateKernelCL, 3, sizeof(cl_mem), &device.p);
+  checkedSetKernelArg(fusedUpdateKernelCL, 4, sizeof(int), &pOffset);
+  checkedSetKernelArg(fusedUpdateKernelCL, 5, sizeof(cl_mem), &device.q);
+  checkedSetKernelArg(fusedUpdateKernelCL, 6, sizeof(cl_mem), &device.r);
+  checkedSetKernelArg(fusedUpdateKernelCL, 7, sizeof(cl_mem), &device.jacobi.C);
+  checkedSetKernelArg(fusedUpdateKernelCL, 8, sizeof(cl_mem), &device.z);
+  checkedSetKernelArg(fusedUpdateKernelCL, 9, sizeof(cl_mem), &device.tmp);
+  checkedSetKernelArg(fusedUpdateKernelCL, 10, localForUpdate, NULL);
+  checkedSetKernelArg(fusedUpdateKernelCL, 11, sizeof(int), &length);
+  device.checkedEnqueueNDRangeKernel(fusedUpdateKernelCL);
+
+  if (preconditioner == PreconditionerNone) {
+    enqueueReducePartial(device, 0, chunk, FusedPartialRR, event);
+  } else {
+    // The kernel stores the partial results of r * z after those of r * r.
+    enqueueReducePartial(device, 0, chunk, FusedPartialRR, NULL);
+    enqueueReducePartial(device, device.groups, chunk, FusedPartialRZ, event);
+  }
+}
+
+void CGOpenCLBase::enqueueFusedScalarKernel(Device &device, cl_kernel kernel,
+                                            int chunks) {
+  checkedSetKernelArg(kernel, 0, sizeof(cl_mem), &device.scalars);
+  checkedSetKernelArg(kernel, 1, sizeof(cl_mem), &device.partials);
+  checkedSetKernelArg(kernel, 2, sizeof(int), &chunks);
+  device.checkedEnqueueNDRangeKernel(kernel, 1, 1);
+}
+
+void CGOpenCLBase::enqueueFusedXpay(Device &device, cl_mem x, int xOffset,
+                                   cl_mem y, int yOffset, int length) {
+  checkedSetKernelArg(fusedXpayKernelCL, 0, sizeof(cl_mem), &device.scalars);
+  checkedSetKernelArg(fusedXpayKernelCL, 1, sizeof(cl_mem), &x);
+  checkedSetKernelArg(fusedXpayKernelCL, 2, sizeof(int), &xOffset);
+  checkedSetKernelArg(fusedXpayKernelCL, 3, sizeof(cl_mem), &y);
+  checkedSetKernelArg(fusedXpayKernelCL, 4, sizeof(int), &yOffset);
+  checkedSetKernelArg(fusedXpayKernelCL, 5, sizeof(int), &length);
+  device.checkedEnqueueNDRangeKernel(fusedXpayKernelCL);
+}
+
+void CGOpenCLBase::printSummary() {
+  CG::printSummary();
+
+  std::cout << std::endl;
+  if (zeroCopy) {
+    std::cout << "Zero-copy buffers in host memory!" << std::endl;
+  }
+  if (deviceConversion) {
+    std::cout << "Matrix converted to ELL format on the device!" << std::endl;
+  }
+  if (matrixFormat == MatrixFormatCRS) {
+    std::string crsKernelName;
+    switch (crsKernel) {
+    case CRSKernelScalar:
+      crsKernelName = "work-item per row";
+      break;
+    case CRSKernelVector:
+      crsKernelName = "work-group per row";
+      break;
+    case CRSKernelBinned:
+      crsKernelName = "binned by row length";
+      break;
+    case CRSKernelAuto:
+      crsKernelName = "auto";
+      break;
+    }
+    assert(crsKernelName.length() > 0);
+    printPadded("CRS kernel:", crsKernelName);
+  }
+}
+
+size_t CGOpenCLBase::getMaxLocal(Device &device,
+                                 std::initializer_list<cl_kernel> kernels) {
+  size_t maxLocal;
+  checkError(clGetDeviceInfo(device.device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                             sizeof(maxLocal), &maxLocal, NULL));
+  for (cl_kernel kernel : kernels) {
+    if (kernel == NULL) {
+      continue;
+    }
+
+    size_t kernelLocal;
+    checkError(clGetKernelWorkGroupInfo(kernel, device.device_id,
+                                        CL_KERNEL_WORK_GROUP_SIZE,
+                                        sizeof(kernelLocal), &kernelLocal,
+                                        NULL));
+    maxLocal = std::min(maxLocal, kernelLocal);
+  }
+
+  return maxLocal;
+}
+
+double CGOpenCLBase::timeLaunches(Device &device,
+                                  const std::function<void()> &enqueue) {
+  // Warm up so that lazy initialization is not measured.
+  enqueue();
+  device.checkedFinish();
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < TuningRepetitions; i++) {
+    enqueue();
+  }
+  device.checkedFinish();
+  std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start;
+
+  return duration.count();
+}
+
+bool CGOpenCLBase::loadLaunchConfiguration(Device &device,
+                                           const std::string &key) {
+  std::ifstream is(getBinaryCacheFile(key, ".launch"));
+  if (!is.is_open()) {
+    return false;
+  }
+
+  // The first line contains the full key to detect hash collisions.
+  std::string storedKey;
+  getline(is, storedKey);
+  if (storedKey != key) {
+    return false;
+  }
+
+  size_t local, maxGroups, localMatvec, maxGroupsMatvec;
+  if (!(is >> local >> maxGroups >> localMatvec >> maxGroupsMatvec)) {
+    return false;
+  }
+  if (maxGroups > Device::MaxGroupsLimit ||
+      maxGroupsMatvec > Device::MaxGroupsMatvecLimit) {
+    return false;
+  }
+
+  device.local = local;
+  device.maxGroups = maxGroups;
+  device.localMatvec = localMatvec;
+  device.maxGroupsMatvec = maxGroupsMatvec;
+  return true;
+}
+
+void CGOpenCLBase::storeLaunchConfiguration(Device &device,
+                                            const std::string &key) {
+  std::ofstream os(getBinaryCacheFile(key, ".launch"));
+  if (!os.is_open()) {
+    // Ignore failures, the configuration is only cached for later runs.
+    return;
+  }
+
+  os << key << std::endl;
+  os << device.local << " " << device.maxGroups << " " << device.localMatvec
+     << " " << device.maxGroupsMatvec << std::endl;
+}
+
+bool CGOpenCLBase::loadCalibration(WorkDistribution::Cost &cost,
+                                   const std::string &key) {
+  std::ifstream is(getBinaryCacheFile(key, ".calibration"));
+  if (!is.is_open()) {
+    return false;
+  }
+
+  // The first line contains the full key to detect hash collisions.
+  std::string storedKey;
+  getline(is, storedKey);
+  if (storedKey != key) {
+    return false;
+  }
+
+  WorkDistribution::Cost stored;
+  if (!(is >> stored.row >> stored.nz >> stored.halo)) {
+    return false;
+  }
+  cost = stored;
+  return true;
+}
+
+void CGOpenCLBase::storeCalibration(const WorkDistribution::Cost &cost,
+                                    const std::string &key) {
+  std::ofstream os(getBinaryCacheFile(key, ".calibration"));
+  if (!os.is_open()) {
+    // Ignore failures, the calibration is only cached for later runs.
+    return;
+  }
+
+  os << key << std::endl;
+  os << std::setprecision(std::numeric_limits<double>::max_digits10)
+     << cost.row << " " << cost.nz << " " << cost.halo << std::endl;
+}
+
+void CGOpenCLBase::fitCalibration(const MatrixDataCRS &sample, int halfRows,
+                                  int sampleRows, const CalibrationTimes &half,
+                                  const CalibrationTimes &full,
+                                  WorkDistribution::Cost &cost) {
+  // Fit the slopes between both samples so that the latency of the launches
+  // is not attributed to the rows. Fall back to the full sample if the
+  // difference is lost in noise.
+  auto slope = [](double timeHalf, double timeFull, double sizeHalf,
+                  double sizeFull) {
+    if (sizeFull > sizeHalf && timeFull > timeHalf) {
+      return (timeFull - timeHalf) / (sizeFull - sizeHalf) / TuningRepetitions;
+    }
+    return std::max(timeFull, 0.0) / std::max(sizeFull, 1.0) /
+           TuningRepetitions;
+  };
+  double vectorPerRow =
+      slope(half.vector, full.vector, halfRows, sampleRows);
+  // matvec also streams the result like a vector operation.
+  double matvecRows = vectorPerRow * TuningRepetitions;
+  cost.row = CalibrationVectorOperations * vectorPerRow;
+  cost.nz = slope(half.matvec - matvecRows * halfRows,
+                  full.matvec - matvecRows * sampleRows, sample.ptr[halfRows],
+                  sample.ptr[sampleRows]);
+  // Each value needed by another chunk is read once and written once.
+  cost.halo = 2 * slope(half.transfer, full.transfer, halfRows, sampleRows);
+}
+
+void CGOpenCLBase::calibrateDevice(cl_device_id device_id, cl_program program,
+                                   const MatrixDataCRS &sample, int sampleRows,
+                                   WorkDistribution::Cost &cost) {
+  Device device;
+  device.init(device_id, this);
+
+  cl_kernel matvec = checkedCreateKernel(program, "matvecKernelCRS");
+  cl_kernel axpy = checkedCreateKernel(program, "axpyKernel");
+
+  int sampleNz = sample.ptr[sampleRows];
+  Device::MatrixCRSDevice matrix;
+  matrix.ptr = checkedCreateBuffer(sizeof(int) * (sampleRows + 1));
+  matrix.index = checkedCreateBuffer(sizeof(int) * std::max(sampleNz, 1));
+  matrix.value = checkedCreateBuffer(sizeof(floatType) * std::max(sampleNz, 1));
+  device.checkedEnqueueWriteBuffer(matrix.ptr, sizeof(int) * (sampleRows + 1),
+                                   sample.ptr);
+  if (sampleNz > 0) {
+    device.checkedEnqueueWriteBuffer(matrix.index, sizeof(int) * sampleNz,
+                                     sample.index);
+    device.checkedEnqueueWriteBuffer(matrix.value,
+                                     sizeof(floatType) * sampleNz, sample.value);
+  }
+  // The columns of the sample may refer to any row.
+  std::vector<floatType> ones(N, 1);
+  cl_mem x = checkedCreateBuffer(sizeof(floatType) * N);
+  cl_mem y = checkedCreateBuffer(sizeof(floatType) * N);
+  device.checkedEnqueueWriteBuffer(x, sizeof(floatType) * N, ones.data());
+  device.checkedEnqueueWriteBuffer(y, sizeof(floatType) * N, ones.data());
+  device.checkedFinish();
+
+  // Measure the kernels and a transfer for some rows.
+  auto measure = [&](int rows) {
+    static const int ZERO = 0;
+    static const floatType zero = 0;
+    device.calculateLaunchConfiguration(rows);
+
+    CalibrationTimes times;
+    times.matvec = timeLaunches(device, [&] {
+      device.checkedEnqueueMatvecKernelCRS(matvec, matrix, x, y, 0, rows);
+    });
+    times.vector = timeLaunches(device, [&] {
+      checkedSetKernelArg(axpy, 0, sizeof(floatType), &zero);
+      checkedSetKernelArg(axpy, 1, sizeof(cl_mem), &x);
+      checkedSetKernelArg(axpy, 2, sizeof(int), &ZERO);
+      checkedSetKernelArg(axpy, 3, sizeof(cl_mem), &y);
+      checkedSetKernelArg(axpy, 4, sizeof(int), &ZERO);
+      checkedSetKernelArg(axpy, 5, sizeof(int), &rows);
+      device.checkedEnqueueNDRangeKernel(axpy);
+    });
+    times.transfer = timeLaunches(device, [&] {
+      device.checkedEnqueueWriteBuffer(x, sizeof(floatType) * rows,
+                                       ones.data());
+    });
+    return times;
+  };
+  int halfRows = std::max(sampleRows / 2, 1);
+  CalibrationTimes half = measure(halfRows);
+  CalibrationTimes full = measure(sampleRows);
+  fitCalibration(sample, halfRows, sampleRows, half, full, cost);
+
+  freeMatrixCRSDevice(matrix);
+  checkedReleaseMemObject(x);
+  checkedReleaseMemObject(y);
+  clReleaseKernel(matvec);
+  clReleaseKernel(axpy);
+}
+
+void CGOpenCLBase::calibrate(WorkDistribution::Cost *costs) {
+  cl_uint numDevices;
+  checkError(clGetContextInfo(ctx, CL_CONTEXT_NUM_DEVICES, sizeof(cl_uint),
+                              &numDevices, NULL));
+  std::vector<cl_device_id> devices(numDevices);
+  checkError(clGetContextInfo(ctx, CL_CONTEXT_DEVICES,
+                              sizeof(cl_device_id) * numDevices, devices.data(),
+                              NULL));
+  // An additional chunk is computed on the host.
+  bool host = (int)numDevices < getNumberOfChunks();
+  assert((int)numDevices + (host ? 1 : 0) == getNumberOfChunks());
+
+  // The calibration belongs to the device in this host, not to the matrix.
+  char hostname[256] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+  std::string options;
+#ifdef CG_USE_FLOAT
+  options = " -DCG_USE_FLOAT";
+#endif
+  std::vector<std::string> keys;
+  std::vector<bool> cached(numDevices, false);
+  bool allCached = true;
+  for (cl_uint d = 0; d < numDevices; d++) {
+    keys.push_back(getBinaryCacheKey(
+        devices[d], std::string("calibration;") + hostname + ";" + options));
+    if (!binaryCache.empty()) {
+      cached[d] = loadCalibration(costs[d], keys[d]);
+    }
+    allCached = allCached && cached[d];
+  }
+  if (allCached) {
+    std::cout << "Loaded calibration from binary cache..." << std::endl;
+    if (!host) {
+      return;
+    }
+  }
+
+  // Sample the first rows of the matrix in CRS format.
+  int sampleRows = CalibrationRows;
+  if (N < sampleRows) {
+    sampleRows = N;
+  }
+  std::vector<int> ptr(sampleRows + 1, 0);
+  for (int i = 0; i < sampleRows; i++) {
+    ptr[i + 1] = ptr[i] + matrixCOO->nzPerRow[i];
+  }
+  std::vector<int> index(ptr[sampleRows]);
+  std::vector<floatType> value(ptr[sampleRows]);
+  std::vector<int> next(ptr.begin(), ptr.end() - 1);
+  for (int i = 0; i < nz; i++) {
+    int row = matrixCOO->I[i];
+    if (row < sampleRows) {
+      int j = next[row]++;
+      index[j] = matrixCOO->J[i];
+      value[j] = matrixCOO->V[i];
+    }
+  }
+  MatrixDataCRS sample;
+  sample.ptr = ptr.data();
+  sample.index = index.data();
+  sample.value = value.data();
+
+  if (!allCached) {
+    std::cout << "Calibrating devices..." << std::endl;
+    // The program for the solver is specialized for the converted matrix, so
+    // build a generic one with the same kernels.
+    cl_int err;
+    cl_program calibrationProgram =
+        clCreateProgramWithSource(ctx, 1, &source, NULL, &err);
+    checkError(err);
+    checkError(clBuildProgram(calibrationProgram, 0, NULL, options.c_str(),
+                              NULL, NULL));
+
+    for (cl_uint d = 0; d < numDevices; d++) {
+      if (cached[d]) {
+        continue;
+      }
+      calibrateDevice(devices[d], calibrationProgram, sample, sampleRows,
+                      costs[d]);
+      if (!binaryCache.empty()) {
+        storeCalibration(costs[d], keys[d]);
+      }
+    }
+    clReleaseProgram(calibrationProgram);
+  }
+
+  // The load on the host may change between runs, so it is not cached.
+  if (host) {
+    std::cout << "Calibrating host..." << std::endl;
+    calibrateHost(sample, sampleRows, costs[numDevices]);
+  }
+}
+
+void CGOpenCLBase::tuneLaunchConfiguration(
+    Device &device, int length, const std::function<void()> &matvec) {
+  // Classify the sizes so that the configuration can be reused for similar
+  // matrices.
+  std::ostringstream sizeClass;
+  sizeClass << "launch;" << matrixFormat << ";" << crsKernel << ";"
+            << std::ilogb(std::max(length, 1)) << ";"
+            << std::ilogb(std::max(nz / N, 1));
+  std::string key = getBinaryCacheKey(device.device_id, sizeClass.str());
+  if (!binaryCache.empty() && loadLaunchConfiguration(device, key)) {
+    device.calculateLaunchConfiguration(length);
+    return;
+  }
+
+  static const size_t MinLocal = 32;
+  static const size_t MaxLocal = 1024;
+  static const size_t MinGroups = 64;
+
+  // Tune the vector kernels with a reduction like CG#vectorDot and a streaming
+  // update like CG#axpy. Only CG#VectorQ is written.
+  size_t maxLocal = getMaxLocal(
+      device, {axpyKernelCL, xpayKernelCL, vectorDotKernelCL,
+               applyPreconditionerKernelJacobi, fusedUpdateKernelCL,
+               fusedXpayKernelCL});
+  size_t maxLocalReduce =
+      getMaxLocal(device, {deviceReduceKernel, reducePartialKernel});
+  auto vectorKernels = [&] {
+    static const int ZERO = 0;
+    static const floatType zero = 0;
+    size_t localForVectorDot = device.local * sizeof(floatType);
+    size_t localForReduce = device.maxGroups * sizeof(floatType);
+
+    checkedSetKernelArg(vectorDotKernelCL, 0, sizeof(cl_mem), &device.k);
+    checkedSetKernelArg(vectorDotKernelCL, 1, sizeof(int), &ZERO);
+    checkedSetKernelArg(vectorDotKernelCL, 2, sizeof(cl_mem), &device.k);
+    checkedSetKernelArg(vectorDotKernelCL, 3, sizeof(int), &ZERO);
+    checkedSetKernelArg(vectorDotKernelCL, 4, sizeof(cl_mem), &device.tmp);
+    checkedSetKernelArg(vectorDotKernelCL, 5, localForVectorDot, NULL);
+    checkedSetKernelArg(vectorDotKernelCL, 6, sizeof(int), &length);
+    device.checkedEnqueueNDRangeKernel(vectorDotKernelCL);
+
+    checkedSetKernelArg(deviceReduceKernel, 0, sizeof(cl_mem), &device.tmp);
+    checkedSetKernelArg(deviceReduceKernel, 1, sizeof(cl_mem), &device.tmp);
+    checkedSetKernelArg(deviceReduceKernel, 2, localForReduce, NULL);
+    checkedSetKernelArg(deviceReduceKernel, 3, sizeof(int), &device.groups);
+    device.checkedEnqueueNDRangeKernel(deviceReduceKernel, device.maxGroups,
+                                       device.maxGroups);
+
+    checkedSetKernelArg(axpyKernelCL, 0, sizeof(floatType), &zero);
+    checkedSetKernelArg(axpyKernelCL, 1, sizeof(cl_mem), &device.k);
+    checkedSetKernelArg(axpyKernelCL, 2, sizeof(int), &ZERO);
+    checkedSetKernelArg(axpyKernelCL, 3, sizeof(cl_mem), &device.q);
+    checkedSetKernelArg(axpyKernelCL, 4, sizeof(int), &ZERO);
+    checkedSetKernelArg(axpyKernelCL, 5, sizeof(int), &length);
+    device.checkedEnqueueNDRangeKernel(axpyKernelCL);
+  };
+
+  double best = std::numeric_limits<double>::max();
+  size_t bestLocal = device.local, bestMaxGroups = device.maxGroups;
+  for (size_t local = MinLocal; local <= std::min(maxLocal, MaxLocal);
+       local *= 2) {
+    // The candidates must be powers of two and fit into Device::tmp.
+    for (size_t maxGroups = MinGroups; maxGroups <= Device::MaxGroupsLimit &&
+                                       maxGroups <= maxLocalReduce;
+         maxGroups *= 4) {
+
+      device.local = local;
+      device.maxGroups = maxGroups;
+      device.calculateLaunchConfiguration(length);
+      double time = timeLaunches(device, vectorKernels);
+      if (time < best) {
+        best = time;
+        bestLocal = local;
+        bestMaxGroups = maxGroups;
+      }
+    }
+  }
+  device.local = bestLocal;
+  device.maxGroups = bestMaxGroups;
+
+  // Tune CG#matvec. CPUs prefer a few groups per compute unit with long
+  // grid-stride loops, GPUs prefer one work-item per row.
+  cl_uint computeUnits;
+  checkError(clGetDeviceInfo(device.device_id, CL_DEVICE_MAX_COMPUTE_UNITS,
+                             sizeof(computeUnits), &computeUnits, NULL));
+  std::vector<size_t> candidateGroupsMatvec;
+  for (size_t perUnit : {4, 16, 64}) {
+    if (computeUnits * perUnit < Device::MaxGroupsMatvecLimit) {
+      candidateGroupsMatvec.push_back(computeUnits * perUnit);
+    }
+  }
+  candidateGroupsMatvec.push_back(
+      static_cast<size_t>(Device::MaxGroupsMatvecLimit));
+
+  maxLocal = getMaxLocal(
+      device, {matvecKernelCRS, matvecKernelELL, matvecKernelCRSRoundup,
+               matvecKernelELLRoundup, matvecKernelCRSRows,
+               matvecKernelCRSRowsRoundup, matvecKernelCRSVector,
+               matvecKernelCRSVectorRoundup});
+  best = std::numeric_limits<double>::max();
+  size_t bestLocalMatvec = device.localMatvec;
+  size_t bestMaxGroupsMatvec = device.maxGroupsMatvec;
+  for (size_t local = MinLocal; local <= std::min(maxLocal, MaxLocal);
+       local *= 2) {
+    for (size_t maxGroups : candidateGroupsMatvec) {
+      device.localMatvec = local;
+      device.maxGroupsMatvec = maxGroups;
+      device.calculateLaunchConfiguration(length);
+      double time = timeLaunches(device, matvec);
+      if (time < best) {
+        best = time;
+        bestLocalMatvec = local;
+        bestMaxGroupsMatvec = maxGroups;
+      }
+    }
+  }
+  device.localMatvec = bestLocalMatvec;
+  device.maxGroupsMatvec = bestMaxGroupsMatvec;
+  device.calculateLaunchConfiguration(length);
+
+  if (profiling) {
+    // Only profile the commands of the solver.
+    device.profile.clear();
+  }
+  if (!binaryCache.empty()) {
+    storeLaunchConfiguration(device, key);
+  }
+}
+
+void CGOpenCLBase::printLaunchConfiguration(Device &device,
+                                            const char *label) {
+  std::ostringstream oss;
+  oss << device.local << " x " << device.groups << " / matvec "
+      << device.localMatvec << " x "
+      << (device.globalMatvec / device.localMatvec);
+  printPadded(label, oss.str());
+}
+
+void CGOpenCLBase::printProfile(Device &device, const std::string &title) {
+  device.collectProfile();
+
+  std::cout << std::endl << title << std::endl;
+  double kernel = 0, launch = 0, transfer = 0;
+  for (auto &entry : device.profile) {
+    const Device::Profile &p = entry.second;
+    std::cout << "  " << std::left << std::setw(32) << (entry.first + ":")
+              << p.count << " x, " << p.execution << " s (launch " << p.launch
+              << " s, queued " << p.queued << " s)" << std::endl;
+
+    if (p.transfer) {
+      transfer += p.execution;
+    } else {
+      kernel += p.execution;
+    }
+    launch += p.launch;
+  }
+  printPadded("Kernel time:", std::to_string(kernel));
+  printPadded("Launch overhead:", std::to_string(launch));
+  printPadded("Transfer time:", std::to_string(transfer));
 }
 
 void CGOpenCLBase::cleanup() {
+  // Zero-copy buffers use the host memory freed by CG::cleanup().
+  freeResidentMatrix();
   CG::cleanup();
 
   clReleaseKernel(matvecKernelCRS);
   clReleaseKernel(matvecKernelELL);
+  if (overlappedGather) {
+    clReleaseKernel(matvecKernelCRSRoundup);
+    clReleaseKernel(matvecKernelELLRoundup);
+  }
+  if (matvecKernelCRSRows != NULL) {
+    clReleaseKernel(matvecKernelCRSRows);
+    clReleaseKernel(matvecKernelCRSVector);
+  }
+  if (matvecKernelCRSRowsRoundup != NULL) {
+    clReleaseKernel(matvecKernelCRSRowsRoundup);
+    clReleaseKernel(matvecKernelCRSVectorRoundup);
+  }
   clReleaseKernel(axpyKernelCL);
   clReleaseKernel(xpayKernelCL);
   clReleaseKernel(vectorDotKernelCL);
   clReleaseKernel(deviceReduceKernel);
-  clReleaseKernel(applyPreconditionerKernelJacobi);
+  if (applyPreconditionerKernelJacobi != NULL) {
+    clReleaseKernel(applyPreconditionerKernelJacobi);
+  }
+  if (fusedSolve) {
+    clReleaseKernel(reducePartialKernel);
+    clReleaseKernel(computeAlphaKernel);
+    clReleaseKernel(computeBetaKernel);
+    clReleaseKernel(fusedUpdateKernelCL);
+    clReleaseKernel(fusedXpayKernelCL);
+  }
 
   clReleaseProgram(program);
   clReleaseContext(ctx);
@@ -19,6 +19,10 @@
 #ifndef CG_OPENCL_BASE_H
 #define CG_OPENCL_BASE_H
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "../CG.h"
@@ -33,15 +37,116 @@ extern const char *source;
 /// Class implementing parallel kernels with OpenCL.
 class CGOpenCLBase : public CG {
 protected:
+  /// Unrolling factor for the inner loop of CG#matvec using a MatrixCRS.
+  static const int UnrollCRS = 4;
+  /// Maximum number of nonzeros per row to fully unroll the loop of CG#matvec
+  /// using a MatrixELL. Wider matrices keep the loop over the row length.
+  static const int MaxUnrollELL = 32;
+  /// Minimum number of nonzeros for a row to be processed by a work-group.
+  static const int MinNzVectorCRS = 32;
+
+  /// Kernels to use for CG#matvec using a MatrixCRS.
+  enum CRSKernel {
+    /// One work-item per row.
+    CRSKernelScalar,
+    /// One work-group per row.
+    CRSKernelVector,
+    /// Bin rows by length, long rows are processed by a work-group.
+    CRSKernelBinned,
+    /// Bin rows if there are rows with at least #MinNzVectorCRS nonzeros.
+    CRSKernelAuto,
+  };
+  CRSKernel crsKernel = CRSKernelAuto;
+
+  /// Whether to use the host memory for buffers instead of copying. This is
+  /// only enabled for devices with host unified memory (e.g. CPUs).
+  bool zeroCopy = true;
+
+  /// MatrixCRS with page-aligned memory for zero-copy buffers.
+  struct AlignedMatrixCRS : MatrixCRS {
+    virtual void allocatePtr(int rows) override;
+    virtual void deallocatePtr() override;
+    virtual void allocateIndexAndValue(int values) override;
+    virtual void deallocateIndexAndValue() override;
+  };
+  /// MatrixELL with page-aligned memory for zero-copy buffers.
+  struct AlignedMatrixELL : MatrixELL {
+    virtual void allocateLength(int rows) override;
+    virtual void deallocateLength() override;
+    virtual void allocateIndexAndData() override;
+    virtual void deallocateIndexAndData() override;
+  };
+  /// Jacobi with page-aligned memory for zero-copy buffers.
+  struct AlignedJacobi : Jacobi {
+    virtual void allocateC(int N) override;
+    virtual void deallocateC() override;
+  };
+
+  /// Whether to record the execution of all commands on the devices.
+  bool profiling = false;
+
+  /// Whether to tune the launch configuration of each device.
+  bool tuning = false;
+  /// Number of timed launches for each candidate when tuning.
+  static const int TuningRepetitions = 10;
+
+  /// Number of rows of the matrix sampled for calibrating the devices.
+  static const int CalibrationRows = 1 << 16;
+  /// Number of vector operations per row in an iteration of CG#solve().
+  static const int CalibrationVectorOperations = 6;
+
+  /// Whether to transfer a MatrixCRS and convert it on the device if
+  /// CG#matrixFormat is MatrixFormatELL.
+  bool deviceConversion = false;
+
+  /// Whether the matrix and the preconditioner are in device memory from an
+  /// earlier transferTo(), see CG#residentMatrix.
+  bool matrixOnDevices = false;
+
+  /// Directory to cache program binaries, empty if disabled.
+  std::string binaryCache;
+
+  /// Scalars on the device for CG#solveFused, keep in sync with kernel.cl!
+  enum FusedScalar {
+    FusedScalarRho,
+    FusedScalarAlpha,
+    FusedScalarBeta,
+    FusedScalarR2,
+    NumberOfFusedScalars,
+  };
+  /// Partial results per chunk for CG#solveFused, keep in sync with kernel.cl!
+  enum FusedPartial {
+    FusedPartialPQ,
+    FusedPartialRR,
+    FusedPartialRZ,
+    NumberOfFusedPartials,
+  };
+
   /// The OpenCL context.
   cl_context ctx = NULL;
 
   /// The OpenCL program containing the kernels.
   cl_program program = NULL;
+  /// Names of the kernels created by checkedCreateKernel() for profiling.
+  std::map<cl_kernel, std::string> kernelNames;
+  /// Protects #kernelNames, devices may be set up in parallel.
+  std::mutex kernelNamesMutex;
   /// Kernel for CG#matvec using a MatrixCRS.
   cl_kernel matvecKernelCRS = NULL;
   /// Kernel for CG#matvec using a MatrixELL.
   cl_kernel matvecKernelELL = NULL;
+  /// Kernel for CG#matvec using a MatrixCRS, adding to the result.
+  cl_kernel matvecKernelCRSRoundup = NULL;
+  /// Kernel for CG#matvec using a MatrixELL, adding to the result.
+  cl_kernel matvecKernelELLRoundup = NULL;
+  /// Kernel for the short rows of a MatrixCRS with one work-item per row.
+  cl_kernel matvecKernelCRSRows = NULL;
+  /// Kernel for the short rows of a MatrixCRS, adding to the result.
+  cl_kernel matvecKernelCRSRowsRoundup = NULL;
+  /// Kernel for the long rows of a MatrixCRS with one work-group per row.
+  cl_kernel matvecKernelCRSVector = NULL;
+  /// Kernel for the long rows of a MatrixCRS, adding to the result.
+  cl_kernel matvecKernelCRSVectorRoundup = NULL;
   /// Kernel for CG#axpy.
   cl_kernel axpyKernelCL = NULL;
   /// Kernelf or CG#xpay.
@@ -52,17 +157,37 @@ protected:
   cl_kernel deviceReduceKernel = NULL;
   /// Kernel for CG#applyPreconditioner using a Jacobi preconditioner.
   cl_kernel applyPreconditionerKernelJacobi = NULL;
+  /// Reduction kernel storing a partial result for CG#solveFused.
+  cl_kernel reducePartialKernel = NULL;
+  /// Kernel computing alpha for CG#fusedAlphaKernel.
+  cl_kernel computeAlphaKernel = NULL;
+  /// Kernel computing beta for CG#fusedUpdateKernel.
+  cl_kernel computeBetaKernel = NULL;
+  /// Kernel for CG#fusedUpdateKernel.
+  cl_kernel fusedUpdateKernelCL = NULL;
+  /// Kernel for CG#fusedXpayKernel.
+  cl_kernel fusedXpayKernelCL = NULL;
 
   /// Holds information about a single device, especially memory, the command
   /// queue and its launch configuration.
   struct Device {
-    /// Local size for all kernels.
-    static const size_t Local = 128;
-    /// Maximum number of groups for all kernels except CG#matvec.
-    static const size_t MaxGroups = 1024;
-    /// Maximum number of groups for CG#matvec.
+    /// Default local size for all kernels.
+    static const size_t DefaultLocal = 128;
+    /// Upper limit for #maxGroups, which is the size of #tmp.
+    static const size_t MaxGroupsLimit = 1024;
+    /// Upper limit for #maxGroupsMatvec.
     /// (65536 seems to not work on the Pascal nodes!)
-    static const size_t MaxGroupsMatvec = 65535;
+    static const size_t MaxGroupsMatvecLimit = 65535;
+
+    /// Local size for all kernels except CG#matvec, must be a power of two.
+    size_t local = DefaultLocal;
+    /// Maximum number of groups for all kernels except CG#matvec. This is the
+    /// local size of the reduction kernels and must be a power of two.
+    size_t maxGroups = MaxGroupsLimit;
+    /// Local size for CG#matvec, must be a power of two.
+    size_t localMatvec = DefaultLocal;
+    /// Maximum number of groups for CG#matvec.
+    size_t maxGroupsMatvec = MaxGroupsMatvecLimit;
 
     /// Number of threads for all kernels except CG#matvec.
     size_t groups;
@@ -71,16 +196,58 @@ protected:
     /// Global size for CG#matvec.
     size_t globalMatvec;
 
+    /// The implementation owning this device.
+    CGOpenCLBase *cg = NULL;
     /// This device's id.
     cl_device_id device_id;
     /// The (cached) context.
     cl_context ctx;
     /// The queue for this device.
     cl_command_queue queue = NULL;
+    /// Properties for creating the queues of this device.
+    cl_command_queue_properties queueProperties = 0;
+
+    /// Whether enqueued commands are ordered by events instead of the queues.
+    bool orderByEvents = false;
+    /// Events the next command waits for if #orderByEvents. Each command
+    /// replaces the list by its own event so that commands are chained.
+    std::vector<cl_event> waitList;
+
+    /// Accumulated profiling information of commands with the same name.
+    struct Profile {
+      /// Whether the commands transfer memory instead of running a kernel.
+      bool transfer = false;
+      /// Number of commands.
+      int count = 0;
+      /// Time between CL_PROFILING_COMMAND_QUEUED and _SUBMIT in seconds.
+      double queued = 0;
+      /// Time between CL_PROFILING_COMMAND_SUBMIT and _START in seconds.
+      double launch = 0;
+      /// Time between CL_PROFILING_COMMAND_START and _END in seconds.
+      double execution = 0;
+    };
+    /// A profiled command that may not have completed yet.
+    struct ProfiledCommand {
+      cl_event event;
+      std::string name;
+      bool transfer;
+    };
+
+    /// Whether to record the profiling information of all commands.
+    bool profiling = false;
+    /// Commands whose profiling information was not collected yet.
+    std::vector<ProfiledCommand> profiledCommands;
+    /// Profiling information by kernel or transfer name.
+    std::map<std::string, Profile> profile;
 
     /// Temporary memory for use in reduction of CG#vectorDot.
     cl_mem tmp = NULL;
 
+    /// Scalars for CG#solveFused.
+    cl_mem scalars = NULL;
+    /// Partial results of all chunks for CG#solveFused.
+    cl_mem partials = NULL;
+
     /// CG#VectorK
     cl_mem k = NULL;
     /// CG#VectorX
@@ -103,6 +270,17 @@ protected:
       cl_mem index = NULL;
       /// @see MatrixDataELL#value
       cl_mem value = NULL;
+
+      /// Whether the rows are binned by their length.
+      bool binned = false;
+      /// Rows processed with one work-item each, if #binned.
+      cl_mem shortRows = NULL;
+      /// Number of #shortRows.
+      int numShortRows = 0;
+      /// Rows processed with one work-group each, if #binned.
+      cl_mem longRows = NULL;
+      /// Number of #longRows.
+      int numLongRows = 0;
     };
     /// MatrixDataCRS on the device.
     MatrixCRSDevice matrixCRS;
@@ -122,28 +300,83 @@ protected:
       cl_mem C = NULL;
     } jacobi;
 
-    ~Device() { clReleaseCommandQueue(queue); }
+    ~Device() {
+      for (ProfiledCommand &command : profiledCommands) {
+        clReleaseEvent(command.event);
+      }
+      clReleaseCommandQueue(queue);
+    }
 
     /// Init device with id \a device_id.
     virtual void init(cl_device_id device_id, CGOpenCLBase *cg) {
+      this->cg = cg;
       this->device_id = device_id;
       this->ctx = cg->ctx;
+      // Rebalancing needs the time of the kernels on each device.
+      profiling = cg->profiling || cg->rebalanceIterations > 0;
+      if (profiling) {
+        queueProperties |= CL_QUEUE_PROFILING_ENABLE;
+      }
 
       cl_int err;
-      queue = clCreateCommandQueue(ctx, device_id, 0, &err);
+      queue = clCreateCommandQueue(ctx, device_id, queueProperties, &err);
       checkError(err);
     }
 
+    /// Call \a enqueue with the wait list and chain the enqueued command if
+    /// #orderByEvents. Record the command as \a name if #profiling and
+    /// optionally return an \a event.
+    template <class Enqueue>
+    void enqueueOrdered(Enqueue enqueue, const std::string &name,
+                        bool transfer, cl_event *event = NULL) {
+      bool needEvent = orderByEvents || profiling || event != NULL;
+      bool wait = orderByEvents && !waitList.empty();
+      cl_event enqueued;
+      checkError(enqueue(wait ? waitList.size() : 0,
+                         wait ? waitList.data() : NULL,
+                         needEvent ? &enqueued : NULL));
+      if (!needEvent) {
+        return;
+      }
+
+      for (cl_event e : waitList) {
+        checkError(clReleaseEvent(e));
+      }
+      waitList.clear();
+
+      // Hand out one reference to every user of the event.
+      int users = 0;
+      if (orderByEvents) {
+        waitList.push_back(enqueued);
+        users++;
+      }
+      if (profiling) {
+        profiledCommands.push_back({enqueued, name, transfer});
+        users++;
+      }
+      if (event != NULL) {
+        *event = enqueued;
+        users++;
+      }
+      for (int i = 1; i < users; i++) {
+        checkError(clRetainEvent(enqueued));
+      }
+    }
+
+    /// Accumulate the profiling information of all completed commands.
+    void collectProfile();
+
     /// Calculate the launch configuration for vectors of length \a N.
     void calculateLaunchConfiguration(int N) {
-      groups = calculateGroups(N, Local, MaxGroups);
-      global = groups * Local;
-      globalMatvec = calculateGroups(N, Local, MaxGroupsMatvec) * Local;
+      groups = calculateGroups(N, local, maxGroups);
+      global = groups * local;
+      globalMatvec =
+          calculateGroups(N, localMatvec, maxGroupsMatvec) * localMatvec;
     }
 
-    /// Enqueue \a kernel.
+    /// Enqueue \a kernel and optionally return an \a event.
     void checkedEnqueueNDRangeKernel(cl_kernel kernel, size_t global = 0,
-                                     size_t local = 0);
+                                     size_t local = 0, cl_event *event = NULL);
     /// Enqueue \a kernel.
     void checkedEnqueueMatvecKernelCRS(cl_kernel kernel,
                                        MatrixCRSDevice &deviceMatrix, cl_mem x,
@@ -156,8 +389,10 @@ protected:
     /// Enqueue read of \a buffer.
     void checkedEnqueueReadBuffer(cl_command_queue queue, cl_mem buffer,
                                   size_t offset, size_t cb, void *ptr) {
-      checkError(clEnqueueReadBuffer(queue, buffer, CL_FALSE, offset, cb, ptr,
-                                     0, NULL, NULL));
+      enqueueOrdered([&](cl_uint num, const cl_event *wait, cl_event *event) {
+        return clEnqueueReadBuffer(queue, buffer, CL_FALSE, offset, cb, ptr,
+                                   num, wait, event);
+      }, "read buffer", /* transfer= */ true);
     }
     /// Enqueue read of \a buffer.
     void checkedEnqueueReadBuffer(cl_mem buffer, size_t offset, size_t cb,
@@ -172,8 +407,10 @@ protected:
     /// Enqueue write of \a buffer.
     void checkedEnqueueWriteBuffer(cl_command_queue queue, cl_mem buffer,
                                    size_t offset, size_t cb, const void *ptr) {
-      checkError(clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, cb, ptr,
-                                      0, NULL, NULL));
+      enqueueOrdered([&](cl_uint num, const cl_event *wait, cl_event *event) {
+        return clEnqueueWriteBuffer(queue, buffer, CL_FALSE, offset, cb, ptr,
+                                    num, wait, event);
+      }, "write buffer", /* transfer= */ true);
     }
     /// Enqueue write of \a buffer.
     void checkedEnqueueWriteBuffer(cl_mem buffer, size_t offset, size_t cb,
@@ -185,8 +422,25 @@ protected:
       checkedEnqueueWriteBuffer(buffer, 0, cb, ptr);
     }
 
+    /// Enqueue copy from \a src to \a dst.
+    void checkedEnqueueCopyBuffer(cl_command_queue queue, cl_mem src,
+                                  cl_mem dst, size_t srcOffset,
+                                  size_t dstOffset, size_t cb) {
+      enqueueOrdered([&](cl_uint num, const cl_event *wait, cl_event *event) {
+        return clEnqueueCopyBuffer(queue, src, dst, srcOffset, dstOffset, cb,
+                                   num, wait, event);
+      }, "copy buffer", /* transfer= */ true);
+    }
+
+    /// Flush all commands in #queue.
+    void checkedFlush() { checkError(clFlush(queue)); }
     /// Finish all commands in #queue.
-    void checkedFinish() { checkError(clFinish(queue)); }
+    void checkedFinish() {
+      checkError(clFinish(queue));
+      if (profiling) {
+        collectProfile();
+      }
+    }
 
     /// @return memory object of the vector on this device.
     cl_mem getVector(Vector v) {
@@ -215,15 +469,53 @@ protected:
   virtual bool supportsPreconditioner(Preconditioner preconditioner) override {
     return preconditioner == PreconditionerJacobi;
   }
+  virtual bool supportsFusedSolve() override { return true; }
+  virtual MatrixFormat getHostMatrixFormat() override {
+    return deviceConversion ? MatrixFormatCRS : matrixFormat;
+  }
 
-  /// @return all devices suitable for computation (excluding CPUs).
+  /// @return all devices suitable for computation (excluding CPUs if there
+  /// are other devices).
   static std::vector<cl_device_id> getAllDevices();
+  /// @return \a true if \a device shares its memory with the host.
+  static bool hasHostUnifiedMemory(cl_device_id device);
+
+  /// @return the maximum number of nonzeros in the \a rows of \a data.
+  static int getMaxNzCRS(int rows, const MatrixDataCRS &data);
+  /// @return the maximum number of nonzeros per row in all MatrixDataELL.
+  int getMaxNzELL();
+  /// @return options to specialize the program for the current matrix.
+  std::string getBuildOptions();
+  /// @return the key to cache the program binary for \a device.
+  static std::string getBinaryCacheKey(cl_device_id device,
+                                       const std::string &options);
+  /// @return the file caching the program binary or other data for \a key.
+  std::string getBinaryCacheFile(const std::string &key,
+                                 const char *extension = ".bin");
+  /// Try to create #program from cached binaries for all \a devices.
+  /// @return \a true if successful.
+  bool loadProgramBinaries(const std::vector<cl_device_id> &devices,
+                           const std::string &options);
+  /// Store the binaries of #program for all \a devices.
+  void storeProgramBinaries(const std::vector<cl_device_id> &devices,
+                            const std::string &options);
+  /// Build #program with \a options and exit with the build log on failure.
+  void checkedBuildProgram(const std::string &options);
+  /// Build or load #program specialized for the current matrix.
+  void buildProgram();
 
   /// @return the loaded kernel called \a kernelname.
-  cl_kernel checkedCreateKernel(const char *kernelName);
-
-  /// @return buffer of size \a size created with \a flags.
-  cl_mem checkedCreateBufferWithFlags(cl_mem_flags flags, size_t size);
+  cl_kernel checkedCreateKernel(const char *kernelName) {
+    return checkedCreateKernel(program, kernelName);
+  }
+  /// @return the kernel called \a kernelname loaded from \a program.
+  cl_kernel checkedCreateKernel(cl_program program, const char *kernelName);
+  /// @return the name of \a kernel, cached when the kernel was created.
+  const std::string &getKernelName(cl_kernel kernel);
+
+  /// @return buffer of size \a size created with \a flags and \a hostPtr.
+  cl_mem checkedCreateBufferWithFlags(cl_mem_flags flags, size_t size,
+                                      void *hostPtr = NULL);
   /// @return read and write buffer.
   /// @see checkedCreateBufferWithFlags
   cl_mem checkedCreateBuffer(size_t size) {
@@ -234,7 +526,26 @@ protected:
   cl_mem checkedCreateReadBuffer(size_t size) {
     return checkedCreateBufferWithFlags(CL_MEM_READ_ONLY, size);
   }
-
+  /// Enqueue the transfer of \a size bytes from \a hostPtr into \a buffer on
+  /// \a device.
+  virtual void enqueueTransferTo(Device &device, cl_mem buffer, size_t size,
+                                 const void *hostPtr) {
+    device.checkedEnqueueWriteBuffer(buffer, size, hostPtr);
+  }
+  /// @return buffer with the content of \a hostPtr, which is used directly if
+  /// #zeroCopy. Otherwise enqueue a write on \a device.
+  cl_mem checkedCreateBufferAndCopy(Device &device, cl_mem_flags flags,
+                                    size_t size, void *hostPtr);
+
+  virtual void allocateMatrixCRS() override;
+  virtual void allocateMatrixELL() override;
+  virtual void allocateJacobi() override;
+  virtual void allocateK() override;
+  virtual void deallocateK() override;
+  virtual void allocateX() override;
+  virtual void deallocateX() override;
+
+  virtual void parseEnvironment() override;
   virtual void init(const char *matrixFile) override;
 
   virtual bool needsTransfer() override { return true; }
@@ -248,17 +559,124 @@ protected:
                                     Device &device,
                                     Device::MatrixELLDevice &deviceMatrix);
 
-  /// Free \a deviceMatrix.
-  void freeMatrixCRSDevice(const Device::MatrixCRSDevice &deviceMatrix);
-  /// Free \a deviceMatrix.
-  void freeMatrixELLDevice(const Device::MatrixELLDevice &deviceMatrix);
+  /// Allocate a MatrixDataELL on the \a device, copy \a data and convert it
+  /// with a kernel.
+  void allocateAndConvertMatrixDataELL(int length, const MatrixDataCRS &data,
+                                       Device &device,
+                                       Device::MatrixELLDevice &deviceMatrix);
+
+  /// Transfer \a size bytes from \a hostPtr into \a buffer, which was created
+  /// by checkedCreateBufferAndCopy() or filled by enqueueTransferTo().
+  void copyIntoBuffer(Device &device, cl_mem buffer, size_t size,
+                      void *hostPtr);
+  /// Transfer only the values of \a data into \a deviceMatrix allocated by
+  /// allocateAndCopyMatrixDataCRS().
+  void copyMatrixValuesCRS(int length, const MatrixDataCRS &data,
+                           Device &device,
+                           Device::MatrixCRSDevice &deviceMatrix);
+  /// Transfer only the values of \a data into \a deviceMatrix allocated by
+  /// allocateAndCopyMatrixDataELL().
+  void copyMatrixValuesELL(const MatrixDataELL &data, Device &device,
+                           Device::MatrixELLDevice &deviceMatrix);
+
+  /// Bin the rows of \a data according to #crsKernel for \a deviceMatrix.
+  void binRowsCRS(int length, const MatrixDataCRS &data,
+                  Device::MatrixCRSDevice &deviceMatrix);
+  /// Enqueue CG#matvec for \a deviceMatrix, adding to \a y if \a roundup.
+  void enqueueMatvecCRS(Device &device, Device::MatrixCRSDevice &deviceMatrix,
+                        cl_mem x, cl_mem y, int yOffset, int N, bool roundup);
+
+  /// Free \a deviceMatrix and reset it for the next allocation.
+  void freeMatrixCRSDevice(Device::MatrixCRSDevice &deviceMatrix);
+  /// Free \a deviceMatrix and reset it for the next allocation.
+  void freeMatrixELLDevice(Device::MatrixELLDevice &deviceMatrix);
+
+  /// Allocate #Device::tmp on the \a device.
+  void allocateTmp(Device &device);
+  /// Allocate memory for the fused kernels with \a chunks on the \a device.
+  void allocateFused(Device &device, int chunks);
+  /// Free memory of the fused kernels on the \a device.
+  void freeFused(Device &device);
+
+  /// Enqueue reduction of #Device::tmp starting at \a tmpOffset into the
+  /// \a partial result of \a chunk.
+  void enqueueReducePartial(Device &device, int tmpOffset, int chunk,
+                            FusedPartial partial, cl_event *event);
+  /// Enqueue partial result of <\a p, \a q> for \a chunk.
+  void enqueueFusedDot(Device &device, cl_mem p, int pOffset, cl_mem q,
+                       int length, int chunk, cl_event *event = NULL);
+  /// Enqueue #fusedUpdateKernelCL and the reductions for \a chunk.
+  void enqueueFusedUpdate(Device &device, int xOffset, int pOffset, int length,
+                          int chunk, cl_event *event = NULL);
+  /// Enqueue \a kernel computing a scalar from the partials of \a chunks.
+  void enqueueFusedScalarKernel(Device &device, cl_kernel kernel, int chunks);
+  /// Enqueue #fusedXpayKernelCL.
+  void enqueueFusedXpay(Device &device, cl_mem x, int xOffset, cl_mem y,
+                        int yOffset, int length);
+
+  /// @return the maximum local size of all \a kernels on \a device.
+  static size_t getMaxLocal(Device &device,
+                            std::initializer_list<cl_kernel> kernels);
+  /// @return the time for #TuningRepetitions calls of \a enqueue on \a device.
+  static double timeLaunches(Device &device,
+                             const std::function<void()> &enqueue);
+  /// Try to load the launch configuration of \a device cached for \a key.
+  /// @return \a true if successful.
+  bool loadLaunchConfiguration(Device &device, const std::string &key);
+  /// Store the launch configuration of \a device for \a key.
+  void storeLaunchConfiguration(Device &device, const std::string &key);
+  /// Tune the launch configuration of \a device for vectors of \a length.
+  /// \a matvec enqueues CG#matvec with the device's matrix from
+  /// CG#VectorX into CG#VectorQ. All data must be on the device.
+  void tuneLaunchConfiguration(Device &device, int length,
+                               const std::function<void()> &matvec);
+  /// Try to load the calibrated \a cost of a device cached for \a key.
+  /// @return \a true if successful.
+  bool loadCalibration(WorkDistribution::Cost &cost, const std::string &key);
+  /// Store the calibrated \a cost of a device for \a key.
+  void storeCalibration(const WorkDistribution::Cost &cost,
+                        const std::string &key);
+  /// Times for #TuningRepetitions calls of the kernels measured for the
+  /// calibration.
+  struct CalibrationTimes {
+    double matvec, vector, transfer;
+  };
+  /// Fit the \a cost from the times measured for \a halfRows and \a sampleRows
+  /// rows of \a sample.
+  static void fitCalibration(const MatrixDataCRS &sample, int halfRows,
+                             int sampleRows, const CalibrationTimes &half,
+                             const CalibrationTimes &full,
+                             WorkDistribution::Cost &cost);
+  /// Measure the \a cost of \a device_id with the kernels of \a program on
+  /// the first \a sampleRows rows of the matrix in \a sample.
+  void calibrateDevice(cl_device_id device_id, cl_program program,
+                       const MatrixDataCRS &sample, int sampleRows,
+                       WorkDistribution::Cost &cost);
+  /// Measure the \a cost of a chunk computed on the host, see calibrateDevice().
+  virtual void calibrateHost(const MatrixDataCRS &sample, int sampleRows,
+                             WorkDistribution::Cost &cost) {
+    assert(0 && "No chunk on the host!");
+  }
+  /// Calibrate each device of #ctx for one chunk, followed by the chunk on the
+  /// host if there is one more.
+  virtual void calibrate(WorkDistribution::Cost *costs) override;
+
+  /// Print the launch configuration of \a device with \a label.
+  static void printLaunchConfiguration(Device &device, const char *label);
 
+  /// Print the profiling information of \a device with \a title.
+  void printProfile(Device &device, const std::string &title);
+
+  virtual void printSummary() override;
   virtual void cleanup() override;
 
 public:
   /// @see CG
   CGOpenCLBase(bool overlappedGather = false)
-      : CG(MatrixFormatELL, PreconditionerJacobi, overlappedGather) {}
+      : CG(MatrixFormatELL, PreconditionerJacobi, overlappedGather) {
+    // Avoid the synchronization with the host for every scalar by default.
+    fusedSolve = true;
+  }
 };
 
 #endif
@@ -18,8 +18,29 @@ R"(
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
 // Keep in sync with def.h!
+#ifdef CG_USE_FLOAT
+typedef float floatType;
+typedef float8 floatType8;
+#else
 typedef double floatType;
 typedef double8 floatType8;
+#endif
+
+// The program is specialized when it is built (see CGOpenCLBase::buildProgram):
+//  - CG_USE_FLOAT is defined if floatType is float,
+//  - CG_ELL_MAX_NZ is the maximum number of nonzeros per row in ELLPACK format
+//    if it is small enough to fully unroll the loop over the columns,
+//  - CG_CHUNK_LENGTH is the number of rows if there is only one chunk,
+//  - CG_UNROLL is the unrolling factor for the inner loop in CRS format,
+//  - CG_PRECONDITIONER_JACOBI is defined if the Jacobi preconditioner is used.
+#ifdef CG_CHUNK_LENGTH
+#define ELL_STRIDE CG_CHUNK_LENGTH
+#else
+#define ELL_STRIDE N
+#endif
+#ifndef CG_UNROLL
+#define CG_UNROLL 1
+#endif
 
 // inspired by
 // https://devblogs.nvidia.com/parallelforall/cuda-pro-tip-write-flexible-kernels-grid-stride-loops/
@@ -35,6 +56,7 @@ __kernel void matvecKernelCRS(__global int *ptr, __global int *index,
                               __global floatType *y, int yOffset, int N) {
   for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
     floatType tmp = 0;
+    #pragma unroll CG_UNROLL
     for (int j = ptr[i]; j < ptr[i + 1]; j++) {
       tmp += value[j] * x[index[j]];
     }
@@ -53,6 +75,46 @@ __kernel void matvecKernelCRSRoundup(__global int *ptr, __global int *index,
     // Skip load and store if nothing to be done...
     if (ptr[i] != ptr[i + 1]) {
       floatType tmp = y[yOffset + i];
+      #pragma unroll CG_UNROLL
+      for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+        tmp += value[j] * x[index[j]];
+      }
+      y[yOffset + i] = tmp;
+    }
+  }
+}
+
+// Same as above, but only for the rows in the list \a rows.
+__attribute__((vec_type_hint(floatType8)))
+__kernel void matvecKernelCRSRows(__global int *ptr, __global int *index,
+                                  __global floatType *value,
+                                  __global floatType *x, __global floatType *y,
+                                  int yOffset, __global int *rows,
+                                  int numRows) {
+  for (int r = get_global_id(0); r < numRows; r += get_global_size(0)) {
+    int i = rows[r];
+    floatType tmp = 0;
+    #pragma unroll CG_UNROLL
+    for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+      tmp += value[j] * x[index[j]];
+    }
+    y[yOffset + i] = tmp;
+  }
+}
+
+// See above...
+__attribute__((vec_type_hint(floatType8)))
+__kernel void matvecKernelCRSRowsRoundup(__global int *ptr, __global int *index,
+                                         __global floatType *value,
+                                         __global floatType *x,
+                                         __global floatType *y, int yOffset,
+                                         __global int *rows, int numRows) {
+  for (int r = get_global_id(0); r < numRows; r += get_global_size(0)) {
+    int i = rows[r];
+    // Skip load and store if nothing to be done...
+    if (ptr[i] != ptr[i + 1]) {
+      floatType tmp = y[yOffset + i];
+      #pragma unroll CG_UNROLL
       for (int j = ptr[i]; j < ptr[i + 1]; j++) {
         tmp += value[j] * x[index[j]];
       }
@@ -61,16 +123,58 @@ __kernel void matvecKernelCRSRoundup(__global int *ptr, __global int *index,
   }
 }
 
+// With a known maximum number of nonzeros, the compiler can fully unroll the
+// loop over the columns and predicate the loads instead of branching.
+static inline floatType ellRow(__global int *index, __global floatType *data,
+                               __global floatType *x, int rowLength, int i,
+                               int N) {
+  floatType tmp = 0;
+#ifdef CG_ELL_MAX_NZ
+  #pragma unroll
+  for (int j = 0; j < CG_ELL_MAX_NZ; j++) {
+    if (j < rowLength) {
+      int k = j * ELL_STRIDE + i;
+      tmp += data[k] * x[index[k]];
+    }
+  }
+#else
+  for (int j = 0; j < rowLength; j++) {
+    int k = j * ELL_STRIDE + i;
+    tmp += data[k] * x[index[k]];
+  }
+#endif
+  return tmp;
+}
+
+__kernel void convertCRSToELLKernel(__global int *ptr, __global int *index,
+                                    __global floatType *value,
+                                    __global int *length,
+                                    __global int *ellIndex,
+                                    __global floatType *ellData, int maxNz,
+                                    int N) {
+  for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
+    int start = ptr[i];
+    int rowLength = ptr[i + 1] - start;
+    length[i] = rowLength;
+    for (int j = 0; j < maxNz; j++) {
+      int k = j * N + i;
+      if (j < rowLength) {
+        ellIndex[k] = index[start + j];
+        ellData[k] = value[start + j];
+      } else {
+        // Zero the padding so that it is harmless if read.
+        ellIndex[k] = 0;
+        ellData[k] = 0;
+      }
+    }
+  }
+}
+
 __kernel void matvecKernelELL(__global int *length, __global int *index,
                               __global floatType *data, __global floatType *x,
                               __global floatType *y, int yOffset, int N) {
   for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
-    floatType tmp = 0;
-    for (int j = 0; j < length[i]; j++) {
-      int k = j * N + i;
-      tmp += data[k] * x[index[k]];
-    }
-    y[yOffset + i] = tmp;
+    y[yOffset + i] = ellRow(index, data, x, length[i], i, N);
   }
 }
 
@@ -80,13 +184,9 @@ __kernel void matvecKernelELLRoundup(__global int *length, __global int *index,
                                      __global floatType *y, int yOffset,
                                      int N) {
   for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
-    if (length[i] > 0) {
-      floatType tmp = y[yOffset + i];
-      for (int j = 0; j < length[i]; j++) {
-        int k = j * N + i;
-        tmp += data[k] * x[index[k]];
-      }
-      y[yOffset + i] = tmp;
+    int rowLength = length[i];
+    if (rowLength > 0) {
+      y[yOffset + i] += ellRow(index, data, x, rowLength, i, N);
     }
   }
 }
@@ -143,6 +243,52 @@ __kernel void deviceReduceKernel(__global floatType *in,
 }
 // -----------------------------------------------------------------------------
 
+// Long rows are processed by a whole work-group so that the loads of the
+// nonzeros are coalesced and the work is balanced between the work-items.
+static inline floatType crsRowVector(__global int *ptr, __global int *index,
+                                     __global floatType *value,
+                                     __global floatType *x, int i,
+                                     __local floatType *scratch) {
+  floatType sum = 0;
+  for (int j = ptr[i] + get_local_id(0); j < ptr[i + 1];
+       j += get_local_size(0)) {
+    sum += value[j] * x[index[j]];
+  }
+
+  return localReduceSum(sum, scratch);
+}
+
+__kernel void matvecKernelCRSVector(__global int *ptr, __global int *index,
+                                    __global floatType *value,
+                                    __global floatType *x,
+                                    __global floatType *y, int yOffset,
+                                    __global int *rows, int numRows,
+                                    __local floatType *scratch) {
+  for (int r = get_group_id(0); r < numRows; r += get_num_groups(0)) {
+    int i = rows[r];
+    floatType sum = crsRowVector(ptr, index, value, x, i, scratch);
+    if (get_local_id(0) == 0) {
+      y[yOffset + i] = sum;
+    }
+  }
+}
+
+__kernel void matvecKernelCRSVectorRoundup(__global int *ptr,
+                                           __global int *index,
+                                           __global floatType *value,
+                                           __global floatType *x,
+                                           __global floatType *y, int yOffset,
+                                           __global int *rows, int numRows,
+                                           __local floatType *scratch) {
+  for (int r = get_group_id(0); r < numRows; r += get_num_groups(0)) {
+    int i = rows[r];
+    floatType sum = crsRowVector(ptr, index, value, x, i, scratch);
+    if (get_local_id(0) == 0) {
+      y[yOffset + i] += sum;
+    }
+  }
+}
+
 __kernel void vectorDotKernel(__global floatType *a, int aOffset,
                               __global floatType *b, int bOffset,
                               __global floatType *tmp,
@@ -159,6 +305,114 @@ __kernel void vectorDotKernel(__global floatType *a, int aOffset,
   }
 }
 
+// Kernels for CG::solveFused that keep all scalars on the device.
+// -----------------------------------------------------------------------------
+// Indices into the scalars and into the partial results per chunk, keep in sync
+// with CGOpenCLBase!
+#define SCALAR_RHO 0
+#define SCALAR_ALPHA 1
+#define SCALAR_BETA 2
+#define SCALAR_R2 3
+#define PARTIAL_PQ 0
+#define PARTIAL_RR 1
+#define PARTIAL_RZ 2
+#define NUMBER_OF_PARTIALS 3
+
+__kernel void reducePartialKernel(__global floatType *in, int inOffset,
+                                  __global floatType *partials, int partial,
+                                  __local floatType *scratch, int N) {
+  floatType sum = 0;
+  for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
+    sum += in[inOffset + i];
+  }
+
+  sum = localReduceSum(sum, scratch);
+
+  if (get_global_id(0) == 0) {
+    partials[partial] = sum;
+  }
+}
+
+static inline floatType sumPartials(__global floatType *partials, int partial,
+                                    int chunks) {
+  // Always sum in the same order so that all devices get the same result.
+  floatType sum = 0;
+  for (int c = 0; c < chunks; c++) {
+    sum += partials[c * NUMBER_OF_PARTIALS + partial];
+  }
+  return sum;
+}
+
+__kernel void computeAlphaKernel(__global floatType *scalars,
+                                 __global floatType *partials, int chunks) {
+  floatType pq = sumPartials(partials, PARTIAL_PQ, chunks);
+  scalars[SCALAR_ALPHA] = (pq != 0) ? scalars[SCALAR_RHO] / pq : 0;
+}
+
+__kernel void computeBetaKernel(__global floatType *scalars,
+                                __global floatType *partials, int chunks) {
+  floatType r2 = sumPartials(partials, PARTIAL_RR, chunks);
+#ifdef CG_PRECONDITIONER_JACOBI
+  floatType rho = sumPartials(partials, PARTIAL_RZ, chunks);
+#else
+  floatType rho = r2;
+#endif
+  floatType oldRho = scalars[SCALAR_RHO];
+
+  scalars[SCALAR_BETA] = (oldRho != 0) ? rho / oldRho : 0;
+  scalars[SCALAR_RHO] = rho;
+  scalars[SCALAR_R2] = r2;
+}
+
+// x += alpha * p, r -= alpha * q and z = C * r, including the partial results
+// of r * r and r * z for each group.
+__kernel void fusedUpdateKernel(__global floatType *scalars,
+                                __global floatType *x, int xOffset,
+                                __global floatType *p, int pOffset,
+                                __global floatType *q, __global floatType *r,
+                                __global floatType *C, __global floatType *z,
+                                __global floatType *tmp,
+                                __local floatType *scratch, int N) {
+  floatType alpha = scalars[SCALAR_ALPHA];
+  floatType rr = 0;
+#ifdef CG_PRECONDITIONER_JACOBI
+  floatType rz = 0;
+#endif
+  for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
+    x[xOffset + i] += alpha * p[pOffset + i];
+    floatType ri = r[i] - alpha * q[i];
+    r[i] = ri;
+    rr += ri * ri;
+#ifdef CG_PRECONDITIONER_JACOBI
+    floatType zi = C[i] * ri;
+    z[i] = zi;
+    rz += ri * zi;
+#endif
+  }
+
+  rr = localReduceSum(rr, scratch);
+  if (get_local_id(0) == 0) {
+    tmp[get_group_id(0)] = rr;
+  }
+#ifdef CG_PRECONDITIONER_JACOBI
+  rz = localReduceSum(rz, scratch);
+  if (get_local_id(0) == 0) {
+    tmp[get_num_groups(0) + get_group_id(0)] = rz;
+  }
+#endif
+}
+
+__kernel void fusedXpayKernel(__global floatType *scalars,
+                              __global floatType *x, int xOffset,
+                              __global floatType *y, int yOffset, int N) {
+  floatType beta = scalars[SCALAR_BETA];
+  for (int i = get_global_id(0); i < N; i += get_global_size(0)) {
+    y[yOffset + i] = x[xOffset + i] + beta * y[yOffset + i];
+  }
+}
+// -----------------------------------------------------------------------------
+
+#ifdef CG_PRECONDITIONER_JACOBI
 __kernel void applyPreconditionerKernelJacobi(__global floatType *C,
                                               __global floatType *x,
                                               int xOffset,
@@ -168,5 +422,6 @@ __kernel void applyPreconditionerKernelJacobi(__global floatType *C,
     y[yOffset + i] = C[i] * x[xOffset + i];
   }
 }
+#endif
 
 )"
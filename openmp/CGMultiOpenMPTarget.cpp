@@ -35,31 +35,24 @@ static inline int getNumberOfDevices() { return omp_get_num_devices(); }
 
 /// Class implementing parallel kernels with OpenMP target directives.
 class CGMultiOpenMPTarget : public CG {
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  std::unique_ptr<floatType[]> vectorDotResults;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
+  /// Partial results of the dot products on each device.
+  enum Partial {
+    PartialDot,
+    /// <r, z> computed together with <r, r> in fusedUpdateKernel().
+    PartialRZ,
+    NumberOfPartials,
+  };
+  /// Partial results of all devices, kept on the devices and only copied to
+  /// the host to combine them.
+  AllocatedArray<floatType> vectorDotResults;
+
+  /// Scalars for the fused kernels, combined from all devices on the host.
+  floatType rho, alpha, beta, r2;
+
+  /// Reset the partial results of device \a d on the device.
+  void zeroPartials(int d);
+  /// Copy the partial results of all devices and combine them in \a results.
+  void combinePartials(floatType results[NumberOfPartials]);
 
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCRS || format == MatrixFormatELL;
@@ -94,6 +87,15 @@ class CGMultiOpenMPTarget : public CG {
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
 
+  virtual bool supportsFusedSolve() override { return true; }
+  virtual void fusedInitKernel(floatType rho) override { this->rho = rho; }
+  virtual void fusedAlphaKernel(Vector _p, Vector _q) override;
+  virtual void fusedUpdateKernel() override;
+  virtual void fusedXpayKernel(Vector _x, Vector _y) override {
+    xpayKernel(_x, beta, _y);
+  }
+  virtual floatType fusedResidualKernel() override { return r2; }
+
 public:
   CGMultiOpenMPTarget()
       : CG(MatrixFormatCRS, PreconditionerJacobi,
@@ -121,14 +123,15 @@ void CGMultiOpenMPTarget::init(const char *matrixFile) {
   CG::init(matrixFile);
   assert(workDistribution->numberOfChunks == devices);
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they can be mapped to the device.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 
-  vectorDotResults.reset(new floatType[devices]);
+  vectorDotResults = allocateArray<floatType>(NumberOfPartials * devices);
 }
 
 static inline void enterMatrixCRS(const MatrixDataCRS &matrix, int N) {
@@ -154,9 +157,9 @@ static inline void enterMatrixELL(const MatrixDataELL &matrix, int N) {
 void CGMultiOpenMPTarget::doTransferTo() {
   // Allocate memory on the device with plain pointers.
   int N = this->N;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
   floatType *x = this->x;
   floatType *k = this->k;
   floatType *vectorDotResults = this->vectorDotResults.get();
@@ -191,7 +194,7 @@ void CGMultiOpenMPTarget::doTransferTo() {
       assert(0 && "Invalid matrix format!");
     }
     if (preconditioner != PreconditionerNone) {
-      floatType *z = this->z.get();
+      floatType *z = getVector(VectorZ);
       #pragma omp target enter data nowait map(alloc: z[offset:length])
 
       switch (preconditioner) {
@@ -205,7 +208,8 @@ void CGMultiOpenMPTarget::doTransferTo() {
       }
     }
 
-    #pragma omp target enter data nowait map(alloc: vectorDotResults[d:1])
+    #pragma omp target enter data nowait \
+        map(alloc: vectorDotResults[d * NumberOfPartials:NumberOfPartials])
   }
 
   #pragma omp taskwait
@@ -235,9 +239,9 @@ static inline void exitMatrixELL(const MatrixDataELL &matrix, int N) {
 void CGMultiOpenMPTarget::doTransferFrom() {
   // Free memory on the device with plain pointers.
   int N = this->N;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
   floatType *x = this->x;
   floatType *k = this->k;
   floatType *vectorDotResults = this->vectorDotResults.get();
@@ -282,7 +286,7 @@ void CGMultiOpenMPTarget::doTransferFrom() {
       assert(0 && "Invalid matrix format!");
     }
     if (preconditioner != PreconditionerNone) {
-      floatType *z = this->z.get();
+      floatType *z = getVector(VectorZ);
       #pragma omp target exit data nowait map(release: z[offset:length])
 
       switch (preconditioner) {
@@ -296,7 +300,8 @@ void CGMultiOpenMPTarget::doTransferFrom() {
       }
     }
 
-    #pragma omp target exit data nowait map(release: vectorDotResults[d:1])
+    #pragma omp target exit data nowait \
+        map(release: vectorDotResults[d * NumberOfPartials:NumberOfPartials])
   }
 
   #pragma omp taskwait
@@ -529,8 +534,43 @@ void CGMultiOpenMPTarget::xpayKernel(Vector _x, floatType a, Vector _y) {
   #pragma omp taskwait
 }
 
+void CGMultiOpenMPTarget::zeroPartials(int d) {
+  floatType *vectorDotResults = this->vectorDotResults.get();
+  int offset = d * NumberOfPartials;
+
+  // Only launch a kernel instead of a blocking transfer from the host.
+#pragma omp target nowait device(d) \
+                   map(vectorDotResults[offset:NumberOfPartials]) \
+                   depend(out: vectorDotResults[offset:NumberOfPartials])
+  for (int i = offset; i < offset + NumberOfPartials; i++) {
+    vectorDotResults[i] = 0;
+  }
+}
+
+void CGMultiOpenMPTarget::combinePartials(floatType results[NumberOfPartials]) {
+  floatType *vectorDotResults = this->vectorDotResults.get();
+
+  for (int d = 0; d < getNumberOfDevices(); d++) {
+    int offset = d * NumberOfPartials;
+
+    #pragma omp target update nowait device(d) \
+        from(vectorDotResults[offset:NumberOfPartials]) \
+        depend(inout: vectorDotResults[offset:NumberOfPartials])
+  }
+  #pragma omp taskwait
+
+  // Always sum in the same order so that the result is reproducible.
+  for (int i = 0; i < NumberOfPartials; i++) {
+    results[i] = 0;
+  }
+  for (int d = 0; d < getNumberOfDevices(); d++) {
+    for (int i = 0; i < NumberOfPartials; i++) {
+      results[i] += vectorDotResults[d * NumberOfPartials + i];
+    }
+  }
+}
+
 floatType CGMultiOpenMPTarget::vectorDotKernel(Vector _a, Vector _b) {
-  floatType res = 0;
   floatType *a = getVector(_a);
   floatType *b = getVector(_b);
   floatType *vectorDotResults = this->vectorDotResults.get();
@@ -538,25 +578,27 @@ floatType CGMultiOpenMPTarget::vectorDotKernel(Vector _a, Vector _b) {
   for (int d = 0; d < getNumberOfDevices(); d++) {
     int offset = workDistribution->offsets[d];
     int length = workDistribution->lengths[d];
+    int result = d * NumberOfPartials + PartialDot;
 
 #ifndef __INTEL_COMPILER
-    // We can't use vectorDotResults[d] directly below, so we can save this...
-    vectorDotResults[d] = 0;
-    #pragma omp target update device(d) to(vectorDotResults[d:1])
+    // The reduction adds to the value on the device.
+    zeroPartials(d);
 #endif
 
 #pragma omp target nowait device(d) map(a[offset:length], b[offset:length]) \
-                                    map(vectorDotResults[d:1])
+                                    map(vectorDotResults[result:1]) \
+                                    depend(inout: vectorDotResults[result:1])
 #ifndef __INTEL_COMPILER
 // 17.0.2 20170213
 // array section derived from "vectorDotResults" is not supported for simd pragma
-#pragma omp teams distribute parallel for simd reduction(+:vectorDotResults[d:1])
+#pragma omp teams distribute parallel for simd \
+                 reduction(+:vectorDotResults[result:1])
 
 // Another possibility:
 // 17.0.2 20170213: internal error: 04010002_1529
-// #pragma omp teams distribute parallel for reduction(+:vectorDotResults[d:1])
+// #pragma omp teams distribute parallel for reduction(+:vectorDotResults[result:1])
     for (int i = offset; i < offset + length; i++) {
-      vectorDotResults[d] += a[i] * b[i];
+      vectorDotResults[result] += a[i] * b[i];
     }
 
 #else
@@ -566,17 +608,91 @@ floatType CGMultiOpenMPTarget::vectorDotKernel(Vector _a, Vector _b) {
     for (int i = offset; i < offset + length; i++) {
       red += a[i] * b[i];
     }
-    vectorDotResults[d] = red;
+    vectorDotResults[result] = red;
 }
 #endif
   }
-  #pragma omp taskwait
+
+  floatType results[NumberOfPartials];
+  combinePartials(results);
+  return results[PartialDot];
+}
+
+void CGMultiOpenMPTarget::fusedAlphaKernel(Vector _p, Vector _q) {
+  floatType pq = vectorDotKernel(_p, _q);
+  alpha = (pq != 0) ? rho / pq : 0;
+}
+
+void CGMultiOpenMPTarget::fusedUpdateKernel() {
+  bool precondition = (preconditioner == PreconditionerJacobi);
+  floatType alpha = this->alpha;
+  floatType *x = this->x;
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
+  // Without preconditioner, z and C are never accessed.
+  floatType *z = precondition ? getVector(VectorZ) : r;
+  floatType *C = precondition ? jacobi->C : r;
+  floatType *vectorDotResults = this->vectorDotResults.get();
 
   for (int d = 0; d < getNumberOfDevices(); d++) {
-    #pragma omp target update device(d) from(vectorDotResults[d:1])
-    res += vectorDotResults[d];
+    int offset = workDistribution->offsets[d];
+    int length = workDistribution->lengths[d];
+    int results = d * NumberOfPartials;
+
+#ifndef __INTEL_COMPILER
+    zeroPartials(d);
+#endif
+
+    // x += alpha * p, r -= alpha * q and z = C * r, including <r, r> and
+    // <r, z> in one launch.
+#pragma omp target nowait device(d) \
+                   map(x[offset:length], p[offset:length], q[offset:length]) \
+                   map(r[offset:length], z[offset:length], C[offset:length]) \
+                   map(vectorDotResults[results:NumberOfPartials]) \
+                   depend(inout: vectorDotResults[results:NumberOfPartials])
+#ifndef __INTEL_COMPILER
+#pragma omp teams distribute parallel for simd \
+                 reduction(+:vectorDotResults[results:NumberOfPartials])
+    for (int i = offset; i < offset + length; i++) {
+      x[i] += alpha * p[i];
+      floatType ri = r[i] - alpha * q[i];
+      r[i] = ri;
+      vectorDotResults[results + PartialDot] += ri * ri;
+      if (precondition) {
+        floatType zi = C[i] * ri;
+        z[i] = zi;
+        vectorDotResults[results + PartialRZ] += ri * zi;
+      }
+    }
+#else
+{
+    floatType rr = 0, rz = 0;
+#pragma omp parallel for reduction(+:rr, rz)
+    for (int i = offset; i < offset + length; i++) {
+      x[i] += alpha * p[i];
+      floatType ri = r[i] - alpha * q[i];
+      r[i] = ri;
+      rr += ri * ri;
+      if (precondition) {
+        floatType zi = C[i] * ri;
+        z[i] = zi;
+        rz += ri * zi;
+      }
+    }
+    vectorDotResults[results + PartialDot] = rr;
+    vectorDotResults[results + PartialRZ] = rz;
+}
+#endif
   }
-  return res;
+
+  floatType results[NumberOfPartials];
+  combinePartials(results);
+
+  r2 = results[PartialDot];
+  floatType oldRho = rho;
+  rho = precondition ? results[PartialRZ] : r2;
+  beta = (oldRho != 0) ? rho / oldRho : 0;
 }
 
 void CGMultiOpenMPTarget::applyPreconditionerKernelJacobi(floatType *x,
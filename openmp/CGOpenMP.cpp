@@ -16,50 +16,182 @@
     You should have received a copy of the GNU General Public License
     along with CGxx.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "../CG.h"
+#include "../CGSpecialized.h"
 #include "../Matrix.h"
 #include "../Preconditioner.h"
 
+const char *CG_OMP_NUMA = "CG_OMP_NUMA";
+const char *CG_OMP_NUMA_NONE = "none";
+const char *CG_OMP_NUMA_FIRST_TOUCH = "first-touch";
+const char *CG_OMP_NUMA_BIND = "bind";
+
+/// Placement of the data on the NUMA nodes.
+enum NumaPlacement {
+  /// Zero the data in parallel, but convert the matrix serially.
+  NumaPlacementNone,
+  /// Convert and initialize all data with the schedule of the kernels.
+  NumaPlacementFirstTouch,
+  /// Additionally bind the block of each thread to its node.
+  NumaPlacementBind,
+};
+
+/// Number of pages on the node of the thread that uses them.
+struct NumaPages {
+  long local = 0;
+  long total = 0;
+};
+
+static const size_t PageSize = 4096;
+
+/// @return the NUMA node of the calling thread, -1 if unknown.
+static int getCurrentNode() {
+#ifdef __linux__
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+    return node;
+  }
+#endif
+  return -1;
+}
+
+/// Get the block [\a from, \a to) of \a n iterations that the calling thread
+/// executes in a loop with schedule(static). Must be called by all threads of
+/// the team.
+static void getStaticBlock(int n, int &from, int &to) {
+  from = n;
+  to = n;
+#pragma omp for schedule(static) nowait
+  for (int i = 0; i < n; i++) {
+    if (i < from) {
+      from = i;
+    }
+    to = i + 1;
+  }
+}
+
+/// Bind all pages completely within [\a begin, \a end) to the node of the
+/// calling thread. Pages shared with other threads are left to first touch.
+static void bindToCurrentNode(const void *begin, const void *end) {
+#ifdef __linux__
+  int node = getCurrentNode();
+  if (node < 0 || node >= (int)(8 * sizeof(unsigned long))) {
+    return;
+  }
+
+  uintptr_t first = ((uintptr_t)begin + PageSize - 1) / PageSize * PageSize;
+  uintptr_t last = (uintptr_t)end / PageSize * PageSize;
+  if (first >= last) {
+    return;
+  }
+
+  unsigned long mask = 1UL << node;
+  // Failing is not fatal, the pages are then placed by first touch.
+  syscall(SYS_mbind, first, last - first, MPOL_BIND, &mask, 8 * sizeof(mask),
+          MPOL_MF_MOVE);
+#endif
+}
+
+/// Count the pages starting within [\a begin, \a end) in \a pages.
+static void countLocalPages(const void *begin, const void *end,
+                            NumaPages &pages) {
+#ifdef __linux__
+  int node = getCurrentNode();
+  uintptr_t first = ((uintptr_t)begin + PageSize - 1) / PageSize * PageSize;
+  if (node < 0 || first >= (uintptr_t)end) {
+    return;
+  }
+
+  unsigned long count = ((uintptr_t)end - first + PageSize - 1) / PageSize;
+  std::unique_ptr<void *[]> addresses(new void *[count]);
+  std::unique_ptr<int[]> status(new int[count]);
+  for (unsigned long i = 0; i < count; i++) {
+    addresses[i] = (void *)(first + i * PageSize);
+  }
+  // Without target nodes, move_pages() only queries the current nodes.
+  if (syscall(SYS_move_pages, 0, count, addresses.get(), NULL, status.get(),
+              0) != 0) {
+    return;
+  }
+
+  for (unsigned long i = 0; i < count; i++) {
+    // Pages that were never touched have a negative status.
+    if (status[i] >= 0) {
+      pages.total++;
+      if (status[i] == node) {
+        pages.local++;
+      }
+    }
+  }
+#endif
+}
+
+/// Zero \a n elements of \a v in parallel with the schedule of the kernels.
+template <class T> static void placeArray(T *v, int n, NumaPlacement placement) {
+#pragma omp parallel
+  {
+    if (placement == NumaPlacementBind) {
+      int from, to;
+      getStaticBlock(n, from, to);
+      bindToCurrentNode(v + from, v + to);
+    }
+
+#pragma omp for schedule(static)
+    for (int i = 0; i < n; i++) {
+      v[i] = 0;
+    }
+  }
+}
+
 /// Class implementing parallel kernels with OpenMP.
-class CGOpenMP : public CG {
+class CGOpenMP : public CGSpecialized<CGOpenMP> {
+  friend class CGSpecialized<CGOpenMP>;
+
   struct MatrixCRSOpenMP : MatrixCRS {
+    NumaPlacement placement;
+
+    MatrixCRSOpenMP(NumaPlacement placement) : placement(placement) {}
+
+    virtual void convert(const MatrixCOO &coo) override;
+
     virtual void allocatePtr(int rows) override;
     virtual void allocateIndexAndValue(int values) override;
   };
   struct MatrixELLOpenMP : MatrixELL {
+    NumaPlacement placement;
+
+    MatrixELLOpenMP(NumaPlacement placement) : placement(placement) {}
+
+    virtual void convert(const MatrixCOO &coo) override;
+
     virtual void allocateLength(int rows) override;
     virtual void allocateIndexAndData() override;
   };
   struct JacobiOpenMP : Jacobi {
+    NumaPlacement placement;
+
+    JacobiOpenMP(NumaPlacement placement) : placement(placement) {}
+
     virtual void allocateC(int N) override;
   };
 
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
+  NumaPlacement numaPlacement = NumaPlacementNone;
+  NumaPages numaPages;
 
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCRS || format == MatrixFormatELL;
@@ -68,55 +200,163 @@ class CGOpenMP : public CG {
     return preconditioner == PreconditionerJacobi;
   }
 
+  virtual void parseEnvironment() override;
   virtual void init(const char *matrixFile) override;
 
   virtual void allocateMatrixCRS() override {
-    matrixCRS.reset(new MatrixCRSOpenMP);
+    matrixCRS.reset(new MatrixCRSOpenMP(numaPlacement));
   }
   virtual void allocateMatrixELL() override {
-    matrixELL.reset(new MatrixELLOpenMP);
+    matrixELL.reset(new MatrixELLOpenMP(numaPlacement));
   }
 
-  virtual void allocateJacobi() override { jacobi.reset(new JacobiOpenMP); }
+  virtual void allocateJacobi() override {
+    jacobi.reset(new JacobiOpenMP(numaPlacement));
+  }
 
   virtual void allocateK() override;
   virtual void allocateX() override;
+  virtual void initK() override;
+  virtual void initX() override;
+  virtual void refreshValues(const floatType *values) override;
+  virtual floatType *allocateVector() override;
+
+  /// Count the pages of all data on the node of the thread using them.
+  void verifyPlacement();
 
   virtual void cpy(Vector _dst, Vector _src) override;
 
   void matvecKernelCRS(floatType *x, floatType *y);
   void matvecKernelELL(floatType *x, floatType *y);
+  template <int Width> void matvecKernelELLFixed(floatType *x, floatType *y);
 
   virtual void matvecKernel(Vector _x, Vector _y) override;
-  virtual void axpyKernel(floatType a, Vector _x, Vector _y) override;
-  virtual void xpayKernel(Vector _x, floatType a, Vector _y) override;
-  virtual floatType vectorDotKernel(Vector _a, Vector _b) override;
+  void axpyKernel(floatType a, floatType *x, floatType *y);
+  void xpayKernel(floatType *x, floatType a, floatType *y);
+  floatType vectorDotKernel(floatType *a, floatType *b);
+
+  virtual void axpyKernel(floatType a, Vector _x, Vector _y) override {
+    axpyKernel(a, getVector(_x), getVector(_y));
+  }
+  virtual void xpayKernel(Vector _x, floatType a, Vector _y) override {
+    xpayKernel(getVector(_x), a, getVector(_y));
+  }
+  virtual floatType vectorDotKernel(Vector _a, Vector _b) override {
+    return vectorDotKernel(getVector(_a), getVector(_b));
+  }
 
   void applyPreconditionerKernelJacobi(floatType *x, floatType *y);
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
 
+  virtual void printSummary() override;
+
 public:
-  CGOpenMP() : CG(MatrixFormatCRS, PreconditionerJacobi) {}
+  CGOpenMP() : CGSpecialized(MatrixFormatCRS, PreconditionerJacobi) {
+    specializedSolve = true;
+  }
 };
 
+void CGOpenMP::MatrixCRSOpenMP::convert(const MatrixCOO &coo) {
+  if (placement == NumaPlacementNone) {
+    MatrixCRS::convert(coo);
+    return;
+  }
+
+  N = coo.N;
+  nz = coo.nz;
+
+  allocatePtr(N);
+  ptr[0] = 0;
+  for (int i = 1; i <= N; i++) {
+    ptr[i] = ptr[i - 1] + coo.nzPerRow[i - 1];
+  }
+
+  // Temporary memory to store the entry in coo for each value. This way only
+  // the thread that computes a row later on writes its index and value.
+  std::unique_ptr<int[]> entries(new int[nz]);
+  std::unique_ptr<int[]> offsets(new int[N]);
+  std::copy(ptr, ptr + N, offsets.get());
+  for (int i = 0; i < nz; i++) {
+    entries[offsets[coo.I[i]]++] = i;
+  }
+
+  allocateIndexAndValue(nz);
+  allocateValueMap();
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < N; i++) {
+    for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+      index[j] = coo.J[entries[j]];
+      value[j] = coo.V[entries[j]];
+      recordValue(entries[j], &value[j]);
+    }
+  }
+}
+
 void CGOpenMP::MatrixCRSOpenMP::allocatePtr(int rows) {
   MatrixCRS::allocatePtr(rows);
 
-#pragma omp parallel for
-  for (int i = 0; i < rows + 1; i++) {
-    ptr[i] = 0;
-  }
+  placeArray(ptr, rows + 1, placement);
 }
 
 void CGOpenMP::MatrixCRSOpenMP::allocateIndexAndValue(int values) {
   MatrixCRS::allocateIndexAndValue(values);
 
-#pragma omp parallel for
+#pragma omp parallel
+  {
+    if (placement == NumaPlacementBind) {
+      int from, to;
+      getStaticBlock(N, from, to);
+      bindToCurrentNode(index + ptr[from], index + ptr[to]);
+      bindToCurrentNode(value + ptr[from], value + ptr[to]);
+    }
+
+#pragma omp for schedule(static)
+    for (int i = 0; i < N; i++) {
+      for (int j = ptr[i]; j < ptr[i + 1]; j++) {
+        index[j] = 0;
+        value[j] = 0.0;
+      }
+    }
+  }
+}
+
+void CGOpenMP::MatrixELLOpenMP::convert(const MatrixCOO &coo) {
+  if (placement == NumaPlacementNone) {
+    MatrixELL::convert(coo);
+    return;
+  }
+
+  N = coo.N;
+  nz = coo.nz;
+  maxNz = coo.getMaxNz();
+  elements = N * maxNz;
+
+  allocateLength(N);
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
-    for (int j = ptr[i]; j < ptr[i + 1]; j++) {
-      index[j] = 0;
-      value[j] = 0.0;
+    length[i] = coo.nzPerRow[i];
+  }
+
+  // Temporary memory to store the entry in coo for each element. This way
+  // only the thread that computes a row later on writes its index and data.
+  std::unique_ptr<int[]> entries(new int[elements]);
+  std::unique_ptr<int[]> offsets(new int[N]());
+  for (int i = 0; i < nz; i++) {
+    int row = coo.I[i];
+    entries[offsets[row] * N + row] = i;
+    offsets[row]++;
+  }
+
+  allocateIndexAndData();
+  allocateValueMap();
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < length[i]; j++) {
+      int k = j * N + i;
+      index[k] = coo.J[entries[k]];
+      data[k] = coo.V[entries[k]];
+      recordValue(entries[k], &data[k]);
     }
   }
 }
@@ -124,21 +364,31 @@ void CGOpenMP::MatrixCRSOpenMP::allocateIndexAndValue(int values) {
 void CGOpenMP::MatrixELLOpenMP::allocateLength(int rows) {
   MatrixELL::allocateLength(rows);
 
-#pragma omp parallel for
-  for (int i = 0; i < rows; i++) {
-    length[i] = 0;
-  }
+  placeArray(length, rows, placement);
 }
 
 void CGOpenMP::MatrixELLOpenMP::allocateIndexAndData() {
   MatrixELL::allocateIndexAndData();
 
-#pragma omp parallel for
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < length[i]; j++) {
-      int k = j * N + i;
-      index[k] = 0;
-      data[k] = 0.0;
+#pragma omp parallel
+  {
+    if (placement == NumaPlacementBind) {
+      int from, to;
+      getStaticBlock(N, from, to);
+      for (int j = 0; j < maxNz; j++) {
+        bindToCurrentNode(index + j * N + from, index + j * N + to);
+        bindToCurrentNode(data + j * N + from, data + j * N + to);
+      }
+    }
+
+    // Zero the padding as well, the fixed width kernels read it.
+#pragma omp for schedule(static)
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < maxNz; j++) {
+        int k = j * N + i;
+        index[k] = 0;
+        data[k] = 0.0;
+      }
     }
   }
 }
@@ -146,63 +396,189 @@ void CGOpenMP::MatrixELLOpenMP::allocateIndexAndData() {
 void CGOpenMP::JacobiOpenMP::allocateC(int N) {
   Jacobi::allocateC(N);
 
-#pragma omp parallel for
-  for (int i = 0; i < N; i++) {
-    C[i] = 0.0;
+  placeArray(C, N, placement);
+}
+
+void CGOpenMP::parseEnvironment() {
+  CG::parseEnvironment();
+
+  const char *env = std::getenv(CG_OMP_NUMA);
+  if (env != NULL && *env != 0) {
+    std::string lower(env);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    if (lower == CG_OMP_NUMA_NONE) {
+      numaPlacement = NumaPlacementNone;
+    } else if (lower == CG_OMP_NUMA_FIRST_TOUCH) {
+      numaPlacement = NumaPlacementFirstTouch;
+    } else if (lower == CG_OMP_NUMA_BIND) {
+      numaPlacement = NumaPlacementBind;
+    } else {
+      std::cerr << "Invalid value for " << CG_OMP_NUMA << "! ("
+                << CG_OMP_NUMA_NONE << ", " << CG_OMP_NUMA_FIRST_TOUCH
+                << ", or " << CG_OMP_NUMA_BIND << ")" << std::endl;
+      invalidEnvironment();
+    }
   }
 }
 
 void CGOpenMP::init(const char *matrixFile) {
   CG::init(matrixFile);
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they are not counted as solving.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 
-#pragma omp parallel for
-  for (int i = 0; i < N; i++) {
-    p[i] = 0.0;
-    q[i] = 0.0;
-    r[i] = 0.0;
-    if (preconditioner != PreconditionerNone) {
-      z[i] = 0.0;
-    }
+  if (numaPlacement != NumaPlacementNone) {
+    verifyPlacement();
   }
 }
 
 void CGOpenMP::allocateK() {
   CG::allocateK();
 
-#pragma omp parallel for
-  for (int i = 0; i < N; i++) {
-    k[i] = 0.0;
-  }
+  placeArray(k, N, numaPlacement);
 }
 
 void CGOpenMP::allocateX() {
   CG::allocateX();
 
-#pragma omp parallel for
+  placeArray(x, N, numaPlacement);
+}
+
+floatType *CGOpenMP::allocateVector() {
+  floatType *v = CG::allocateVector();
+
+  placeArray(v, N, numaPlacement);
+  return v;
+}
+
+void CGOpenMP::initK() {
+  if (numaPlacement == NumaPlacementNone) {
+    CG::initK();
+    return;
+  }
+
+  // Sum up the rows of the converted matrix, in the same order as CG::initK().
+  switch (matrixFormat) {
+  case MatrixFormatCRS:
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+      floatType sum = 0;
+      for (int j = matrixCRS->ptr[i]; j < matrixCRS->ptr[i + 1]; j++) {
+        sum += matrixCRS->value[j];
+      }
+      k[i] = sum;
+    }
+    break;
+  case MatrixFormatELL:
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+      floatType sum = 0;
+      for (int j = 0; j < matrixELL->length[i]; j++) {
+        sum += matrixELL->data[j * N + i];
+      }
+      k[i] = sum;
+    }
+    break;
+  default:
+    assert(0 && "Invalid matrix format!");
+  }
+}
+
+void CGOpenMP::initX() {
+  if (numaPlacement == NumaPlacementNone) {
+    CG::initX();
+    return;
+  }
+
+  // Keep the pages on the nodes chosen in allocateX().
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
-    x[i] = 0.0;
+    x[i] = 0;
   }
 }
 
+void CGOpenMP::refreshValues(const floatType *values) {
+  floatType **valueMap = getHostMatrix()->valueMap.get();
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < nz; i++) {
+    *valueMap[i] = values[i];
+  }
+}
+
+void CGOpenMP::verifyPlacement() {
+  long local = 0, total = 0;
+
+  std::vector<floatType *> allocatedVectors;
+  for (int v = 0; v < vectors.getNumberOfVectors(); v++) {
+    if (vectors.isAllocated(v)) {
+      allocatedVectors.push_back(getVector(static_cast<Vector>(v)));
+    }
+  }
+
+#pragma omp parallel reduction(+:local, total)
+  {
+    NumaPages pages;
+    int from, to;
+    getStaticBlock(N, from, to);
+
+    for (floatType *v : allocatedVectors) {
+      countLocalPages(v + from, v + to, pages);
+    }
+
+    switch (matrixFormat) {
+    case MatrixFormatCRS: {
+      int *ptr = matrixCRS->ptr;
+      countLocalPages(ptr + from, ptr + to, pages);
+      countLocalPages(matrixCRS->index + ptr[from], matrixCRS->index + ptr[to],
+                      pages);
+      countLocalPages(matrixCRS->value + ptr[from], matrixCRS->value + ptr[to],
+                      pages);
+      break;
+    }
+    case MatrixFormatELL:
+      countLocalPages(matrixELL->length + from, matrixELL->length + to, pages);
+      for (int j = 0; j < matrixELL->maxNz; j++) {
+        countLocalPages(matrixELL->index + j * N + from,
+                        matrixELL->index + j * N + to, pages);
+        countLocalPages(matrixELL->data + j * N + from,
+                        matrixELL->data + j * N + to, pages);
+      }
+      break;
+    default:
+      assert(0 && "Invalid matrix format!");
+    }
+
+    if (preconditioner == PreconditionerJacobi) {
+      countLocalPages(jacobi->C + from, jacobi->C + to, pages);
+    }
+
+    local += pages.local;
+    total += pages.total;
+  }
+
+  numaPages.local = local;
+  numaPages.total = total;
+}
+
 void CGOpenMP::cpy(Vector _dst, Vector _src) {
   floatType *dst = getVector(_dst);
   floatType *src = getVector(_src);
 
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     dst[i] = src[i];
   }
 }
 
 void CGOpenMP::matvecKernelCRS(floatType *x, floatType *y) {
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     floatType tmp = 0;
     for (int j = matrixCRS->ptr[i]; j < matrixCRS->ptr[i + 1]; j++) {
@@ -213,7 +589,7 @@ void CGOpenMP::matvecKernelCRS(floatType *x, floatType *y) {
 }
 
 void CGOpenMP::matvecKernelELL(floatType *x, floatType *y) {
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     floatType tmp = 0;
     for (int j = 0; j < matrixELL->length[i]; j++) {
@@ -224,6 +600,23 @@ void CGOpenMP::matvecKernelELL(floatType *x, floatType *y) {
   }
 }
 
+/// Same as matvecKernelELL(), but all rows have \a Width elements.
+template <int Width>
+void CGOpenMP::matvecKernelELLFixed(floatType *x, floatType *y) {
+  int *index = matrixELL->index;
+  floatType *data = matrixELL->data;
+
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < N; i++) {
+    floatType tmp = 0;
+    for (int j = 0; j < Width; j++) {
+      int k = j * N + i;
+      tmp += data[k] * x[index[k]];
+    }
+    y[i] = tmp;
+  }
+}
+
 void CGOpenMP::matvecKernel(Vector _x, Vector _y) {
   floatType *x = getVector(_x);
   floatType *y = getVector(_y);
@@ -233,39 +626,31 @@ void CGOpenMP::matvecKernel(Vector _x, Vector _y) {
     matvecKernelCRS(x, y);
     break;
   case MatrixFormatELL:
-    matvecKernelELL(x, y);
+    matvecELL(x, y);
     break;
   default:
     assert(0 && "Invalid matrix format!");
   }
 }
 
-void CGOpenMP::axpyKernel(floatType a, Vector _x, Vector _y) {
-  floatType *x = getVector(_x);
-  floatType *y = getVector(_y);
-
-#pragma omp parallel for
+void CGOpenMP::axpyKernel(floatType a, floatType *x, floatType *y) {
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     y[i] += a * x[i];
   }
 }
 
-void CGOpenMP::xpayKernel(Vector _x, floatType a, Vector _y) {
-  floatType *x = getVector(_x);
-  floatType *y = getVector(_y);
-
-#pragma omp parallel for
+void CGOpenMP::xpayKernel(floatType *x, floatType a, floatType *y) {
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     y[i] = x[i] + a * y[i];
   }
 }
 
-floatType CGOpenMP::vectorDotKernel(Vector _a, Vector _b) {
+floatType CGOpenMP::vectorDotKernel(floatType *a, floatType *b) {
   floatType res = 0;
-  floatType *a = getVector(_a);
-  floatType *b = getVector(_b);
 
-#pragma omp parallel for reduction(+:res)
+#pragma omp parallel for schedule(static) reduction(+:res)
   for (int i = 0; i < N; i++) {
     res += a[i] * b[i];
   }
@@ -274,7 +659,7 @@ floatType CGOpenMP::vectorDotKernel(Vector _a, Vector _b) {
 }
 
 void CGOpenMP::applyPreconditionerKernelJacobi(floatType *x, floatType *y) {
-#pragma omp parallel for
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < N; i++) {
     y[i] = jacobi->C[i] * x[i];
   }
@@ -293,4 +678,19 @@ void CGOpenMP::applyPreconditionerKernel(Vector _x, Vector _y) {
   }
 }
 
+void CGOpenMP::printSummary() {
+  CGSpecialized::printSummary();
+
+  if (numaPlacement != NumaPlacementNone) {
+    std::cout << std::endl;
+    std::string placementName =
+        (numaPlacement == NumaPlacementBind) ? "bind" : "first-touch";
+    printPadded("NUMA placement:", placementName);
+    if (numaPages.total > 0) {
+      printPadded("Local pages:", std::to_string(numaPages.local) + " of " +
+                                      std::to_string(numaPages.total));
+    }
+  }
+}
+
 CG *CG::getInstance() { return new CGOpenMP; }
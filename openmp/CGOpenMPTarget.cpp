@@ -25,30 +25,6 @@
 
 /// Class implementing parallel kernels with OpenMP target directives.
 class CGOpenMPTarget : public CG {
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
-
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCRS || format == MatrixFormatELL;
   }
@@ -87,20 +63,21 @@ void CGOpenMPTarget::init(const char *matrixFile) {
 
   CG::init(matrixFile);
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they can be mapped to the device.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 }
 
 void CGOpenMPTarget::doTransferTo() {
   // Allocate memory on the device with plain pointers.
   int N = this->N, nz = this->nz;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
   floatType *x = this->x;
   floatType *k = this->k;
 
@@ -127,7 +104,7 @@ void CGOpenMPTarget::doTransferTo() {
     assert(0 && "Invalid matrix format!");
   }
   if (preconditioner != PreconditionerNone) {
-    floatType *z = this->z.get();
+    floatType *z = getVector(VectorZ);
     #pragma omp target enter data map(alloc: z[0:N])
 
     switch (preconditioner) {
@@ -145,9 +122,9 @@ void CGOpenMPTarget::doTransferTo() {
 void CGOpenMPTarget::doTransferFrom() {
   // Free memory on the device with plain pointers.
   int N = this->N, nz = this->nz;
-  floatType *p = this->p.get();
-  floatType *q = this->q.get();
-  floatType *r = this->r.get();
+  floatType *p = getVector(VectorP);
+  floatType *q = getVector(VectorQ);
+  floatType *r = getVector(VectorR);
   floatType *x = this->x;
   floatType *k = this->k;
 
@@ -176,7 +153,7 @@ void CGOpenMPTarget::doTransferFrom() {
     assert(0 && "Invalid matrix format!");
   }
   if (preconditioner != PreconditionerNone) {
-    floatType *z = this->z.get();
+    floatType *z = getVector(VectorZ);
     #pragma omp target exit data map(release: z[0:N])
 
     switch (preconditioner) {
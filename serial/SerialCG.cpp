@@ -21,32 +21,11 @@
 #include <memory>
 
 #include "../CG.h"
+#include "../CGSpecialized.h"
 
 /// Class imlementing serial kernels.
-class SerialCG : public CG {
-  std::unique_ptr<floatType[]> p;
-  std::unique_ptr<floatType[]> q;
-  std::unique_ptr<floatType[]> r;
-  std::unique_ptr<floatType[]> z;
-
-  floatType *getVector(Vector v) {
-    switch (v) {
-    case VectorK:
-      return k;
-    case VectorX:
-      return x;
-    case VectorP:
-      return p.get();
-    case VectorQ:
-      return q.get();
-    case VectorR:
-      return r.get();
-    case VectorZ:
-      return z.get();
-    }
-    assert(0 && "Invalid value of v!");
-    return nullptr;
-  }
+class SerialCG : public CGSpecialized<SerialCG> {
+  friend class CGSpecialized<SerialCG>;
 
   virtual bool supportsMatrixFormat(MatrixFormat format) override {
     return format == MatrixFormatCOO || format == MatrixFormatCRS ||
@@ -63,28 +42,42 @@ class SerialCG : public CG {
   void matvecKernelCOO(floatType *x, floatType *y);
   void matvecKernelCRS(floatType *x, floatType *y);
   void matvecKernelELL(floatType *x, floatType *y);
+  template <int Width> void matvecKernelELLFixed(floatType *x, floatType *y);
 
   virtual void matvecKernel(Vector _x, Vector _y) override;
-  virtual void axpyKernel(floatType a, Vector _x, Vector _y) override;
-  virtual void xpayKernel(Vector _x, floatType a, Vector _y) override;
-  virtual floatType vectorDotKernel(Vector _a, Vector _b) override;
+  void axpyKernel(floatType a, floatType *x, floatType *y);
+  void xpayKernel(floatType *x, floatType a, floatType *y);
+  floatType vectorDotKernel(floatType *a, floatType *b);
+
+  virtual void axpyKernel(floatType a, Vector _x, Vector _y) override {
+    axpyKernel(a, getVector(_x), getVector(_y));
+  }
+  virtual void xpayKernel(Vector _x, floatType a, Vector _y) override {
+    xpayKernel(getVector(_x), a, getVector(_y));
+  }
+  virtual floatType vectorDotKernel(Vector _a, Vector _b) override {
+    return vectorDotKernel(getVector(_a), getVector(_b));
+  }
 
   void applyPreconditionerKernelJacobi(floatType *x, floatType *y);
 
   virtual void applyPreconditionerKernel(Vector _x, Vector _y) override;
 
 public:
-  SerialCG() : CG(MatrixFormatCRS, PreconditionerJacobi) {}
+  SerialCG() : CGSpecialized(MatrixFormatCRS, PreconditionerJacobi) {
+    specializedSolve = true;
+  }
 };
 
 void SerialCG::init(const char *matrixFile) {
   CG::init(matrixFile);
 
-  p.reset(new floatType[N]);
-  q.reset(new floatType[N]);
-  r.reset(new floatType[N]);
+  // Allocate the work vectors now so that they are not counted as solving.
+  getVector(VectorP);
+  getVector(VectorQ);
+  getVector(VectorR);
   if (preconditioner != PreconditionerNone) {
-    z.reset(new floatType[N]);
+    getVector(VectorZ);
   }
 }
 
@@ -121,6 +114,22 @@ void SerialCG::matvecKernelELL(floatType *x, floatType *y) {
   }
 }
 
+/// Same as matvecKernelELL(), but all rows have \a Width elements.
+template <int Width>
+void SerialCG::matvecKernelELLFixed(floatType *x, floatType *y) {
+  int *index = matrixELL->index;
+  floatType *data = matrixELL->data;
+
+  for (int i = 0; i < N; i++) {
+    floatType tmp = 0;
+    for (int j = 0; j < Width; j++) {
+      int k = j * N + i;
+      tmp += data[k] * x[index[k]];
+    }
+    y[i] = tmp;
+  }
+}
+
 void SerialCG::matvecKernel(Vector _x, Vector _y) {
   floatType *x = getVector(_x);
   floatType *y = getVector(_y);
@@ -133,35 +142,27 @@ void SerialCG::matvecKernel(Vector _x, Vector _y) {
     matvecKernelCRS(x, y);
     break;
   case MatrixFormatELL:
-    matvecKernelELL(x, y);
+    matvecELL(x, y);
     break;
   default:
     assert(0 && "Invalid matrix format!");
   }
 }
 
-void SerialCG::axpyKernel(floatType a, Vector _x, Vector _y) {
-  floatType *x = getVector(_x);
-  floatType *y = getVector(_y);
-
+void SerialCG::axpyKernel(floatType a, floatType *x, floatType *y) {
   for (int i = 0; i < N; i++) {
     y[i] += a * x[i];
   }
 }
 
-void SerialCG::xpayKernel(Vector _x, floatType a, Vector _y) {
-  floatType *x = getVector(_x);
-  floatType *y = getVector(_y);
-
+void SerialCG::xpayKernel(floatType *x, floatType a, floatType *y) {
   for (int i = 0; i < N; i++) {
     y[i] = x[i] + a * y[i];
   }
 }
 
-floatType SerialCG::vectorDotKernel(Vector _a, Vector _b) {
+floatType SerialCG::vectorDotKernel(floatType *a, floatType *b) {
   floatType res = 0;
-  floatType *a = getVector(_a);
-  floatType *b = getVector(_b);
 
   for (int i = 0; i < N; i++) {
     res += a[i] * b[i];